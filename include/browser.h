@@ -0,0 +1,29 @@
+/*
+ * Description:
+ * Register browser for commissioning.
+ *
+ * A full-screen table shows a window of BROWSER_ROWS consecutive registers of one slave.
+ * The table only ever has BROWSER_ROWS rows: scrolling does not move the table, it moves
+ * the register window, reformats the visible rows and asks the bus task to poll the new
+ * window. Only the visible registers are read, with one coalesced request, so browsing
+ * a thousand registers costs no more LVGL memory or bus time than browsing ten.
+ *
+ * Drag the table, or the slider next to it, to scroll. The screen is built once, on first
+ * open or by browser_begin(), and kept.
+ */
+
+#ifndef BROWSER_H
+#define BROWSER_H
+
+#include <Arduino.h>
+
+#define BROWSER_ROWS 7             // Visible rows, registers polled at a time
+#define BROWSER_REGISTERS 1000     // Registers reachable by scrolling
+#define BROWSER_ROW_HEIGHT 24      // Row pitch in pixels; one row of drag scrolls one register
+#define BROWSER_REFRESH_MS 100     // How often the table looks for a new read
+
+void browser_begin();                                              // Build the screen at boot
+void browser_open(uint8_t slave, uint8_t function, uint16_t start); // Show the browser screen
+void browser_close();                                              // Back to the previous screen
+
+#endif
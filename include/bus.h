@@ -0,0 +1,96 @@
+/*
+ * Description:
+ * Modbus RS485 bus task.
+ *
+ * One task owns Serial2 and the ModbusMaster instance. It builds a poll plan from the
+ * tag table, coalescing neighbouring registers of the same slave and poll class into a
+ * single read, and runs each read when its poll class is due. Results go to the tag
+ * cache; tags that changed update the virtual tags built on them and then go to the UI
+ * dispatcher and the data logger. Writes from other tasks are queued and sent between
+ * polls; writes on the priority lane (automation) go before any other queued write.
+ *
+ * A write to every slave goes out once as a broadcast (slave ID 0) instead of once per
+ * slave. Slaves do not answer a broadcast, so the bus stays silent for the configured
+ * turnaround delay while they execute it. The panel clock is broadcast the same way
+ * every clock_sync_s seconds, which keeps the slaves' timestamps in line with the log,
+ * and once whenever "clock <epoch>" sets it, even with the periodic broadcast off.
+ * Between polls the task also runs the low-rate FC08 link probe, see diag.h.
+ * The fixed-period PID loop (see pid.h) runs on this task too, ahead of everything else.
+ * A recipe download (see recipe.h) holds the bus chunk after chunk; only due alarm polls,
+ * writes and the PID loop are let in between.
+ *
+ * Due polls run most urgent class first. A poll the response-time model predicts would
+ * still hold the bus when a more urgent poll falls due gives way to a due poll that fits
+ * in the gap, typically a short read of a fast slave.
+ *
+ * When the bus cannot keep up, polls start missing their deadlines. An overload
+ * controller watches the miss rate over BUS_SHED_WINDOW_MS windows and raises the
+ * degradation level, which stretches the periods of the trend and background classes;
+ * alarm and operator tags keep their rates. The level drops again one step at a time
+ * after BUS_SHED_CALM_WINDOWS quiet windows.
+ *
+ * The register browser asks for one window of registers outside the tag table. The
+ * window is read with a single request at the operator poll rate; moving it replaces the
+ * pending window, so a fast scroll costs one read, not one per row passed.
+ *
+ * A register map reload (see tagmap.h) builds the new plan in a spare plan while polling
+ * goes on. The task swaps the tag table and the plan together at the top of a cycle, so
+ * no poll ever mixes the two; blocks present in both plans keep their schedule.
+ */
+
+#ifndef BUS_H
+#define BUS_H
+
+#include <Arduino.h>
+#include "tags.h"
+
+#define BUS_TASK_PRIORITY 3       // Above the data logger, below the system tasks
+#define BUS_TASK_CORE 0           // LVGL runs in loop() on core 1
+#define BUS_WRITE_QUEUE_DEPTH 8   // Writes waiting for the bus
+#define BUS_PRIORITY_QUEUE_DEPTH 4 // Priority writes (automation) waiting for the bus
+#define BUS_WRITE_MAX_REGS 8      // Registers in one queued write
+#define BUS_IDLE_MS 100           // Longest sleep, so a new browse window is picked up quickly
+#define BUS_MAX_BLOCKS 32         // Coalesced reads in the poll plan
+#define BUS_MAX_READ 64           // Registers per read; ModbusMaster's response buffer size
+#define BUS_COALESCE_GAP 4        // Unused registers one read may span to merge two tags
+#define BUS_SHED_LEVELS 4         // Degradation levels, 0 = all classes at their nominal rate
+#define BUS_SHED_WINDOW_MS 2000   // Window the deadline-miss rate is measured over
+#define BUS_SHED_RAISE_PCT 10     // Miss rate that raises the level
+#define BUS_SHED_LOWER_PCT 2      // Miss rate below which a window counts as quiet
+#define BUS_SHED_CALM_WINDOWS 5   // Quiet windows in a row before the level drops
+#define BUS_MISS_FRACTION 4       // A poll later than period / this missed its deadline
+#define BUS_CLOCK_VALID 1577836800u // Epoch seconds below this mean the panel clock is not set (2020)
+
+/* Bus counters; they only ever grow, so callers work with differences */
+struct bus_stats_t {
+  uint32_t transactions;  // Requests sent: polls, writes, broadcasts, recipe and diagnostic frames
+  uint32_t errors;        // Requests that failed or timed out
+  uint32_t busy_us;       // Time spent in transactions, wraps after about 71 minutes
+};
+
+/* Register window polled for the browser */
+struct bus_browse_t {
+  uint8_t slave;
+  uint8_t function;               // 3 or 4
+  uint8_t quality;                // tag_quality_t of the last read, NONE until the first one
+  uint16_t start;                 // First register
+  uint16_t count;                 // Registers, 0 = not browsing
+  uint32_t seq;                   // Incremented by every completed read
+  uint16_t values[BUS_MAX_READ];
+};
+
+bool bus_begin();                                           // Build the poll plan and start the bus task
+bool bus_write(uint8_t slave, uint16_t address, uint16_t value); // Queue a single register write (FC06)
+bool bus_write_priority(uint8_t slave, uint16_t address, uint16_t value); // Queue ahead of all other writes
+bool bus_broadcast(uint16_t address, const uint16_t *values, uint8_t count); // Queue a write to all slaves
+bool bus_reload(const tag_desc_t *table, uint16_t count);  // Plan a staged tag table and swap both in
+bool bus_reload_pending();                                 // True until the bus task has swapped
+void bus_browse(uint8_t slave, uint8_t function, uint16_t start, uint16_t count); // Poll a register window, count 0 stops
+void bus_browse_read(bus_browse_t *out);                   // Copy the latest browse window
+void bus_get_stats(bus_stats_t *stats);                    // Snapshot the bus counters
+void bus_count_frame(uint32_t start_us, bool ok);          // Count a request sent on the bus task
+uint8_t bus_shed_level();                                  // Current degradation level
+uint32_t bus_class_period(uint8_t poll_class);             // Poll period at the current level, in ms
+uint32_t bus_planned_load(uint8_t poll_class);             // Bus share the poll plan needs, in 0.1 %
+
+#endif
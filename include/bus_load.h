@@ -0,0 +1,39 @@
+/*
+ * Description:
+ * RS485 bus utilisation accounting.
+ *
+ * The wire time of a transaction is computed from its request and response sizes, the
+ * character time at the configured baud rate and one inter-frame gap (3.5 characters,
+ * 1750 us above 19200 baud) after each frame. Busy time is accumulated per slave and per
+ * poll class; everything else is idle time. The "busload" console command reports
+ * utilisation, headroom and the load the current poll plan should produce, so poll rates
+ * can be sized before a new register map is deployed.
+ */
+
+#ifndef BUS_LOAD_H
+#define BUS_LOAD_H
+
+#include <Arduino.h>
+#include "tags.h"
+
+#define BUS_LOAD_MAX_SLAVES 8               // Slaves accounted individually
+#define BUS_LOAD_WRITES POLL_CLASS_COUNT    // Accounting class for writes
+#define BUS_LOAD_CLASSES (POLL_CLASS_COUNT + 1)
+#define BUS_BITS_PER_CHAR 10                // Start, 8 data and stop bit (8N1)
+
+/* Frame sizes in bytes, including slave ID, function code and CRC */
+#define MODBUS_READ_REQUEST 8                            // FC03/FC04 request
+#define MODBUS_READ_RESPONSE(n) (5 + 2 * (n))            // FC03/FC04 response with n registers
+#define MODBUS_WRITE_SINGLE 8                            // FC06 request and response
+#define MODBUS_WRITE_MULTIPLE_REQUEST(n) (9 + 2 * (n))   // FC16 request with n registers
+#define MODBUS_WRITE_MULTIPLE_RESPONSE 8                 // FC16 response
+#define MODBUS_EXCEPTION_RESPONSE 5                      // Any exception response
+
+uint32_t bus_char_us(uint32_t baud);   // Time of one character on the wire
+uint32_t bus_gap_us(uint32_t baud);    // Silent interval that ends a frame
+uint32_t bus_wire_us(uint32_t baud, uint16_t request_bytes, uint16_t response_bytes); // Wire time of a transaction
+void bus_load_record(uint8_t slave, uint8_t load_class, uint32_t wire_us);          // Account a transaction
+uint32_t bus_load_busy_us();           // Total busy time, wraps; for rate displays
+void bus_load_begin();                 // Start the accounting window and register "busload"
+
+#endif
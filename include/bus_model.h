@@ -0,0 +1,28 @@
+/*
+ * Description:
+ * Online response-time model of the slaves on the bus.
+ *
+ * Every completed transaction adds one sample of the slave's response latency: the time
+ * the transaction took minus its wire time. The model keeps a moving average per slave
+ * and function code and, for reads, a least-squares fit of latency against the number of
+ * registers read, both with exponential forgetting so a slave that slows down is noticed
+ * within a few dozen polls. The scheduler uses the predictions to tell whether a poll
+ * will be off the bus before a more urgent one falls due.
+ */
+
+#ifndef BUS_MODEL_H
+#define BUS_MODEL_H
+
+#include <Arduino.h>
+
+#define BUS_MODEL_SLAVES 8            // Slaves modelled individually
+#define BUS_MODEL_AVERAGE_SHIFT 3     // Moving average weight of a new sample: 1/8
+#define BUS_MODEL_FIT_WINDOW 32.0f    // Samples the size fit effectively remembers
+#define BUS_MODEL_FIT_SAMPLES 8       // Samples before the size fit is used
+#define BUS_MODEL_DEFAULT_US 20000    // Latency assumed for a slave or function not seen yet
+
+void bus_model_record(uint8_t slave, uint8_t function, uint16_t registers, uint32_t latency_us); // Add a sample
+uint32_t bus_model_latency_us(uint8_t slave, uint8_t function, uint16_t registers); // Predicted latency
+void bus_model_begin();               // Register the "model" console command
+
+#endif
@@ -0,0 +1,71 @@
+/*
+ * Description:
+ * Panel configuration stored as one versioned binary blob in NVS.
+ *
+ * The blob is read once at boot into RAM and handed out by value, so the runtime path
+ * never touches flash or parses anything, and a caller's copy can never change under it.
+ * Updates are copy-on-write: the change is made to a local copy, written to NVS as a
+ * whole (NVS replaces a blob atomically) and only then copied over the active struct
+ * inside a short critical section, which config_get() copies out under as well.
+ *
+ * Fields are only ever appended and CONFIG_VERSION is raised when they are. An older blob
+ * is laid over the defaults, so its settings survive a firmware update.
+ */
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <Arduino.h>
+
+#define CONFIG_VERSION 3                 // Layout version written with the blob
+#define CONFIG_MAX_LISTENERS 4           // Modules notified when the configuration changes
+
+/* Factory defaults, used when NVS holds no configuration */
+#define CONFIG_DEFAULT_RX_PIN 26         // RS-485 receive pin connected to ESP32
+#define CONFIG_DEFAULT_TX_PIN 12         // RS-485 transmit pin connected to ESP32
+#define CONFIG_DEFAULT_BAUD 9600         // RS-485 line speed
+#define CONFIG_DEFAULT_SLAVE_ID 1        // Modbus slave the panel talks to
+#define CONFIG_DEFAULT_SETPOINT_REG 1    // Holding register written from the keyboard
+#define CONFIG_DEFAULT_ROTATION 1        // Display rotation
+#define CONFIG_DEFAULT_BROADCAST_DELAY_MS 100 // Turnaround after a broadcast
+#define CONFIG_DEFAULT_CLOCK_SYNC_S 0    // Clock broadcasts are off until a register is set up
+#define CONFIG_DEFAULT_CLOCK_REG 0       // First of the two clock registers on every slave
+#define CONFIG_DEFAULT_PID_PV_FUNCTION 4 // PID process value from an input register
+#define CONFIG_DEFAULT_PID_OUT_MAX 10000 // PID output range 0-10000 (0.01 % steps)
+
+/* Panel configuration, version 3 */
+struct panel_config_t {
+  uint16_t version;            // CONFIG_VERSION of the code that wrote the blob
+  uint16_t size;               // sizeof(panel_config_t) of the code that wrote the blob
+  uint32_t baud;               // RS-485 line speed
+  uint8_t rx_pin;              // RS-485 receive pin
+  uint8_t tx_pin;              // RS-485 transmit pin
+  uint8_t slave_id;            // Modbus slave ID
+  uint8_t rotation;            // Display rotation, applied at once
+  uint16_t setpoint_reg;       // Holding register written from the keyboard
+  uint16_t broadcast_delay_ms; // Bus silence after a broadcast while slaves execute it (v2)
+  uint16_t clock_sync_s;       // Period of the clock broadcast, 0 = off (v2)
+  uint16_t clock_reg;          // Slave registers the clock goes to, epoch seconds high word first (v2)
+  uint16_t pid_period_ms;      // PID loop period, 0 = off (v3)
+  uint8_t pid_slave;           // Slave of the PID registers, 0 = slave_id (v3)
+  uint8_t pid_pv_function;     // 3 or 4: process value register type (v3)
+  uint16_t pid_pv_reg;         // Process value register (v3)
+  uint16_t pid_out_reg;        // Holding register the output is written to (v3)
+  uint16_t pid_setpoint;       // Setpoint in process value units (v3)
+  uint16_t pid_out_min;        // Lower output limit; the integral is clamped to the limits too (v3)
+  uint16_t pid_out_max;        // Upper output limit (v3)
+  uint16_t pid_kp;             // Proportional gain, hundredths (v3)
+  uint16_t pid_ki;             // Integral gain per second, hundredths (v3)
+  uint16_t pid_kd;             // Derivative gain in seconds, hundredths (v3)
+  uint16_t crc;                // CRC-16 of the bytes before this field; keep last
+};
+
+/* Called after a new configuration became active */
+typedef void (*config_listener_t)(const panel_config_t *old_cfg, const panel_config_t *new_cfg);
+
+void config_begin();                                  // Load the blob from NVS, or the defaults
+panel_config_t config_get();                          // Copy of the active configuration; never reads flash
+bool config_update(const panel_config_t *cfg);        // Validate, persist and activate a new configuration; one task at a time
+bool config_add_listener(config_listener_t listener); // Get notified of configuration changes
+
+#endif
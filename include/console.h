@@ -0,0 +1,27 @@
+/*
+ * Description:
+ * Line-based command console on the USB Serial port.
+ *
+ * Modules register their commands once at startup; console_poll() is called from the
+ * main loop, reads whatever characters are available without blocking and dispatches
+ * a command when a full line has arrived. A binary transfer can take the port over
+ * with console_suspend() so its protocol bytes are not parsed as commands.
+ */
+
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <Arduino.h>
+
+#define CONSOLE_MAX_COMMANDS 16  // Registered command names
+#define CONSOLE_LINE_LEN 96      // Longest accepted command line
+#define CONSOLE_MAX_ARGS 8       // Words per command line, including the command
+
+/* Command handler; argv[0] is the command name */
+typedef void (*console_handler_t)(int argc, char **argv);
+
+bool console_register(const char *name, const char *help, console_handler_t handler); // Add a command
+void console_poll();                 // Read input and run complete commands; never blocks
+void console_suspend(bool suspend);  // Stop or resume reading the Serial port
+
+#endif
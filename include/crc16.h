@@ -0,0 +1,22 @@
+/*
+ * Description:
+ * CRC-16/MODBUS (polynomial 0xA001 reflected, initial value 0xFFFF), the same checksum
+ * the RS485 link uses. Shared by the log, export and configuration formats.
+ */
+
+#ifndef CRC16_H
+#define CRC16_H
+
+#include <Arduino.h>
+
+#define CRC16_INIT 0xFFFF  // Initial value for a new checksum
+
+/* Update a running CRC with a block of bytes. Start with CRC16_INIT. */
+uint16_t crc16_update(uint16_t crc, const void *data, size_t len);
+
+/* CRC of a single block */
+static inline uint16_t crc16(const void *data, size_t len) {
+  return crc16_update(CRC16_INIT, data, len);
+}
+
+#endif
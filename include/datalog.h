@@ -0,0 +1,79 @@
+/*
+ * Description:
+ * Flash data logger with a tiered retention policy.
+ *
+ * Samples are appended at full resolution to a ring of raw segment files. Before the
+ * raw ring runs out of room, its oldest segment is compacted into per-minute
+ * min/max/avg aggregates, and the minute ring is in turn compacted into per-hour
+ * aggregates. Only when the hour ring is full is the oldest data actually discarded.
+ *
+ * All flash work happens on a low-priority background task. Appending only posts to a
+ * queue, so callers on the polling or rendering path never wait for flash, and
+ * compaction writes are throttled by their own byte budget.
+ *
+ * Export: "log export <r|m|h> <seq> [chunk]" streams one segment file over Serial as
+ * frames of up to LOG_EXPORT_CHUNK bytes, read straight from flash:
+ *
+ *   0xA5 0x5A | tier u8 | seq u32 | chunk u16 | len u8 | payload[len] | crc16
+ *
+ * Multi-byte fields are little endian and the CRC-16/MODBUS covers tier..payload.
+ * The host answers every frame with ACK (0x06) followed by the low byte of the chunk
+ * number it stored, or with NAK (0x15). An ACK for any other chunk, such as a late
+ * one for a frame sent before a timeout resend, does not move the transfer on. A frame
+ * with len 0 ends the segment. When the host stops answering, "log resume" restarts
+ * the transfer at the first chunk that was not acknowledged.
+ */
+
+#ifndef DATALOG_H
+#define DATALOG_H
+
+#include <Arduino.h>
+
+/* Retention tiers, finest resolution first */
+enum datalog_tier_t {
+  LOG_TIER_RAW = 0,     // Every sample as appended
+  LOG_TIER_MINUTE,      // One aggregate per tag per minute
+  LOG_TIER_HOUR,        // One aggregate per tag per hour
+  LOG_TIER_COUNT
+};
+
+#define LOG_SEGMENT_RECORDS 512       // Records per segment file
+#define LOG_RAW_SEGMENTS 8            // Segment files kept at full resolution
+#define LOG_MINUTE_SEGMENTS 8         // Segment files of per-minute aggregates
+#define LOG_HOUR_SEGMENTS 8           // Segment files of per-hour aggregates
+
+#define LOG_COMPACT_WRITE_BUDGET 512u // Bytes per second compaction may write to flash
+#define LOG_TASK_PRIORITY 1           // Just above idle, below polling and rendering
+#define LOG_TASK_CORE 0               // Keep flash work off the LVGL core
+
+#define LOG_EXPORT_CHUNK 128          // Payload bytes per export frame
+#define LOG_EXPORT_TIMEOUT_MS 1000    // Time the host has to acknowledge a frame
+#define LOG_EXPORT_RETRIES 3          // Resends of one frame before the transfer is abandoned
+
+/* One log record. Raw samples have count 1 and min == max == avg. */
+struct log_record_t {
+  uint32_t seq;       // Record number within the tier, one higher than the previous record
+  uint32_t time;      // Seconds; bucket start time for aggregates
+  uint16_t tag;       // Tag the value belongs to
+  uint16_t crc;       // CRC-16 of the record with this field zero
+  uint32_t count;     // Number of raw samples folded into this record
+  int32_t min;        // Smallest sample in the bucket
+  int32_t max;        // Largest sample in the bucket
+  int32_t avg;        // Mean of the samples in the bucket
+};
+
+/* Counters for monitoring the logger */
+struct datalog_stats_t {
+  uint32_t appended;             // Samples accepted by datalog_append()
+  uint32_t dropped;              // Samples lost because the queue was full
+  uint32_t segments_compacted;   // Segments folded into the next tier
+  uint32_t segments_expired;     // Segments discarded without being compacted
+  uint8_t used[LOG_TIER_COUNT];  // Occupied segments per tier
+};
+
+bool datalog_begin();                                // Recover segment state and start the log task
+bool datalog_append(uint16_t tag, int32_t value);   // Queue a sample; never touches flash
+void datalog_get_stats(datalog_stats_t *stats);     // Snapshot the logger counters
+bool datalog_export(uint8_t tier, uint32_t seq, uint16_t first_chunk); // Stream a segment over Serial
+
+#endif
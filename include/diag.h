@@ -0,0 +1,48 @@
+/*
+ * Description:
+ * Modbus diagnostics (FC08) and link-quality probing.
+ *
+ * Every DIAG_PROBE_MS the bus task sends one loopback request (FC08 sub-function 0,
+ * "return query data") to the next slave in the poll plan and times the echo. Round
+ * trip time and loss are kept per slave and appended to the data logger under the
+ * DIAG_TAG_RTT / DIAG_TAG_LOSS tags, so the minute and hour tiers hold a long-term trend
+ * of every link. Loss is logged as 0 or 1000 per probe, so aggregates read in per mille.
+ *
+ * "diag" lists the link statistics; "diag <slave>" reads the slave's own bus message,
+ * CRC error and exception counters, which show the link from the slave's side.
+ */
+
+#ifndef DIAG_H
+#define DIAG_H
+
+#include <Arduino.h>
+
+#define DIAG_PROBE_MS 10000         // One probe every 10 s, rotating over the slaves
+#define DIAG_TIMEOUT_MS 200         // Time a slave has to answer a diagnostic request
+#define DIAG_MAX_SLAVES 8           // Slaves with link statistics
+
+/* FC08 sub-functions */
+#define DIAG_RETURN_QUERY_DATA 0x00
+#define DIAG_BUS_MESSAGE_COUNT 0x0B
+#define DIAG_BUS_CRC_ERROR_COUNT 0x0C
+#define DIAG_BUS_EXCEPTION_COUNT 0x0D
+
+/* Log tags of the link trend, outside the tag table */
+#define DIAG_TAG_RTT(slave) (0xFE00 | (slave))   // Round trip time in us
+#define DIAG_TAG_LOSS(slave) (0xFF00 | (slave))  // 0 answered, 1000 lost
+
+/* Link statistics of one slave */
+struct diag_link_t {
+  uint8_t slave;          // 0 = free entry
+  uint32_t probes;        // Loopback requests sent
+  uint32_t lost;          // Of those, not answered or answered wrong
+  uint32_t rtt_us;        // Moving average round trip time
+  uint32_t rtt_min_us;
+  uint32_t rtt_max_us;
+};
+
+int32_t diag_service(uint32_t now, const uint8_t *slaves, uint8_t count); // Bus task: run due probes and readouts
+bool diag_request(uint8_t slave, uint16_t sub_function, uint16_t data, uint16_t *reply); // Bus task: one FC08 request
+void diag_begin();          // Register the "diag" console command
+
+#endif
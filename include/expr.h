@@ -0,0 +1,30 @@
+/*
+ * Description:
+ * Integer expressions over tags, compiled to a compact stack bytecode.
+ *
+ * Expressions use tag names, integer constants (decimal or 0x hex), the C operators
+ *
+ *   ( )  unary - ! ~  * / %  + -  << >>  < <= > >=  == !=  &  ^  |  &&  ||
+ *
+ * with C precedence, and abs(x), min(a, b), max(a, b). Arithmetic is 32-bit and wraps.
+ *
+ * Compiling checks the stack depth the code needs against EXPR_STACK, so evaluation
+ * needs no checks and no allocation. The result is GOOD only if every input tag is GOOD;
+ * a stale or bad input makes it stale or bad, and division by zero makes it bad.
+ */
+
+#ifndef EXPR_H
+#define EXPR_H
+
+#include <Arduino.h>
+#include "tags.h"
+
+#define EXPR_STACK 16   // Evaluation stack depth an expression may need
+
+/* Compile text into code; on failure *error says why */
+bool expr_compile(const char *text, uint8_t *code, size_t max, size_t *len, tag_mask_t *inputs,
+                  const char **error);
+/* Evaluate compiled code against the tag cache; false if an input was never read */
+bool expr_eval(const uint8_t *code, size_t len, int32_t *value, uint8_t *quality);
+
+#endif
@@ -0,0 +1,35 @@
+/*
+ * Description:
+ * Heap fragmentation monitoring and the static allocation mode.
+ *
+ * Fragmentation is reported as the share of free heap that is not in the largest free
+ * block: 0 % means all free memory is one block, values near 100 % mean a large
+ * allocation fails although plenty is free. "heap" prints it for the system heap and for
+ * the LVGL arena, with the lowest free heap since boot and the drift since setup()
+ * finished. The figures also go to the data log every HEAPSTAT_LOG_S seconds, so slow
+ * drift over months of uptime shows in the exported trends.
+ *
+ * Building with PANEL_STATIC_HEAP=1 selects the static mode: every screen and widget is
+ * created during setup() and only shown or hidden afterwards, and LVGL must draw all its
+ * memory from its own fixed arena (LV_MEM_CUSTOM 0 in lv_conf.h) rather than from the
+ * system heap. Any drop in free system heap after boot is then reported as a leak.
+ */
+
+#ifndef HEAPSTAT_H
+#define HEAPSTAT_H
+
+#include <Arduino.h>
+
+#ifndef PANEL_STATIC_HEAP
+#define PANEL_STATIC_HEAP 0          // 1 = allocate everything at boot
+#endif
+
+#define HEAPSTAT_LOG_S 60            // Period of the heap samples in the data log
+#define HEAPSTAT_TAG_FREE 0xFD00     // Log tag: free system heap in bytes
+#define HEAPSTAT_TAG_LARGEST 0xFD01  // Log tag: largest free block in bytes
+#define HEAPSTAT_TAG_FRAG 0xFD02     // Log tag: fragmentation in 0.1 %
+
+uint32_t heapstat_frag(uint32_t free_bytes, uint32_t largest); // Fragmentation in 0.1 %
+void heapstat_begin();               // Call at the end of setup(): record the baseline, start logging
+
+#endif
@@ -0,0 +1,31 @@
+/*
+ * Description:
+ * Raw Modbus RTU frames.
+ *
+ * ModbusMaster always waits for a reply, which is wrong for a broadcast (slave ID 0):
+ * slaves execute a broadcast silently, so every one would end in a response timeout.
+ * It also only knows the data access function codes, not diagnostics (FC08). These
+ * helpers build request frames with their CRC, put them on the wire directly and read
+ * back a response, for the requests ModbusMaster cannot send. They are only used from
+ * the bus task.
+ */
+
+#ifndef MODBUS_RTU_H
+#define MODBUS_RTU_H
+
+#include <Arduino.h>
+
+#define MODBUS_BROADCAST 0          // Slave ID every slave accepts and never answers
+#define MODBUS_RTU_MAX_FRAME 256    // Largest RTU frame, CRC included
+#define MODBUS_RTU_MAX_WRITE 123    // Registers one FC16 request may carry
+
+size_t rtu_frame(uint8_t *frame, uint8_t slave, uint8_t function, const uint8_t *payload,
+                 size_t len);                                        // Add header and CRC; returns the frame length
+size_t rtu_write_frame(uint8_t *frame, uint8_t slave, uint16_t address, const uint16_t *values,
+                       uint8_t count);                               // FC06 for one register, FC16 otherwise
+void rtu_send(HardwareSerial &port, const uint8_t *frame, size_t len, uint32_t gap_us); // Send after a silent gap
+size_t rtu_receive(HardwareSerial &port, uint8_t *frame, size_t max, uint32_t timeout_ms,
+                   uint32_t gap_us);                                 // Read one frame; 0 on timeout
+bool rtu_valid(const uint8_t *frame, size_t len);                    // Length and CRC check
+
+#endif
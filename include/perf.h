@@ -0,0 +1,23 @@
+/*
+ * Description:
+ * On-device performance overlay.
+ *
+ * A small fixed box in the top-right corner of the top layer shows render FPS, CPU load
+ * per core, RS485 bus utilisation, transactions per second and free heap. It is updated
+ * once a second and only its own area is invalidated, so it adds about one small redraw
+ * per second to the numbers it reports. "perf on" / "perf off" toggle it from the console.
+ */
+
+#ifndef PERF_H
+#define PERF_H
+
+#include <lvgl.h>
+
+#define PERF_UPDATE_MS 1000   // Overlay refresh period
+#define PERF_IDLE_GAP_US 20   // Longer gaps between idle hook calls mean the core was busy
+
+void perf_begin();                  // Install the idle hooks and create the (hidden) overlay
+void perf_show(bool show);          // Show or hide the overlay
+void perf_monitor_cb(lv_disp_drv_t *drv, uint32_t time_ms, uint32_t px); // Display driver monitor hook
+
+#endif
@@ -0,0 +1,41 @@
+/*
+ * Description:
+ * Fixed-period PID loop run by the bus task.
+ *
+ * Every pid_period_ms the bus task reads the process value with one targeted read,
+ * computes the output and writes it with FC06, ahead of polls and queued writes. Polls
+ * the response-time model predicts would still be running at the next tick wait until
+ * after it, so the loop period holds however busy the poll plan or the UI is.
+ *
+ * The controller runs in Q16.16 fixed point: proportional on error, integral clamped to
+ * the output limits (anti-windup), derivative on the measurement so setpoint steps do
+ * not kick the output. A failed read skips the tick and leaves the output alone; the
+ * next good tick integrates over the real time since the last good one. Starting the
+ * loop, or changing any pid_* setting, starts from a clean controller state.
+ *
+ * Each tick records how late it started against its schedule (esp_timer microseconds):
+ * mean, standard deviation, worst case with its timestamp, and a histogram. "pid" shows
+ * the loop state and the jitter statistics, "pid reset" clears them.
+ */
+
+#ifndef PID_H
+#define PID_H
+
+#include <Arduino.h>
+#include "config.h"
+
+#define PID_JITTER_BUCKETS 6    // Histogram: <100 us, <500 us, <1 ms, <2 ms, <5 ms, more
+#define PID_MAX_DT_MS 30000     // Longest gap one update integrates over; keeps the Q16 terms in range
+
+/* Controller state carried from tick to tick */
+struct pid_state_t {
+  int64_t integral;       // Q16.16 output units
+  int32_t last_pv;        // Process value of the previous tick
+  bool primed;            // last_pv is valid
+};
+
+int32_t pid_step(pid_state_t *state, const panel_config_t *cfg, int32_t pv, uint32_t dt_ms); // One controller update
+void pid_record(int64_t due_us, int64_t start_us, int32_t pv, int32_t out, bool ok); // Account one tick
+void pid_begin();         // Register the "pid" console command
+
+#endif
@@ -0,0 +1,62 @@
+/*
+ * Description:
+ * Recipe storage and download engine.
+ *
+ * A recipe is a block of consecutive holding registers of one slave, stored on the panel
+ * file system as /rcp_<name>:
+ *
+ *   "RCP1" | slave u8 | reserved u8 | start u16 | count u16 | crc16 | values u16[count]
+ *
+ * (little endian; the CRC-16/MODBUS covers the values). "recipe save" captures a recipe
+ * by reading the registers from a running slave; files can also be uploaded with the
+ * file system image.
+ *
+ * Downloads run on the bus task as raw RTU frames, so every FC16 request carries the
+ * protocol maximum of 123 registers rather than ModbusMaster's 64. Chunks go out back to
+ * back, each right after the previous response, with only due alarm polls and the PID
+ * loop let in between; a chunk predicted to run into the next PID tick waits for it,
+ * like a poll would. After the last chunk the registers are read back (FC03, 125 per
+ * request) and compared. "recipe" reports the time taken against the wire-time limit.
+ */
+
+#ifndef RECIPE_H
+#define RECIPE_H
+
+#include <Arduino.h>
+
+#define RECIPE_MAX_REGS 512          // Registers in one recipe
+#define RECIPE_NAME_LEN 16           // Longest name, including the terminator
+#define RECIPE_WRITE_CHUNK 123       // Registers per FC16 request, the protocol maximum
+#define RECIPE_READ_CHUNK 125        // Registers per FC03 request, the protocol maximum
+#define RECIPE_TIMEOUT_MS 500        // Time a slave has to answer one chunk
+#define RECIPE_RETRIES 2             // Resends of a chunk before the download fails
+
+/* Engine state */
+enum recipe_state_t {
+  RECIPE_IDLE = 0,
+  RECIPE_WRITING,      // Sending FC16 chunks
+  RECIPE_VERIFYING,    // Reading back and comparing
+  RECIPE_CAPTURING,    // Reading a slave for "recipe save"
+  RECIPE_DONE,         // Last job succeeded
+  RECIPE_FAILED,       // Last job failed, see error
+};
+
+/* Progress of the current or last job */
+struct recipe_progress_t {
+  uint8_t state;               // recipe_state_t
+  char name[RECIPE_NAME_LEN];
+  uint16_t done;               // Registers finished in the current phase
+  uint16_t total;              // Registers in the recipe
+  uint32_t elapsed_ms;         // Since the job started
+  uint32_t wire_ms;            // Wire time of the frames sent and received
+  const char *error;           // Why the job failed
+};
+
+bool recipe_download(const char *name);  // Load a recipe from flash and start the download
+bool recipe_capture(const char *name, uint8_t slave, uint16_t start, uint16_t count); // Read a slave into a recipe
+bool recipe_step();                      // Bus task: transfer one chunk; true while a job runs
+uint32_t recipe_next_us();               // Bus task: predicted bus time of the next chunk, 0 if idle
+void recipe_get_progress(recipe_progress_t *out); // Snapshot of the progress
+void recipe_begin();                     // Register the "recipe" console command
+
+#endif
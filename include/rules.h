@@ -0,0 +1,41 @@
+/*
+ * Description:
+ * Local rule engine for simple interlocks.
+ *
+ * Each line of RULES_FILE is one rule:
+ *
+ *   if <condition> then <tag> = <expression> [every <ms>]
+ *   while <condition> then <tag> = <expression> [every <ms>]
+ *
+ * Condition and value are expressions over tags (see expr.h) compiled once at boot; the
+ * target must be a holding register tag. An "if" rule writes once each time its
+ * condition becomes true; a "while" rule writes again every <ms> (default
+ * RULES_MIN_INTERVAL_MS) for as long as it stays true. A condition or value that is not
+ * GOOD never writes.
+ *
+ * Rules are evaluated on the bus task when one of their inputs changes in the cache and
+ * their writes go out on the priority write lane, ahead of queued UI writes. Evaluation
+ * stops for the cycle once RULES_BUDGET_US is spent, leaving the remaining rules for the
+ * next cycle, and all rules together write at most RULES_MAX_WRITES_PER_S times a
+ * second, so automation cannot starve polling or rendering.
+ */
+
+#ifndef RULES_H
+#define RULES_H
+
+#include <Arduino.h>
+#include "tags.h"
+
+#define RULES_FILE "/rules.txt"      // Rules on the panel file system
+#define RULES_MAX 16                 // Rules
+#define RULES_CODE_BYTES 1024        // Bytecode of all conditions and values together
+#define RULES_LINE_LEN 160           // Longest rule line
+#define RULES_MIN_INTERVAL_MS 1000   // Default and shortest time between writes of one rule
+#define RULES_MAX_INTERVAL_MS 86400000u // Longest "every" interval, one day
+#define RULES_MAX_WRITES_PER_S 10    // Writes of all rules together
+#define RULES_BUDGET_US 500          // Evaluation time per bus cycle
+
+bool rules_begin();                  // Load and compile the rules, register "rules"
+void rules_update(tag_mask_t changed); // Bus task: evaluate rules whose inputs changed
+
+#endif
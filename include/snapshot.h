@@ -0,0 +1,30 @@
+/*
+ * Description:
+ * Warm-start snapshot of the tag cache.
+ *
+ * Every SNAPSHOT_PERIOD_MS a low-priority task saves the cached value, quality and poll
+ * time of every tag that has been read to one small file, if anything changed since the
+ * last save. At boot the file is loaded into the cache before the first frame, with
+ * every value marked TAG_QUALITY_STALE, so the screens show last-known values instead of
+ * placeholders until the first polls replace them.
+ *
+ * Records are matched to tags by slave, function and address, with the default slave
+ * stored as the slave ID it stood for, so a changed tag table or default slave
+ * restores whatever still matches and ignores the rest.
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <Arduino.h>
+
+#define SNAPSHOT_FILE "/cache"          // Current snapshot
+#define SNAPSHOT_TEMP_FILE "/cache.tmp" // Snapshot being written
+#define SNAPSHOT_PERIOD_MS 60000        // Time between saves
+#define SNAPSHOT_TASK_PRIORITY 1        // Same as the data logger
+#define SNAPSHOT_TASK_CORE 0            // Keep flash work off the LVGL core
+
+bool snapshot_begin();   // Restore the last snapshot into the cache and start saving
+bool snapshot_save();    // Save the cache now if it changed
+
+#endif
@@ -0,0 +1,30 @@
+/*
+ * Description:
+ * File system backend shared by touch calibration and the data logger.
+ *
+ * The backend is chosen at build time with STORAGE_BACKEND. SPIFFS stays the default so
+ * existing panels keep their data; LittleFS mounts faster, keeps its write speed as the
+ * partition fills and is the maintained file system on the ESP32. Both use the same
+ * "spiffs" partition, so switching backends reformats it on the first boot.
+ */
+
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <Arduino.h>
+#include <FS.h>
+
+#define STORAGE_BACKEND_SPIFFS 0
+#define STORAGE_BACKEND_LITTLEFS 1
+
+#ifndef STORAGE_BACKEND
+#define STORAGE_BACKEND STORAGE_BACKEND_SPIFFS
+#endif
+
+bool storage_begin();         // Mount the file system, formatting only if it cannot be mounted
+fs::FS &storage_fs();         // File system used for all panel files
+const char *storage_name();   // Backend name for diagnostics
+size_t storage_total_bytes(); // Partition size
+size_t storage_used_bytes();  // Bytes in use
+
+#endif
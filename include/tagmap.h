@@ -0,0 +1,32 @@
+/*
+ * Description:
+ * Register map on the panel file system, loaded at boot and reloadable at runtime.
+ *
+ * Each line of TAGMAP_FILE describes one polled tag:
+ *
+ *   name slave function address class
+ *
+ * slave 0 stands for the configured slave ID, function is 3 or 4, the address may be
+ * written in hex (0x...) and class is alarm, operator, trend or background. Lines starting
+ * with # are comments. A line naming a built-in tag overrides its register. Two polled
+ * tags may not read the same register.
+ *
+ * "tags reload" parses the file into a spare tag table while polling goes on and hands it
+ * to the bus task, which swaps table and poll plan in between two polls (see bus.h).
+ * Tags keep their IDs; the cache carries over for tags whose register is unchanged. A
+ * file with any error is rejected as a whole and the running map stays in place.
+ */
+
+#ifndef TAGMAP_H
+#define TAGMAP_H
+
+#include <Arduino.h>
+
+#define TAGMAP_FILE "/tags.txt"   // Register map on the panel file system
+#define TAGMAP_NAME_LEN 16        // Longest name, including the terminator
+#define TAGMAP_LINE_LEN 96        // Longest line
+
+bool tagmap_begin();              // Load the map before the bus starts; register "tags"
+bool tagmap_reload();             // Parse the map and hand it to the bus task
+
+#endif
@@ -0,0 +1,103 @@
+/*
+ * Description:
+ * Tag table and register cache.
+ *
+ * A tag names one Modbus register on one slave. The bus task polls tags according to
+ * their poll class and stores the results in the cache; everything else reads tags from
+ * the cache and never touches the bus.
+ *
+ * Virtual tags (function TAG_FUNCTION_VIRTUAL) are not polled; their values are computed
+ * from other tags, see vtags.h. Tags added at boot follow the built-in ones.
+ *
+ * The built-in tags and their coalesced poll plan are generated at build time from
+ * registers.csv by tools/gen_tags.py, so a panel running the compiled-in map parses
+ * nothing and plans nothing at boot.
+ *
+ * The register map can be reloaded at runtime (see tagmap.h). The new descriptors are
+ * staged in a spare table and swapped in by the bus task between polls. A tag keeps its
+ * ID across reloads, so virtual tags, rules, UI bindings and the log stay attached to it;
+ * a tag dropped from the map is retired rather than removed and its ID is not reused
+ * until the next boot.
+ */
+
+#ifndef TAGS_H
+#define TAGS_H
+
+#include <Arduino.h>
+
+#define TAG_MAX 64            // Tags the cache can hold
+#define TAG_DEFAULT_SLAVE 0   // Descriptor slave 0: use the slave ID from the panel configuration
+#define TAG_FUNCTION_VIRTUAL 0 // Descriptor function 0: computed, never polled
+#define TAG_FUNCTION_RETIRED 0xFF // Dropped from the register map by a reload, never polled
+
+/* One bit per tag ID, for sets of tags that changed */
+typedef uint64_t tag_mask_t;
+#define TAG_BIT(id) ((tag_mask_t)1 << (id))
+
+/* Poll classes, most urgent first */
+enum poll_class_t {
+  POLL_ALARM = 0,       // Alarm and interlock inputs
+  POLL_OPERATOR,        // Values shown on the operator screens
+  POLL_TREND,           // Logged values
+  POLL_BACKGROUND,      // Everything else
+  POLL_CLASS_COUNT
+};
+
+/* Nominal poll period of each class in milliseconds */
+#define POLL_PERIOD_ALARM 250
+#define POLL_PERIOD_OPERATOR 500
+#define POLL_PERIOD_TREND 2000
+#define POLL_PERIOD_BACKGROUND 10000
+
+/* Quality of a cached value */
+enum tag_quality_t {
+  TAG_QUALITY_NONE = 0,   // Never read
+  TAG_QUALITY_GOOD,       // Read successfully on the last poll
+  TAG_QUALITY_BAD,        // Last poll failed; value is the last good one
+  TAG_QUALITY_STALE,      // Restored from the warm-start snapshot, not polled since boot
+};
+
+/* Compiled-in tags: TAG_<NAME> IDs and TAG_BUILTIN_COUNT, generated from registers.csv */
+#include "generated/tag_ids.h"
+
+/* Where a tag lives on the bus */
+struct tag_desc_t {
+  const char *name;     // Short name for the console and logs
+  uint8_t slave;        // Modbus slave ID, or TAG_DEFAULT_SLAVE
+  uint8_t function;     // 3 = holding register, 4 = input register, 0 = virtual, 0xFF = retired
+  uint16_t address;     // Register address (zero based)
+  uint8_t poll_class;   // poll_class_t
+};
+
+/* One coalesced read of the compiled-in poll plan */
+struct tag_block_t {
+  uint8_t slave;        // Descriptor slave, TAG_DEFAULT_SLAVE included
+  uint8_t function;     // 3 or 4
+  uint8_t poll_class;   // poll_class_t shared by all tags in the block
+  uint16_t start;       // First register read
+  uint16_t count;       // Registers read
+  uint16_t first;       // Index of the block's first tag in the plan's tag list
+  uint16_t tags;        // Number of tags served by the block
+};
+
+/* Cached value of a tag */
+struct tag_value_t {
+  int32_t value;        // Last good value
+  uint8_t quality;      // tag_quality_t
+  uint32_t time_ms;     // millis() of the last poll
+};
+
+uint16_t tag_count();                                     // Tags in the table
+const tag_desc_t *tag_desc(uint16_t id);                  // Bus task and boot only: descriptor in the live table
+bool tag_get_desc(uint16_t id, tag_desc_t *out);          // Consistent copy of a descriptor, from any task
+uint16_t tag_period_ms(uint8_t poll_class);               // Nominal period of a poll class
+bool tag_store(uint16_t id, int32_t value, uint8_t quality); // Update the cache; true if the tag changed
+bool tag_read(uint16_t id, tag_value_t *out);             // Consistent copy of a cached value
+bool tag_restore(uint16_t id, int32_t value, uint32_t time_ms); // Seed a never-polled tag with a stale value
+int tag_add(const tag_desc_t *desc);                      // Append a tag at boot; its ID, or -1 if full
+int tag_find(const char *name);                           // ID of a tag by name, or -1
+tag_desc_t *tag_stage(uint16_t *count);                   // Copy the live table into the spare one for editing
+tag_mask_t tag_swap(uint16_t count);                      // Bus task: make the staged table live; returns cleared tags
+const tag_block_t *tag_compiled_plan(uint8_t *blocks, const uint16_t **tags); // Generated plan, NULL once the map was replaced
+
+#endif
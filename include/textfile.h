@@ -0,0 +1,22 @@
+/*
+ * Description:
+ * Line reader shared by the text configuration files (register map, virtual tags and
+ * rules).
+ *
+ * A line that does not fit the caller's buffer is reported as too long and the rest of
+ * it is skipped up to the newline, so it is never parsed as a cut-off definition and
+ * its tail never turns up as a line of its own.
+ */
+
+#ifndef TEXTFILE_H
+#define TEXTFILE_H
+
+#include <Arduino.h>
+#include <FS.h>
+
+/* Read the next line into line, of len bytes. Returns the text with leading blanks,
+   comment and DOS line end stripped, or NULL at the end of the file. *too_long is set
+   when the line did not fit; the text is then not to be used. */
+char *textfile_read_line(fs::File &f, char *line, size_t len, bool *too_long);
+
+#endif
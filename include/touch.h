@@ -0,0 +1,61 @@
+/*
+ * Description:
+ * Three-point affine touch calibration.
+ *
+ * The controller's raw readings relate to panel pixels by an affine map: scale, skew,
+ * offset and any swap or mirroring of the axes. Three targets that are not on one line,
+ * touched once each, fix all six coefficients. The calibration is kept in native panel
+ * coordinates (rotation 0), stored as /TouchCal3P:
+ *
+ *   "TCA1" | raw x u16[3] | raw y u16[3] | target x u16[3] | target y u16[3] | crc16
+ *
+ * (little endian; the CRC-16/MODBUS covers everything before it).
+ *
+ * touch_set_rotation() folds the display rotation into the calibration and quantizes
+ * the result to a Q16 fixed-point matrix, once per rotation. Mapping a sample is then
+ * two multiply-adds per axis, and the display can rotate at runtime without touching
+ * the calibration.
+ *
+ * Touch-to-photon latency: the touch read timestamps the raw sample that starts a press,
+ * LVGL's input feedback hook reports the object the press landed on, and the first
+ * flush that covers that object ends the measurement, once its pixels are in the
+ * display's memory. The time from the finger landing to the next touch read (up to the
+ * indev read period) is not seen. Presses on the bare screen, and presses whose object
+ * is not redrawn within TOUCH_LATENCY_TIMEOUT_MS, are counted as unmeasured. "touch
+ * latency" shows the histogram, "touch latency reset" clears it.
+ */
+
+#ifndef TOUCH_H
+#define TOUCH_H
+
+#include <Arduino.h>
+#include <lvgl.h>
+
+#define TOUCH_CAL_FILE "/TouchCal3P"  // Calibration points on the panel file system
+#define TOUCH_CAL_POINTS 3            // Targets touched during calibration
+#define TOUCH_FRAC_BITS 16            // Fraction bits of the fixed-point matrix
+#define TOUCH_LATENCY_BUCKETS 7       // Histogram: <20, <35, <50, <75, <100, <150 ms, more
+#define TOUCH_LATENCY_TIMEOUT_MS 500  // A press not redrawn by then is not measured
+
+/* Calibration: raw readings and the target pixels they were taken at, rotation 0 */
+struct touch_cal_t {
+  uint32_t magic;
+  uint16_t raw_x[TOUCH_CAL_POINTS];
+  uint16_t raw_y[TOUCH_CAL_POINTS];
+  uint16_t x[TOUCH_CAL_POINTS];
+  uint16_t y[TOUCH_CAL_POINTS];
+  uint16_t crc;                       // CRC-16 of the bytes before this field; keep last
+};
+
+void touch_begin();                                        // Register the "touch" console command
+void touch_targets(touch_cal_t *cal, uint16_t width, uint16_t height); // Targets for a panel of width x height at rotation 0
+bool touch_set_calibration(const touch_cal_t *cal);        // Use a calibration; false if its points are on one line
+bool touch_load(touch_cal_t *cal);                         // Read the stored calibration; false if absent or damaged
+bool touch_save(touch_cal_t *cal);                         // Store a calibration, filling in magic and CRC
+void touch_set_rotation(uint8_t rotation, uint16_t width, uint16_t height); // Screen size at that rotation
+bool touch_map(uint16_t raw_x, uint16_t raw_y, int16_t *x, int16_t *y);       // Raw sample to screen pixel; false if uncalibrated
+void touch_sample(bool pressed, int64_t sample_us);       // Touch read: state and esp_timer time of the raw sample
+void touch_feedback_cb(lv_indev_drv_t *drv, uint8_t code); // Input driver feedback hook
+void touch_flushed(const lv_area_t *area, int64_t done_us); // Display flush: area now on the panel
+
+#endif
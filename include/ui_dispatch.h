@@ -0,0 +1,25 @@
+/*
+ * Description:
+ * Frame-batched handoff of tag updates from the bus task to the LVGL thread.
+ *
+ * LVGL must only be called from the UI thread. Instead of posting one message per
+ * update, the bus task sets the tag's bit in an atomic dirty bitmap. Once per
+ * lv_timer_handler() cycle the UI thread swaps the bitmap out word by word and calls
+ * the bound handler for every dirty tag in a single pass, so the cross-core cost is
+ * the same whether one tag changed or all of them did.
+ */
+
+#ifndef UI_DISPATCH_H
+#define UI_DISPATCH_H
+
+#include <Arduino.h>
+#include "tags.h"
+
+/* Applies a tag update to the screen; runs on the UI thread */
+typedef void (*ui_tag_handler_t)(uint16_t id, const tag_value_t *value);
+
+void ui_dispatch_mark(uint16_t id);                           // Flag a tag as changed; any task, never blocks
+void ui_dispatch_bind(uint16_t id, ui_tag_handler_t handler); // Set the handler of a tag
+void ui_dispatch_drain();                                     // Apply all pending updates; UI thread only
+
+#endif
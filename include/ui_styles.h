@@ -0,0 +1,33 @@
+/*
+ * Description:
+ * Shared style sheet and panel theme.
+ *
+ * All HMI widgets reference the same statically allocated styles, which are built once
+ * at boot. The panel theme attaches them when a widget is created, replacing the LVGL
+ * default theme and the handful of styles it adds to every object.
+ *
+ * Building with UI_RENDER_LITE=1 selects the lightweight render profile: no shadows,
+ * gradients, rounded corners or cursor animation, and anti-aliasing switched off in
+ * the display driver. The "ui" console command times full redraws of the button and
+ * keyboard screens so the two profiles can be compared on the panel.
+ *
+ * The saving of the lite profile is not measured yet: no panel was at hand when it was
+ * added. Flash env:esp32doit-devkit-v1 and env:esp32doit-devkit-v1-lite in turn, run
+ * "ui" on each and record both lines here.
+ */
+
+#ifndef UI_STYLES_H
+#define UI_STYLES_H
+
+#include <lvgl.h>
+
+#ifndef UI_RENDER_LITE
+#define UI_RENDER_LITE 0    // 1 = lightweight render profile
+#endif
+
+extern lv_style_t style_default;  // Button, released
+extern lv_style_t style_pressed;  // Button, pressed
+
+void ui_styles_init(lv_disp_t *disp); // Build the style sheet and install the panel theme
+
+#endif
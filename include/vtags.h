@@ -0,0 +1,28 @@
+/*
+ * Description:
+ * Virtual tags: values computed from other tags.
+ *
+ * Each line of VTAG_FILE defines one virtual tag as "name = expression" (see expr.h). A
+ * definition may use virtual tags defined above it. Lines starting with # are comments.
+ *
+ * The file is read once at boot and every expression is compiled to bytecode. Evaluation
+ * runs on the bus task whenever a poll changes one of a virtual tag's inputs and only
+ * walks the bytecode, with no parsing and no allocation.
+ */
+
+#ifndef VTAGS_H
+#define VTAGS_H
+
+#include <Arduino.h>
+#include "tags.h"
+
+#define VTAG_FILE "/vtags.txt"   // Definitions on the panel file system
+#define VTAG_MAX 16              // Virtual tags
+#define VTAG_NAME_LEN 16         // Longest name, including the terminator
+#define VTAG_CODE_BYTES 1024     // Bytecode of all virtual tags together
+#define VTAG_LINE_LEN 128        // Longest definition line
+
+bool vtags_begin();                      // Load and compile the definitions, add the tags
+tag_mask_t vtags_update(tag_mask_t changed); // Bus task: re-evaluate dependents; returns changed plus changed virtual tags
+
+#endif
@@ -0,0 +1,171 @@
+/*
+ * Description:
+ * Register browser. See browser.h.
+ */
+
+#include "browser.h"
+#include "bus.h"
+#include "tags.h"
+#include <lvgl.h>
+
+#define BROWSER_LAST_TOP (BROWSER_REGISTERS - BROWSER_ROWS)
+#define SHOWN_NONE -1              // Row shows a placeholder instead of a value
+
+static lv_obj_t *screen = NULL;
+static bool is_open = false;
+static lv_obj_t *previous = NULL;  // Screen to return to
+static lv_obj_t *title;
+static lv_obj_t *table;
+static lv_obj_t *slider;
+static lv_timer_t *timer;
+
+static uint8_t slave;
+static uint8_t function;
+static uint16_t top;               // Register in the first row
+static lv_coord_t drag_y;          // Drag distance not yet turned into rows
+static uint32_t shown_seq;         // Bus read shown in the table
+static int32_t shown[BROWSER_ROWS]; // Value in each row, SHOWN_NONE for a placeholder
+
+/* Show one row, touching the table only if the row changed */
+static void show_row(uint8_t row, int32_t value, const char *placeholder) {
+  if (value == shown[row] && value != SHOWN_NONE)
+    return;  // Placeholders are always written, their text differs
+  shown[row] = value;
+  if (value == SHOWN_NONE) {
+    lv_table_set_cell_value(table, row + 1, 1, placeholder);
+    lv_table_set_cell_value(table, row + 1, 2, "");
+  } else {
+    lv_table_set_cell_value_fmt(table, row + 1, 1, "%d", (int)value);
+    lv_table_set_cell_value_fmt(table, row + 1, 2, "0x%04X", (unsigned)value);
+  }
+}
+
+/* Fill the value column from the latest read of the window */
+static void refresh(lv_timer_t *t) {
+  bus_browse_t w;
+  bus_browse_read(&w);
+  if (w.seq == shown_seq || w.slave != slave || w.function != function || w.start != top ||
+      w.count != BROWSER_ROWS)
+    return;  // Nothing new, or still the read of an old window
+  shown_seq = w.seq;
+
+  for (uint8_t row = 0; row < BROWSER_ROWS; row++)
+    show_row(row, w.quality == TAG_QUALITY_GOOD ? w.values[row] : SHOWN_NONE,
+             w.quality == TAG_QUALITY_BAD ? "error" : "...");
+}
+
+/* Move the window: relabel the rows and poll the new registers */
+static void scroll_to(int32_t first) {
+  top = constrain(first, 0, BROWSER_LAST_TOP);
+  bus_browse(slave, function, top, BROWSER_ROWS);
+
+  lv_label_set_text_fmt(title, "Slave %u %s %u-%u", slave, function == 4 ? "IR" : "HR", top,
+                        top + BROWSER_ROWS - 1);
+  for (uint8_t row = 0; row < BROWSER_ROWS; row++) {
+    lv_table_set_cell_value_fmt(table, row + 1, 0, "%u", top + row);
+    show_row(row, SHOWN_NONE, "...");
+  }
+}
+
+/* Drag on the table: one row of movement scrolls one register */
+static void table_event_cb(lv_event_t *e) {
+  lv_event_code_t code = lv_event_get_code(e);
+  if (code == LV_EVENT_PRESSED) {
+    drag_y = 0;
+  } else if (code == LV_EVENT_PRESSING) {
+    lv_point_t v;
+    lv_indev_get_vect(lv_indev_get_act(), &v);
+    drag_y += v.y;
+    int32_t rows = drag_y / BROWSER_ROW_HEIGHT;
+    if (rows != 0) {
+      drag_y -= rows * BROWSER_ROW_HEIGHT;
+      scroll_to(top - rows);  // Dragging down shows lower addresses
+      lv_slider_set_value(slider, BROWSER_LAST_TOP - top, LV_ANIM_OFF);
+    }
+  }
+}
+
+/* The slider is a vertical scrollbar; its maximum is at the top */
+static void slider_event_cb(lv_event_t *e) {
+  if (lv_event_get_code(e) == LV_EVENT_VALUE_CHANGED)
+    scroll_to(BROWSER_LAST_TOP - lv_slider_get_value(slider));
+}
+
+static void back_event_cb(lv_event_t *e) {
+  if (lv_event_get_code(e) == LV_EVENT_CLICKED)
+    browser_close();
+}
+
+/* Build the browser screen; it is kept for the program lifetime and only loaded and
+   unloaded, so browsing does not churn the LVGL heap */
+static void build() {
+  screen = lv_obj_create(NULL);
+
+  lv_obj_t *back = lv_btn_create(screen);
+  lv_obj_set_size(back, 60, 30);
+  lv_obj_align(back, LV_ALIGN_TOP_LEFT, 4, 4);
+  lv_obj_add_event_cb(back, back_event_cb, LV_EVENT_ALL, NULL);
+  lv_obj_t *back_label = lv_label_create(back);
+  lv_label_set_text(back_label, LV_SYMBOL_LEFT " Back");
+
+  title = lv_label_create(screen);
+  lv_obj_align(title, LV_ALIGN_TOP_LEFT, 76, 10);
+
+  // Header plus BROWSER_ROWS rows; the table never grows, only its contents change
+  table = lv_table_create(screen);
+  lv_table_set_col_cnt(table, 3);
+  lv_table_set_row_cnt(table, BROWSER_ROWS + 1);
+  lv_table_set_col_width(table, 0, 80);
+  lv_table_set_col_width(table, 1, 100);
+  lv_table_set_col_width(table, 2, 100);
+  lv_obj_set_style_pad_ver(table, (BROWSER_ROW_HEIGHT - 16) / 2, LV_PART_ITEMS);
+  lv_obj_clear_flag(table, LV_OBJ_FLAG_SCROLLABLE);  // Scrolling moves the window instead
+  lv_obj_align(table, LV_ALIGN_TOP_LEFT, 4, 40);
+  lv_obj_add_event_cb(table, table_event_cb, LV_EVENT_ALL, NULL);
+  lv_table_set_cell_value(table, 0, 0, "Reg");
+  lv_table_set_cell_value(table, 0, 1, "Value");
+  lv_table_set_cell_value(table, 0, 2, "Hex");
+
+  slider = lv_slider_create(screen);
+  lv_obj_set_size(slider, 12, BROWSER_ROWS * BROWSER_ROW_HEIGHT);
+  lv_obj_align(slider, LV_ALIGN_TOP_RIGHT, -10, 40 + BROWSER_ROW_HEIGHT);
+  lv_slider_set_range(slider, 0, BROWSER_LAST_TOP);
+  lv_obj_add_event_cb(slider, slider_event_cb, LV_EVENT_ALL, NULL);
+
+  timer = lv_timer_create(refresh, BROWSER_REFRESH_MS, NULL);
+  lv_timer_pause(timer);
+}
+
+/* Build the screen now rather than on first open */
+void browser_begin() {
+  if (screen == NULL)
+    build();
+}
+
+/* Show the browser screen and start polling its window */
+void browser_open(uint8_t browse_slave, uint8_t browse_function, uint16_t start) {
+  if (is_open)
+    return;
+  if (screen == NULL)
+    build();
+  is_open = true;
+  slave = browse_slave;
+  function = browse_function;
+  shown_seq = 0;
+  previous = lv_scr_act();
+
+  scroll_to(start);
+  lv_slider_set_value(slider, BROWSER_LAST_TOP - top, LV_ANIM_OFF);
+  lv_timer_resume(timer);
+  lv_scr_load(screen);
+}
+
+/* Stop polling and return to the previous screen */
+void browser_close() {
+  if (!is_open)
+    return;
+  bus_browse(0, 0, 0, 0);
+  lv_timer_pause(timer);
+  lv_scr_load(previous);
+  is_open = false;
+}
@@ -0,0 +1,750 @@
+/*
+ * Description:
+ * Modbus RS485 bus task: poll plan, scheduler, write queue and clock broadcast. See bus.h.
+ */
+
+#include "bus.h"
+#include "bus_load.h"
+#include "bus_model.h"
+#include "config.h"
+#include "console.h"
+#include "datalog.h"
+#include "diag.h"
+#include "modbus_rtu.h"
+#include "pid.h"
+#include "recipe.h"
+#include "rules.h"
+#include "tags.h"
+#include "ui_dispatch.h"
+#include "vtags.h"
+#include <ModbusMaster.h>
+#include <sys/time.h>
+
+/* One coalesced read in the poll plan */
+struct poll_block_t {
+  uint8_t slave;        // Modbus slave ID
+  uint8_t function;     // 3 or 4
+  uint8_t poll_class;   // poll_class_t shared by all tags in the block
+  uint16_t start;       // First register read
+  uint16_t count;       // Registers read
+  uint16_t first;       // Index of the block's first tag in the plan's tags
+  uint16_t tags;        // Number of tags served by the block
+  uint32_t due_ms;      // When the block should be polled next
+};
+
+/* A queued register write; slave MODBUS_BROADCAST goes to every slave */
+struct bus_write_t {
+  uint8_t slave;
+  uint8_t count;                        // Registers, FC06 for one and FC16 for more
+  uint16_t address;
+  uint16_t values[BUS_WRITE_MAX_REGS];
+};
+
+/* A poll plan: the blocks and the tags they serve */
+struct poll_plan_t {
+  poll_block_t blocks[BUS_MAX_BLOCKS];
+  uint8_t block_count;
+  uint16_t tags[TAG_MAX];             // Tag IDs ordered by block
+  uint8_t slaves[BUS_MAX_BLOCKS];     // Distinct slaves in the plan, for the link probe
+  uint8_t slave_count;
+  uint8_t default_slave;              // Slave ID TAG_DEFAULT_SLAVE stood for when built
+};
+
+static ModbusMaster node;                 // Only used from the bus task
+static poll_plan_t plans[2];              // The live plan and the one a reload builds
+static poll_plan_t *plan = &plans[0];     // Live plan; only the bus task switches it
+static volatile bool reload_pending = false; // A staged tag table and plan wait to be swapped in
+static uint16_t reload_count = 0;         // Tags in the staged table
+static QueueHandle_t write_queue = NULL;
+static QueueHandle_t priority_queue = NULL; // Writes sent before any other queued write
+static TaskHandle_t task = NULL;
+static panel_config_t applied;            // Configuration the port was opened with
+static bus_stats_t stats;
+static uint32_t clock_due_ms = 0;         // Next clock broadcast
+static volatile bool clock_now = false;   // Broadcast the clock at the next chance
+static volatile uint8_t shed_level = 0;   // Degradation level, see bus.h
+static uint16_t window_polls = 0;         // Polls in the current miss-rate window
+static uint16_t window_misses = 0;        // Of those, polls that missed their deadline
+static uint32_t window_start_ms = 0;
+static uint8_t calm_windows = 0;          // Quiet windows in a row
+
+/* Period multiplier per level and class; alarm and operator tags are never stretched */
+static const uint8_t shed_stretch[BUS_SHED_LEVELS][POLL_CLASS_COUNT] = {
+  {1, 1, 1, 1},
+  {1, 1, 1, 4},
+  {1, 1, 2, 8},
+  {1, 1, 4, 16},
+};
+
+static pid_state_t pid_state;
+static int64_t pid_due_us = 0;            // esp_timer time of the next PID tick, 0 = not started
+static int64_t pid_last_us = 0;           // esp_timer time of the last tick that read the process value
+static portMUX_TYPE browse_lock = portMUX_INITIALIZER_UNLOCKED;
+static bus_browse_t browse_req;           // Window the browser asked for; guarded by browse_lock
+static bus_browse_t browse;               // Last window read; guarded by browse_lock
+static poll_block_t browse_block;         // Window being polled, count 0 = none
+
+/* Slave a tag is polled from */
+static uint8_t tag_slave(const tag_desc_t *d, uint8_t default_slave) {
+  return d->slave == TAG_DEFAULT_SLAVE ? default_slave : d->slave;
+}
+
+/* Sort key: tags that can share a read end up next to each other */
+static uint32_t plan_key(const tag_desc_t *d, uint8_t default_slave) {
+  return ((uint32_t)tag_slave(d, default_slave) << 24) | ((uint32_t)d->function << 20) |
+         ((uint32_t)d->poll_class << 16) | d->address;
+}
+
+/* Build a poll plan from a tag table: sort the tags and merge neighbours into blocks */
+static void build_plan(poll_plan_t &p, const tag_desc_t *table, uint16_t count, uint8_t default_slave) {
+  uint16_t n = 0;
+  p.default_slave = default_slave;
+  for (uint16_t id = 0; id < min(count, (uint16_t)TAG_MAX); id++) {
+    if (table[id].function != 3 && table[id].function != 4)
+      continue;  // Computed or retired, not polled
+    // Insertion sort; the table is small and rarely rebuilt
+    uint32_t key = plan_key(&table[id], default_slave);
+    uint16_t j = n++;
+    while (j > 0 && plan_key(&table[p.tags[j - 1]], default_slave) > key) {
+      p.tags[j] = p.tags[j - 1];
+      j--;
+    }
+    p.tags[j] = id;
+  }
+
+  p.block_count = 0;
+  poll_block_t *b = NULL;
+  for (uint16_t i = 0; i < n; i++) {
+    const tag_desc_t *d = &table[p.tags[i]];
+    uint8_t slave = tag_slave(d, default_slave);
+    bool joins = b != NULL && b->slave == slave && b->function == d->function &&
+                 b->poll_class == d->poll_class &&
+                 d->address <= b->start + b->count + BUS_COALESCE_GAP &&
+                 d->address - b->start < BUS_MAX_READ;
+
+    if (!joins) {
+      if (p.block_count >= BUS_MAX_BLOCKS)
+        break;  // Remaining tags are not polled
+      b = &p.blocks[p.block_count++];
+      *b = {slave, d->function, d->poll_class, d->address, 0, i, 0, millis()};
+    }
+    b->count = max(b->count, (uint16_t)(d->address - b->start + 1));
+    b->tags++;
+  }
+
+  // Blocks are sorted by slave, so each slave starts a new run
+  p.slave_count = 0;
+  for (uint8_t i = 0; i < p.block_count; i++) {
+    if (i == 0 || p.blocks[i].slave != p.blocks[i - 1].slave)
+      p.slaves[p.slave_count++] = p.blocks[i].slave;
+  }
+}
+
+/* Sort key of a block: slave, function, class and start register, as plan_key() */
+static uint32_t block_key(const poll_block_t &b) {
+  return ((uint32_t)b.slave << 24) | ((uint32_t)b.function << 20) | ((uint32_t)b.poll_class << 16) | b.start;
+}
+
+/* Copy the plan generated at build time. It was sorted and coalesced with the default
+   slave as slave 0, so its blocks are resolved to the configured slave first and then
+   sorted and merged again: a default-slave block may now sit next to one that names
+   the same slave explicitly */
+static void load_compiled_plan(poll_plan_t &p, const tag_block_t *compiled, uint8_t count, const uint16_t *tags,
+                               uint8_t default_slave) {
+  poll_block_t sorted[BUS_MAX_BLOCKS];
+  uint8_t n = 0;
+  for (uint8_t i = 0; i < min(count, (uint8_t)BUS_MAX_BLOCKS); i++) {
+    const tag_block_t &c = compiled[i];
+    uint8_t slave = c.slave == TAG_DEFAULT_SLAVE ? default_slave : c.slave;
+    poll_block_t b = {slave, c.function, c.poll_class, c.start, c.count, c.first, c.tags, millis()};
+    uint8_t j = n++;
+    while (j > 0 && block_key(sorted[j - 1]) > block_key(b)) {
+      sorted[j] = sorted[j - 1];
+      j--;
+    }
+    sorted[j] = b;
+  }
+
+  p.default_slave = default_slave;
+  p.block_count = 0;
+  uint16_t used = 0;  // Tags copied so far, in block order
+  poll_block_t *b = NULL;
+  for (uint8_t i = 0; i < n; i++) {
+    const poll_block_t &c = sorted[i];
+    bool joins = b != NULL && b->slave == c.slave && b->function == c.function && b->poll_class == c.poll_class &&
+                 c.start <= b->start + b->count + BUS_COALESCE_GAP && c.start + c.count - b->start <= BUS_MAX_READ;
+    if (joins) {
+      b->count = max(b->count, (uint16_t)(c.start + c.count - b->start));
+      b->tags += c.tags;
+    } else {
+      b = &p.blocks[p.block_count++];
+      *b = c;
+      b->first = used;
+    }
+    memcpy(p.tags + used, tags + c.first, c.tags * sizeof(tags[0]));
+    used += c.tags;
+  }
+
+  // Blocks are sorted by slave, so each slave starts a new run
+  p.slave_count = 0;
+  for (uint8_t i = 0; i < p.block_count; i++) {
+    if (i == 0 || p.blocks[i].slave != p.blocks[i - 1].slave)
+      p.slaves[p.slave_count++] = p.blocks[i].slave;
+  }
+}
+
+/* Rebuild the live plan from the live tag table */
+static void rebuild_plan() {
+  uint8_t count;
+  const uint16_t *tags;
+  const tag_block_t *compiled = tag_compiled_plan(&count, &tags);
+  if (compiled != NULL)
+    load_compiled_plan(*plan, compiled, count, tags, applied.slave_id);
+  else
+    build_plan(*plan, tag_desc(0), tag_count(), applied.slave_id);
+}
+
+/* Reopen the port and rebuild the plan when the configuration changed */
+static void apply_config() {
+  const panel_config_t cfg = config_get();
+  if (memcmp(&cfg, &applied, sizeof(applied)) == 0)
+    return;
+
+  if (cfg.baud != applied.baud || cfg.rx_pin != applied.rx_pin || cfg.tx_pin != applied.tx_pin) {
+    Serial2.end();
+    Serial2.begin(cfg.baud, SERIAL_8N1, cfg.rx_pin, cfg.tx_pin);
+  }
+  bool slave_changed = cfg.slave_id != applied.slave_id;
+  // Any change to the loop restarts it from a clean controller state
+  size_t pid_fields = offsetof(panel_config_t, crc) - offsetof(panel_config_t, pid_period_ms);
+  if (memcmp(&cfg.pid_period_ms, &applied.pid_period_ms, pid_fields) != 0 || (cfg.pid_slave == 0 && slave_changed))
+    pid_due_us = 0;
+  applied = cfg;
+  if (slave_changed)
+    rebuild_plan();  // Tags on the default slave move
+}
+
+/* Switch to the window the browser asked for last; intermediate windows are never read */
+static void apply_browse() {
+  portENTER_CRITICAL(&browse_lock);
+  bus_browse_t req = browse_req;
+  bool moved = req.slave != browse.slave || req.function != browse.function ||
+               req.start != browse.start || req.count != browse.count;
+  if (moved) {
+    browse.slave = req.slave;
+    browse.function = req.function;
+    browse.start = req.start;
+    browse.count = req.count;
+    browse.quality = TAG_QUALITY_NONE;
+  }
+  portEXIT_CRITICAL(&browse_lock);
+
+  if (moved)
+    browse_block = {req.slave, req.function, POLL_OPERATOR, req.start, req.count, 0, 0, millis()};
+}
+
+/* Bytes the slave put on the wire, given the ModbusMaster result */
+static uint16_t response_bytes(uint8_t result, uint16_t expected) {
+  if (result == node.ku8MBResponseTimedOut)
+    return 0;
+  if (result != node.ku8MBSuccess && result < node.ku8MBInvalidSlaveID)
+    return MODBUS_EXCEPTION_RESPONSE;  // Slave answered with an exception code
+  return expected;
+}
+
+/* Account one transaction that started at start_us and feed the latency model */
+static void count_transaction(uint32_t start_us, uint8_t result, uint8_t slave, uint8_t load_class,
+                              uint8_t function, uint16_t registers, uint16_t request, uint16_t response) {
+  uint32_t elapsed_us = micros() - start_us;
+  uint32_t wire_us = bus_wire_us(applied.baud, request, response_bytes(result, response));
+  bus_count_frame(start_us, result == node.ku8MBSuccess);
+  bus_load_record(slave, load_class, wire_us);
+  // A timeout counts with its full length: that is how long the slave kept the bus
+  bus_model_record(slave, function, registers, elapsed_us > wire_us ? elapsed_us - wire_us : 0);
+}
+
+/* Broadcast a write: nobody answers, so send the raw frame and keep the bus quiet
+   while the slaves execute it */
+static void do_broadcast(const bus_write_t &w) {
+  uint8_t frame[MODBUS_RTU_MAX_FRAME];
+  size_t len = rtu_write_frame(frame, MODBUS_BROADCAST, w.address, w.values, w.count);
+  uint32_t gap_us = bus_gap_us(applied.baud);
+  uint32_t start_us = micros();
+  rtu_send(Serial2, frame, len, gap_us);
+  vTaskDelay(pdMS_TO_TICKS(applied.broadcast_delay_ms));
+
+  // The turnaround is busy time too, no other request may go out during it
+  bus_count_frame(start_us, true);
+  bus_load_record(MODBUS_BROADCAST, BUS_LOAD_WRITES,
+                  bus_wire_us(applied.baud, len, 0) + applied.broadcast_delay_ms * 1000u);
+}
+
+/* Send one queued write */
+static void do_write(const bus_write_t &w) {
+  if (w.slave == MODBUS_BROADCAST) {
+    do_broadcast(w);
+    return;
+  }
+
+  uint32_t start_us = micros();
+  node.begin(w.slave, Serial2);
+  uint8_t result;
+  if (w.count == 1) {
+    result = node.writeSingleRegister(w.address, w.values[0]);
+    count_transaction(start_us, result, w.slave, BUS_LOAD_WRITES, 6, 1, MODBUS_WRITE_SINGLE, MODBUS_WRITE_SINGLE);
+  } else {
+    node.clearTransmitBuffer();
+    for (uint8_t i = 0; i < w.count; i++)
+      node.setTransmitBuffer(i, w.values[i]);
+    result = node.writeMultipleRegisters(w.address, w.count);
+    count_transaction(start_us, result, w.slave, BUS_LOAD_WRITES, 16, w.count,
+                      MODBUS_WRITE_MULTIPLE_REQUEST(w.count), MODBUS_WRITE_MULTIPLE_RESPONSE);
+  }
+  if (result != node.ku8MBSuccess)
+    Serial.printf("Write %u:%u failed (0x%02X)\n", w.slave, w.address, result);
+}
+
+/* Broadcast the panel clock when it is due, or once when it was just set; returns ms
+   until the next broadcast */
+static int32_t clock_sync(uint32_t now) {
+  if (applied.clock_sync_s == 0 && !clock_now)
+    return 1000;  // Off; look again later in case it gets switched on
+  if (!clock_now && (int32_t)(clock_due_ms - now) > 0)
+    return clock_due_ms - now;
+
+  uint32_t t = (uint32_t)time(NULL);
+  if (t < BUS_CLOCK_VALID) {
+    clock_now = false;
+    return 1000;  // Never set since boot; do not push 1970 to the slaves
+  }
+  bus_write_t w = {MODBUS_BROADCAST, 2, applied.clock_reg, {(uint16_t)(t >> 16), (uint16_t)t}};
+  do_broadcast(w);
+  clock_now = false;
+  if (applied.clock_sync_s == 0)
+    return 1000;
+  clock_due_ms = now + applied.clock_sync_s * 1000u;
+  return applied.clock_sync_s * 1000u;
+}
+
+/* Hand changed tags on: virtual tags first, then rules, the UI and the logger */
+static void publish(tag_mask_t changed) {
+  if (changed == 0)
+    return;
+  changed = vtags_update(changed);
+  rules_update(changed);
+  for (uint16_t id = 0; changed != 0; id++, changed >>= 1) {
+    if ((changed & 1) == 0)
+      continue;
+    ui_dispatch_mark(id);
+    tag_value_t v;
+    if (tag_read(id, &v) && v.quality == TAG_QUALITY_GOOD)
+      datalog_append(id, v.value);  // Log on change
+  }
+}
+
+/* Read one block and store every tag it serves */
+static void poll(poll_block_t &b) {
+  uint32_t start_us = micros();
+  node.begin(b.slave, Serial2);
+  uint8_t result = b.function == 4 ? node.readInputRegisters(b.start, b.count)
+                                   : node.readHoldingRegisters(b.start, b.count);
+  count_transaction(start_us, result, b.slave, b.poll_class, b.function, b.count, MODBUS_READ_REQUEST,
+                    MODBUS_READ_RESPONSE(b.count));
+
+  tag_mask_t changed = 0;
+  for (uint16_t i = 0; i < b.tags; i++) {
+    uint16_t id = plan->tags[b.first + i];
+    const tag_desc_t *d = tag_desc(id);
+    int32_t value = 0;
+    uint8_t quality = TAG_QUALITY_BAD;
+    if (result == node.ku8MBSuccess) {
+      value = node.getResponseBuffer(d->address - b.start);
+      quality = TAG_QUALITY_GOOD;
+    }
+    if (tag_store(id, value, quality))
+      changed |= TAG_BIT(id);
+  }
+  publish(changed);
+}
+
+/* Read the browse window and publish the values */
+static void poll_browse() {
+  uint32_t start_us = micros();
+  node.begin(browse_block.slave, Serial2);
+  uint8_t result = browse_block.function == 4 ? node.readInputRegisters(browse_block.start, browse_block.count)
+                                              : node.readHoldingRegisters(browse_block.start, browse_block.count);
+  count_transaction(start_us, result, browse_block.slave, browse_block.poll_class, browse_block.function,
+                    browse_block.count, MODBUS_READ_REQUEST, MODBUS_READ_RESPONSE(browse_block.count));
+
+  uint16_t values[BUS_MAX_READ];
+  for (uint16_t i = 0; i < browse_block.count && result == node.ku8MBSuccess; i++)
+    values[i] = node.getResponseBuffer(i);
+
+  portENTER_CRITICAL(&browse_lock);
+  bool moved = browse.slave != browse_block.slave || browse.function != browse_block.function ||
+               browse.start != browse_block.start || browse.count != browse_block.count;
+  if (!moved) {  // The window was not moved or switched to another slave meanwhile
+    if (result == node.ku8MBSuccess) {
+      memcpy(browse.values, values, browse_block.count * sizeof(values[0]));
+      browse.quality = TAG_QUALITY_GOOD;
+    } else {
+      browse.quality = TAG_QUALITY_BAD;
+    }
+    browse.seq++;
+  }
+  portEXIT_CRITICAL(&browse_lock);
+}
+
+/* Swap in a staged tag table and its plan between polls. Blocks that survive the reload
+   keep their schedule; new ones are due at once */
+static void apply_reload() {
+  if (!reload_pending)
+    return;
+
+  poll_plan_t *next = plan == &plans[0] ? &plans[1] : &plans[0];
+  tag_mask_t cleared = tag_swap(reload_count);
+  if (next->default_slave != applied.slave_id)
+    build_plan(*next, tag_desc(0), tag_count(), applied.slave_id);  // Slave ID changed meanwhile
+  uint32_t now = millis();
+  for (uint8_t i = 0; i < next->block_count; i++) {
+    poll_block_t &b = next->blocks[i];
+    b.due_ms = now;
+    for (uint8_t j = 0; j < plan->block_count; j++) {
+      const poll_block_t &o = plan->blocks[j];
+      if (o.slave == b.slave && o.function == b.function && o.poll_class == b.poll_class && o.start == b.start) {
+        b.due_ms = o.due_ms;
+        break;
+      }
+    }
+  }
+  plan = next;
+  reload_pending = false;
+  Serial.printf("Register map reloaded: %u tags, %u blocks\n", tag_count(), plan->block_count);
+  publish(cleared);  // Moved and new tags show as unread until their first poll
+}
+
+/* True if block a should be polled before block b: among due blocks the most
+   urgent class wins, otherwise the block due first */
+static bool runs_before(const poll_block_t &a, const poll_block_t &b, uint32_t now) {
+  bool a_due = (int32_t)(now - a.due_ms) >= 0;
+  bool b_due = (int32_t)(now - b.due_ms) >= 0;
+  if (a_due && b_due && a.poll_class != b.poll_class)
+    return a.poll_class < b.poll_class;
+  return (int32_t)(a.due_ms - b.due_ms) < 0;
+}
+
+/* Block i of the plan; index block_count is the browse window, NULL while not browsing */
+static poll_block_t *plan_block(uint8_t i) {
+  if (i < plan->block_count)
+    return &plan->blocks[i];
+  return browse_block.count > 0 ? &browse_block : NULL;
+}
+
+/* Predicted time a block holds the bus: wire time plus the slave's modelled latency */
+static int32_t block_cost_us(const poll_block_t &b) {
+  return bus_wire_us(applied.baud, MODBUS_READ_REQUEST, MODBUS_READ_RESPONSE(b.count)) +
+         bus_model_latency_us(b.slave, b.function, b.count);
+}
+
+/* Block to poll next. If the block that should run would still hold the bus when a more
+   urgent class falls due, a due block predicted to finish in time runs first instead,
+   so short polls to fast slaves fill the gap before the deadline */
+static poll_block_t *next_block(uint32_t now) {
+  poll_block_t *best = NULL;
+  for (uint8_t i = 0; i <= plan->block_count; i++) {
+    poll_block_t *b = plan_block(i);
+    if (b != NULL && (best == NULL || runs_before(*b, *best, now)))
+      best = b;
+  }
+  if (best == NULL || (int32_t)(now - best->due_ms) < 0)
+    return best;  // Nothing due yet
+
+  // Next deadline of a more urgent class
+  poll_block_t *urgent = NULL;
+  for (uint8_t i = 0; i <= plan->block_count; i++) {
+    poll_block_t *b = plan_block(i);
+    if (b != NULL && b->poll_class < best->poll_class &&
+        (urgent == NULL || (int32_t)(b->due_ms - urgent->due_ms) < 0))
+      urgent = b;
+  }
+  if (urgent == NULL)
+    return best;
+  int32_t gap_us = (int32_t)(urgent->due_ms - now) * 1000;
+  if (block_cost_us(*best) <= gap_us)
+    return best;
+
+  poll_block_t *fill = NULL;
+  for (uint8_t i = 0; i <= plan->block_count; i++) {
+    poll_block_t *b = plan_block(i);
+    if (b != NULL && (int32_t)(now - b->due_ms) >= 0 && block_cost_us(*b) <= gap_us &&
+        (fill == NULL || runs_before(*b, *fill, now)))
+      fill = b;
+  }
+  return fill != NULL ? fill : best;  // Nothing fits; the urgent poll waits for this one
+}
+
+/* Run the PID loop when its tick is due: read the process value, write the output.
+   Returns ms until the next tick */
+static int32_t pid_tick() {
+  if (applied.pid_period_ms == 0) {
+    pid_due_us = 0;
+    return BUS_IDLE_MS;
+  }
+  int64_t now_us = esp_timer_get_time();
+  int64_t period_us = applied.pid_period_ms * 1000LL;
+  if (pid_due_us == 0) {
+    pid_due_us = now_us;  // Loop (re)started: no integral or derivative carried over
+    memset(&pid_state, 0, sizeof(pid_state));
+  }
+  if (now_us < pid_due_us)
+    return (pid_due_us - now_us + 999) / 1000;
+
+  uint8_t slave = applied.pid_slave != 0 ? applied.pid_slave : applied.slave_id;
+  node.begin(slave, Serial2);
+  uint32_t start_us = micros();
+  uint8_t result = applied.pid_pv_function == 4 ? node.readInputRegisters(applied.pid_pv_reg, 1)
+                                                : node.readHoldingRegisters(applied.pid_pv_reg, 1);
+  count_transaction(start_us, result, slave, POLL_ALARM, applied.pid_pv_function, 1, MODBUS_READ_REQUEST,
+                    MODBUS_READ_RESPONSE(1));
+  int32_t pv = 0;
+  int32_t out = 0;
+  if (result == node.ku8MBSuccess) {
+    pv = node.getResponseBuffer(0);
+    // Real time since the last good read, which spans any failed or skipped ticks
+    uint32_t dt_ms = applied.pid_period_ms;
+    if (pid_state.primed)
+      dt_ms = (uint32_t)min((now_us - pid_last_us + 500) / 1000, (int64_t)PID_MAX_DT_MS);
+    pid_last_us = now_us;
+    out = pid_step(&pid_state, &applied, pv, dt_ms);
+    start_us = micros();
+    result = node.writeSingleRegister(applied.pid_out_reg, out);
+    count_transaction(start_us, result, slave, BUS_LOAD_WRITES, 6, 1, MODBUS_WRITE_SINGLE, MODBUS_WRITE_SINGLE);
+  }
+  pid_record(pid_due_us, now_us, pv, out, result == node.ku8MBSuccess);
+
+  pid_due_us += period_us;
+  now_us = esp_timer_get_time();
+  if (pid_due_us <= now_us)
+    pid_due_us = now_us + period_us;  // Overran a whole period; skip the missed ticks
+  return (pid_due_us - now_us + 999) / 1000;
+}
+
+/* Count one poll and, at the end of a window, move the degradation level */
+static void shed_account(bool missed, uint32_t now) {
+  window_polls++;
+  if (missed)
+    window_misses++;
+  if (now - window_start_ms < BUS_SHED_WINDOW_MS)
+    return;
+
+  uint32_t miss_pct = window_misses * 100u / window_polls;
+  if (miss_pct >= BUS_SHED_RAISE_PCT) {
+    calm_windows = 0;
+    if (shed_level + 1 < BUS_SHED_LEVELS) {
+      shed_level++;
+      Serial.printf("Bus overload: %u%% missed, shedding level %u\n", miss_pct, shed_level);
+    }
+  } else if (miss_pct < BUS_SHED_LOWER_PCT && shed_level > 0 && ++calm_windows >= BUS_SHED_CALM_WINDOWS) {
+    calm_windows = 0;
+    shed_level--;
+    Serial.printf("Bus recovered, shedding level %u\n", shed_level);
+  }
+  window_polls = 0;
+  window_misses = 0;
+  window_start_ms = now;
+}
+
+/* Bus task: writes, the PID loop, the clock and diagnostics first, then a recipe chunk or the next due poll,
+   sleeping until something is due */
+static void bus_task(void *arg) {
+  for (;;) {
+    apply_config();
+    apply_reload();
+    apply_browse();
+
+    bus_write_t w;
+    while (xQueueReceive(priority_queue, &w, 0) == pdTRUE || xQueueReceive(write_queue, &w, 0) == pdTRUE)
+      do_write(w);  // The priority lane is checked again before every normal write
+    rules_update(0);  // Finish rules left over from the last cycle
+
+    int32_t pid_wait = pid_tick();
+    uint32_t now = millis();
+    int32_t clock_wait = clock_sync(now);
+    int32_t diag_wait = diag_service(now, plan->slaves, plan->slave_count);
+    poll_block_t *b = next_block(now);
+    // A recipe chunk predicted to run into the next PID tick waits until after it, as polls do
+    int32_t chunk_us = recipe_next_us();
+    bool chunk_fits = applied.pid_period_ms == 0 || chunk_us <= pid_wait * 1000 ||
+                      chunk_us > applied.pid_period_ms * 1000;
+    if (chunk_fits && recipe_step() && (b == NULL || b->poll_class != POLL_ALARM || (int32_t)(now - b->due_ms) < 0))
+      continue;  // Recipe chunks go back to back; only a due alarm poll gets in between
+    int32_t wait = b != NULL ? (int32_t)(b->due_ms - now) : BUS_IDLE_MS;
+    if (b != NULL && wait <= 0 && applied.pid_period_ms != 0) {
+      // A poll predicted to run into the next PID tick waits until after it, unless it
+      // can never fit between two ticks
+      int32_t cost_us = block_cost_us(*b);
+      if (cost_us > pid_wait * 1000 && cost_us <= applied.pid_period_ms * 1000)
+        wait = pid_wait + 1;
+    }
+    if (wait > 0) {
+      // Sleep until the next poll, waking early for a write, the PID loop, the clock, a
+      // probe or a new browse window
+      int32_t sleep = min(min(min(wait, pid_wait), clock_wait), min(diag_wait, (int32_t)BUS_IDLE_MS));
+      if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(sleep)) > 0 || sleep < wait)
+        continue;
+      now = millis();
+    }
+    if (b == NULL)
+      continue;
+
+    int32_t late = now - b->due_ms;
+    shed_account(late > tag_period_ms(b->poll_class) / BUS_MISS_FRACTION, now);
+    if (b == &browse_block)
+      poll_browse();
+    else
+      poll(*b);
+    int32_t period = bus_class_period(b->poll_class);
+    b->due_ms += period;
+    if ((int32_t)(now - b->due_ms) > period)
+      b->due_ms = now + period;  // Too far behind to catch up; skip the missed polls
+  }
+}
+
+/* Current degradation level */
+uint8_t bus_shed_level() {
+  return shed_level;
+}
+
+/* Poll period of a class at the current degradation level */
+uint32_t bus_class_period(uint8_t poll_class) {
+  uint8_t c = poll_class < POLL_CLASS_COUNT ? poll_class : POLL_BACKGROUND;
+  return tag_period_ms(c) * shed_stretch[shed_level][c];
+}
+
+/* Bus share the poll plan needs at the nominal class periods, in 0.1 % */
+uint32_t bus_planned_load(uint8_t poll_class) {
+  uint32_t load = 0;
+  const poll_plan_t *p = plan;
+  for (uint8_t i = 0; i < p->block_count; i++) {
+    if (p->blocks[i].poll_class == poll_class)
+      load += bus_wire_us(applied.baud, MODBUS_READ_REQUEST, MODBUS_READ_RESPONSE(p->blocks[i].count)) /
+              tag_period_ms(poll_class);
+  }
+  return load;
+}
+
+static void clock_command(int argc, char **argv);
+
+/* Open the port, build the poll plan and start the bus task */
+bool bus_begin() {
+  applied = config_get();
+  Serial2.begin(applied.baud, SERIAL_8N1, applied.rx_pin, applied.tx_pin);
+  rebuild_plan();
+  bus_load_begin();
+  bus_model_begin();
+  diag_begin();
+  pid_begin();
+  console_register("clock", "Show panel clock, or set <epoch> and broadcast it", clock_command);
+
+  write_queue = xQueueCreate(BUS_WRITE_QUEUE_DEPTH, sizeof(bus_write_t));
+  priority_queue = xQueueCreate(BUS_PRIORITY_QUEUE_DEPTH, sizeof(bus_write_t));
+  if (write_queue == NULL || priority_queue == NULL)
+    return false;
+  return xTaskCreatePinnedToCore(bus_task, "bus", 4096, NULL, BUS_TASK_PRIORITY, &task,
+                                 BUS_TASK_CORE) == pdPASS;
+}
+
+/* Queue a write of count registers and wake the bus task; false if the queue is full */
+static bool queue_write(QueueHandle_t queue, uint8_t slave, uint16_t address, const uint16_t *values,
+                        uint8_t count) {
+  if (queue == NULL || count == 0 || count > BUS_WRITE_MAX_REGS)
+    return false;
+  bus_write_t w = {slave, count, address, {}};
+  memcpy(w.values, values, count * sizeof(values[0]));
+  if (xQueueSend(queue, &w, 0) != pdTRUE)
+    return false;
+  xTaskNotifyGive(task);
+  return true;
+}
+
+/* Queue a single register write; false if the queue is full */
+bool bus_write(uint8_t slave, uint16_t address, uint16_t value) {
+  return queue_write(write_queue, slave, address, &value, 1);
+}
+
+/* Queue a single register write ahead of all normal writes */
+bool bus_write_priority(uint8_t slave, uint16_t address, uint16_t value) {
+  return queue_write(priority_queue, slave, address, &value, 1);
+}
+
+/* Queue a write every slave executes and none answers */
+bool bus_broadcast(uint16_t address, const uint16_t *values, uint8_t count) {
+  return queue_write(write_queue, MODBUS_BROADCAST, address, values, count);
+}
+
+/* Build the plan for a staged tag table off to the side and have the bus task swap both
+   in before its next poll; false while the last reload is still pending */
+bool bus_reload(const tag_desc_t *table, uint16_t count) {
+  if (reload_pending)
+    return false;
+  poll_plan_t *next = plan == &plans[0] ? &plans[1] : &plans[0];
+  build_plan(*next, table, count, applied.slave_id);
+  reload_count = count;
+  reload_pending = true;
+  if (task != NULL)
+    xTaskNotifyGive(task);
+  return true;
+}
+
+/* True while a reload waits for the bus task */
+bool bus_reload_pending() {
+  return reload_pending;
+}
+
+/* Poll a window of registers for the browser; replaces any window not read yet */
+void bus_browse(uint8_t slave, uint8_t function, uint16_t start, uint16_t count) {
+  portENTER_CRITICAL(&browse_lock);
+  browse_req.slave = slave;
+  browse_req.function = function;
+  browse_req.start = start;
+  browse_req.count = min(count, (uint16_t)BUS_MAX_READ);
+  portEXIT_CRITICAL(&browse_lock);
+}
+
+/* Copy the latest browse window */
+void bus_browse_read(bus_browse_t *out) {
+  portENTER_CRITICAL(&browse_lock);
+  *out = browse;
+  portEXIT_CRITICAL(&browse_lock);
+}
+
+/* Snapshot the bus counters */
+void bus_get_stats(bus_stats_t *out) {
+  *out = stats;
+}
+
+/* Count a request that started at start_us, from the poll path or a raw frame another
+   module sent on the bus task */
+void bus_count_frame(uint32_t start_us, bool ok) {
+  stats.busy_us += micros() - start_us;
+  stats.transactions++;
+  if (!ok)
+    stats.errors++;
+}
+
+/* Console: "clock" shows the panel clock, "clock <epoch>" sets it and broadcasts it at once */
+static void clock_command(int argc, char **argv) {
+  if (argc > 1) {
+    struct timeval tv = {(time_t)strtoul(argv[1], NULL, 0), 0};
+    settimeofday(&tv, NULL);
+    clock_now = true;
+  }
+  const panel_config_t cfg = config_get();
+  Serial.printf("clock %lu", (unsigned long)time(NULL));
+  if (cfg.clock_sync_s == 0 && argc > 1)
+    Serial.printf(", broadcast once to register %u, periodic broadcast off\n", cfg.clock_reg);
+  else if (cfg.clock_sync_s == 0)
+    Serial.println(", broadcast off");
+  else
+    Serial.printf(", broadcast to register %u every %u s\n", cfg.clock_reg, cfg.clock_sync_s);
+}
@@ -0,0 +1,148 @@
+/*
+ * Description:
+ * RS485 bus utilisation accounting. See bus_load.h.
+ */
+
+#include "bus_load.h"
+#include "bus.h"
+#include "config.h"
+#include "console.h"
+#include "modbus_rtu.h"
+
+#define SLAVE_OTHER BUS_LOAD_MAX_SLAVES          // Counter of slaves beyond the tracked ones
+#define SLAVE_BROADCAST (BUS_LOAD_MAX_SLAVES + 1) // Counter of broadcasts
+
+/* Busy time and transaction count of one slave or class */
+struct load_counter_t {
+  uint64_t busy_us;
+  uint32_t transactions;
+};
+
+static uint8_t slave_ids[BUS_LOAD_MAX_SLAVES];          // 0 = free entry
+static load_counter_t slaves[BUS_LOAD_MAX_SLAVES + 2];  // Then untracked slaves and broadcasts
+static load_counter_t classes[BUS_LOAD_CLASSES];
+static uint64_t total_busy_us = 0;
+static uint32_t since_ms = 0;                           // Start of the accounting window
+static portMUX_TYPE load_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static const char *class_names[BUS_LOAD_CLASSES] = {"alarm", "operator", "trend", "background", "writes"};
+
+/* Time of one character on the wire */
+uint32_t bus_char_us(uint32_t baud) {
+  return (BUS_BITS_PER_CHAR * 1000000UL + baud / 2) / baud;
+}
+
+/* Silent interval that ends a frame: 3.5 characters, fixed above 19200 baud */
+uint32_t bus_gap_us(uint32_t baud) {
+  return baud > 19200 ? 1750 : bus_char_us(baud) * 7 / 2;
+}
+
+/* Wire time of a transaction; a missing response (timeout) adds no bytes */
+uint32_t bus_wire_us(uint32_t baud, uint16_t request_bytes, uint16_t response_bytes) {
+  uint32_t us = request_bytes * bus_char_us(baud) + bus_gap_us(baud);
+  if (response_bytes > 0)
+    us += response_bytes * bus_char_us(baud) + bus_gap_us(baud);
+  return us;
+}
+
+/* Counter of a slave, claiming a free entry on first use */
+static load_counter_t &slave_counter(uint8_t slave) {
+  if (slave == MODBUS_BROADCAST)
+    return slaves[SLAVE_BROADCAST];  // 0 also marks a free entry
+  for (uint8_t i = 0; i < BUS_LOAD_MAX_SLAVES; i++) {
+    if (slave_ids[i] == slave)
+      return slaves[i];
+    if (slave_ids[i] == 0) {
+      slave_ids[i] = slave;
+      return slaves[i];
+    }
+  }
+  return slaves[SLAVE_OTHER];
+}
+
+/* Account one transaction */
+void bus_load_record(uint8_t slave, uint8_t load_class, uint32_t wire_us) {
+  if (load_class >= BUS_LOAD_CLASSES)
+    load_class = BUS_LOAD_WRITES;
+
+  portENTER_CRITICAL(&load_lock);
+  load_counter_t &s = slave_counter(slave);
+  s.busy_us += wire_us;
+  s.transactions++;
+  classes[load_class].busy_us += wire_us;
+  classes[load_class].transactions++;
+  total_busy_us += wire_us;
+  portEXIT_CRITICAL(&load_lock);
+}
+
+/* Total busy time, wraps. Read under the lock: the 64-bit counter is written by the bus
+   task on the other core and a plain read can tear */
+uint32_t bus_load_busy_us() {
+  portENTER_CRITICAL(&load_lock);
+  uint32_t busy = (uint32_t)total_busy_us;
+  portEXIT_CRITICAL(&load_lock);
+  return busy;
+}
+
+/* Share of the window in percent, one decimal */
+static float percent(uint64_t busy_us, uint32_t window_ms) {
+  return window_ms == 0 ? 0.0f : busy_us / (window_ms * 10.0f);
+}
+
+/* Console: "busload" reports utilisation since the last "busload reset" */
+static void busload_command(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+    portENTER_CRITICAL(&load_lock);
+    memset(slave_ids, 0, sizeof(slave_ids));
+    memset(slaves, 0, sizeof(slaves));
+    memset(classes, 0, sizeof(classes));
+    total_busy_us = 0;
+    since_ms = millis();
+    portEXIT_CRITICAL(&load_lock);
+    return;
+  }
+
+  // Copy under the lock, print without it
+  uint8_t ids[BUS_LOAD_MAX_SLAVES];
+  load_counter_t s[BUS_LOAD_MAX_SLAVES + 2], c[BUS_LOAD_CLASSES];
+  portENTER_CRITICAL(&load_lock);
+  memcpy(ids, slave_ids, sizeof(ids));
+  memcpy(s, slaves, sizeof(s));
+  memcpy(c, classes, sizeof(c));
+  uint64_t busy = total_busy_us;
+  uint32_t window_ms = millis() - since_ms;
+  portEXIT_CRITICAL(&load_lock);
+
+  uint32_t baud = config_get().baud;
+  float used = percent(busy, window_ms);
+  uint32_t read_us = bus_wire_us(baud, MODBUS_READ_REQUEST, MODBUS_READ_RESPONSE(1));
+  float spare_reads = (100.0f - used) * 10000.0f / read_us;  // Single-register reads per second
+  Serial.printf("%u baud, char %u us, gap %u us, window %.1f s\n", baud, bus_char_us(baud),
+                bus_gap_us(baud), window_ms / 1000.0f);
+  Serial.printf("busy %.1f%%, idle %.1f%%, headroom ~%.0f single-register reads/s\n", used,
+                100.0f - used, max(spare_reads, 0.0f));
+
+  Serial.println("slave   busy%   transactions");
+  for (uint8_t i = 0; i < BUS_LOAD_MAX_SLAVES && ids[i] != 0; i++)
+    Serial.printf("%5u  %6.1f   %u\n", ids[i], percent(s[i].busy_us, window_ms), s[i].transactions);
+  if (s[SLAVE_OTHER].transactions > 0)
+    Serial.printf("other  %6.1f   %u\n", percent(s[SLAVE_OTHER].busy_us, window_ms),
+                  s[SLAVE_OTHER].transactions);
+  if (s[SLAVE_BROADCAST].transactions > 0)
+    Serial.printf("bcast  %6.1f   %u\n", percent(s[SLAVE_BROADCAST].busy_us, window_ms),
+                  s[SLAVE_BROADCAST].transactions);
+
+  Serial.printf("class       busy%%   planned%%   period ms (shedding level %u)\n", bus_shed_level());
+  for (uint8_t i = 0; i < BUS_LOAD_CLASSES; i++) {
+    Serial.printf("%-10s %6.1f", class_names[i], percent(c[i].busy_us, window_ms));
+    if (i < POLL_CLASS_COUNT)
+      Serial.printf("   %6.1f     %6u", bus_planned_load(i) / 10.0f, bus_class_period(i));
+    Serial.println();
+  }
+}
+
+/* Register the console command */
+void bus_load_begin() {
+  since_ms = millis();
+  console_register("busload", "Bus utilisation per slave and class, or reset", busload_command);
+}
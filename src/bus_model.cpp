@@ -0,0 +1,134 @@
+/*
+ * Description:
+ * Slave response-time model. See bus_model.h.
+ */
+
+#include "bus_model.h"
+#include "console.h"
+
+#define MODEL_FUNCTIONS 4
+
+static const uint8_t model_functions[MODEL_FUNCTIONS] = {3, 4, 6, 16};
+
+/* Latency statistics of one slave */
+struct slave_model_t {
+  uint8_t slave;                               // 0 = free entry
+  uint32_t samples[MODEL_FUNCTIONS];
+  int32_t latency_us[MODEL_FUNCTIONS];         // Moving average per function code
+  float sw, sx, sy, sxx, sxy;                  // Decayed sums of the read fit latency = a + b * registers
+};
+
+static slave_model_t models[BUS_MODEL_SLAVES];
+static portMUX_TYPE model_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Index of a modelled function code, or -1 */
+static int8_t function_index(uint8_t function) {
+  for (uint8_t i = 0; i < MODEL_FUNCTIONS; i++) {
+    if (model_functions[i] == function)
+      return i;
+  }
+  return -1;
+}
+
+/* Model of a slave; claims a free entry on first use if claim is set */
+static slave_model_t *find(uint8_t slave, bool claim) {
+  if (slave == 0)
+    return NULL;  // Broadcasts have no response; 0 also marks a free entry
+  for (uint8_t i = 0; i < BUS_MODEL_SLAVES; i++) {
+    if (models[i].slave == slave)
+      return &models[i];
+    if (models[i].slave == 0) {
+      if (!claim)
+        return NULL;
+      models[i].slave = slave;
+      return &models[i];
+    }
+  }
+  return NULL;
+}
+
+/* Intercept and slope of the read fit; false until it has enough spread in sizes */
+static bool fit(const slave_model_t &m, float *a, float *b) {
+  float det = m.sw * m.sxx - m.sx * m.sx;  // sw^2 times the variance of the sizes
+  if (m.samples[0] + m.samples[1] < BUS_MODEL_FIT_SAMPLES || det < m.sw * m.sw)
+    return false;  // Too few reads, or their sizes vary by less than one register
+  *b = (m.sw * m.sxy - m.sx * m.sy) / det;
+  *a = (m.sy - *b * m.sx) / m.sw;
+  return true;
+}
+
+/* Add one latency sample */
+void bus_model_record(uint8_t slave, uint8_t function, uint16_t registers, uint32_t latency_us) {
+  int8_t f = function_index(function);
+  if (f < 0)
+    return;
+
+  portENTER_CRITICAL(&model_lock);
+  slave_model_t *m = find(slave, true);
+  if (m != NULL) {
+    if (m->samples[f]++ == 0)
+      m->latency_us[f] = latency_us;
+    else
+      m->latency_us[f] += ((int32_t)latency_us - m->latency_us[f]) >> BUS_MODEL_AVERAGE_SHIFT;
+
+    if (function == 3 || function == 4) {
+      const float keep = 1.0f - 1.0f / BUS_MODEL_FIT_WINDOW;
+      float x = registers;
+      float y = latency_us;
+      m->sw = m->sw * keep + 1.0f;
+      m->sx = m->sx * keep + x;
+      m->sy = m->sy * keep + y;
+      m->sxx = m->sxx * keep + x * x;
+      m->sxy = m->sxy * keep + x * y;
+    }
+  }
+  portEXIT_CRITICAL(&model_lock);
+}
+
+/* Predicted latency of a request: the size fit for reads, else the function's average */
+uint32_t bus_model_latency_us(uint8_t slave, uint8_t function, uint16_t registers) {
+  int8_t f = function_index(function);
+  uint32_t us = BUS_MODEL_DEFAULT_US;
+
+  portENTER_CRITICAL(&model_lock);
+  slave_model_t *m = find(slave, false);
+  float a, b;
+  if (m != NULL && f >= 0) {
+    if ((function == 3 || function == 4) && fit(*m, &a, &b))
+      us = (uint32_t)max(a + b * registers, 0.0f);
+    else if (m->samples[f] > 0)
+      us = max(m->latency_us[f], (int32_t)0);
+  }
+  portEXIT_CRITICAL(&model_lock);
+  return us;
+}
+
+/* Console: "model" lists the latency estimates of every slave seen */
+static void model_command(int argc, char **argv) {
+  slave_model_t copy[BUS_MODEL_SLAVES];
+  portENTER_CRITICAL(&model_lock);
+  memcpy(copy, models, sizeof(copy));
+  portEXIT_CRITICAL(&model_lock);
+
+  Serial.println("slave  fc03 ms  fc04 ms  fc06 ms  fc16 ms  read fit");
+  for (uint8_t i = 0; i < BUS_MODEL_SLAVES && copy[i].slave != 0; i++) {
+    const slave_model_t &m = copy[i];
+    Serial.printf("%5u", m.slave);
+    for (uint8_t f = 0; f < MODEL_FUNCTIONS; f++) {
+      if (m.samples[f] > 0)
+        Serial.printf("  %7.1f", m.latency_us[f] / 1000.0f);
+      else
+        Serial.print("        -");
+    }
+    float a, b;
+    if (fit(m, &a, &b))
+      Serial.printf("  %.1f ms + %.0f us/reg\n", a / 1000.0f, b);
+    else
+      Serial.println("  -");
+  }
+}
+
+/* Register the console command */
+void bus_model_begin() {
+  console_register("model", "Response latency per slave and function", model_command);
+}
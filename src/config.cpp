@@ -0,0 +1,237 @@
+/*
+ * Description:
+ * NVS configuration store. See config.h.
+ */
+
+#include "config.h"
+#include "console.h"
+#include "crc16.h"
+#include <Preferences.h>
+#include <stddef.h>
+
+#define CONFIG_NAMESPACE "panel"  // NVS namespace
+#define CONFIG_KEY "cfg"          // NVS key of the blob
+#define CONFIG_CRC_LEN offsetof(panel_config_t, crc)
+
+/* A field that can be changed from the console */
+struct config_field_t {
+  const char *name;
+  uint8_t offset;     // Offset in panel_config_t
+  uint8_t size;       // Field size in bytes
+  uint32_t min;
+  uint32_t max;
+};
+
+#define CONFIG_FIELD(name, lo, hi) \
+  {#name, offsetof(panel_config_t, name), sizeof(((panel_config_t *)0)->name), lo, hi}
+
+static const config_field_t fields[] = {
+  CONFIG_FIELD(baud, 1200, 115200),
+  CONFIG_FIELD(rx_pin, 0, 39),
+  CONFIG_FIELD(tx_pin, 0, 33),     // GPIO 34-39 are input only
+  CONFIG_FIELD(slave_id, 1, 247),
+  CONFIG_FIELD(rotation, 0, 3),
+  CONFIG_FIELD(setpoint_reg, 0, 65535),
+  CONFIG_FIELD(broadcast_delay_ms, 0, 1000),
+  CONFIG_FIELD(clock_sync_s, 0, 65535),
+  CONFIG_FIELD(clock_reg, 0, 65534),     // Two registers
+  CONFIG_FIELD(pid_period_ms, 0, 10000),
+  CONFIG_FIELD(pid_slave, 0, 247),
+  CONFIG_FIELD(pid_pv_function, 3, 4),
+  CONFIG_FIELD(pid_pv_reg, 0, 65535),
+  CONFIG_FIELD(pid_out_reg, 0, 65535),
+  CONFIG_FIELD(pid_setpoint, 0, 65535),
+  CONFIG_FIELD(pid_out_min, 0, 65535),
+  CONFIG_FIELD(pid_out_max, 0, 65535),
+  CONFIG_FIELD(pid_kp, 0, 65535),
+  CONFIG_FIELD(pid_ki, 0, 65535),
+  CONFIG_FIELD(pid_kd, 0, 65535),
+};
+
+static panel_config_t active;                      // Copied in and out under config_lock only
+static portMUX_TYPE config_lock = portMUX_INITIALIZER_UNLOCKED;  // Readers run on both cores
+static config_listener_t listeners[CONFIG_MAX_LISTENERS];
+static uint8_t listener_count = 0;
+
+/* Fill a configuration with the factory defaults */
+static void set_defaults(panel_config_t *cfg) {
+  memset(cfg, 0, sizeof(*cfg));
+  cfg->baud = CONFIG_DEFAULT_BAUD;
+  cfg->rx_pin = CONFIG_DEFAULT_RX_PIN;
+  cfg->tx_pin = CONFIG_DEFAULT_TX_PIN;
+  cfg->slave_id = CONFIG_DEFAULT_SLAVE_ID;
+  cfg->rotation = CONFIG_DEFAULT_ROTATION;
+  cfg->setpoint_reg = CONFIG_DEFAULT_SETPOINT_REG;
+  cfg->broadcast_delay_ms = CONFIG_DEFAULT_BROADCAST_DELAY_MS;
+  cfg->clock_sync_s = CONFIG_DEFAULT_CLOCK_SYNC_S;
+  cfg->clock_reg = CONFIG_DEFAULT_CLOCK_REG;
+  cfg->pid_pv_function = CONFIG_DEFAULT_PID_PV_FUNCTION;
+  cfg->pid_out_max = CONFIG_DEFAULT_PID_OUT_MAX;
+}
+
+/* Stamp version, size and CRC before a configuration is stored */
+static void seal(panel_config_t *cfg) {
+  cfg->version = CONFIG_VERSION;
+  cfg->size = sizeof(*cfg);
+  cfg->crc = crc16(cfg, CONFIG_CRC_LEN);
+}
+
+/* Check every console-settable field against its limits, and the fields that go together */
+static bool valid(const panel_config_t *cfg) {
+  for (const config_field_t &f : fields) {
+    uint32_t v = 0;
+    memcpy(&v, (const uint8_t *)cfg + f.offset, f.size);  // Little endian
+    if (v < f.min || v > f.max)
+      return false;
+  }
+  return cfg->pid_out_min <= cfg->pid_out_max;
+}
+
+/* Offset of the CRC in the blob of each layout version. The struct ends in padding after
+   the CRC, so it is not in the last two bytes of the blob */
+static const uint8_t crc_offsets[CONFIG_VERSION + 1] = {0, 14, 20, CONFIG_CRC_LEN};
+static_assert(CONFIG_CRC_LEN == 40, "panel_config_t changed: raise CONFIG_VERSION and add its CRC offset");
+
+/* True if the CRC stored at offset at covers the blob before it */
+static bool crc_matches(const uint8_t *blob, size_t len, size_t at) {
+  if (at == 0 || at + sizeof(uint16_t) > len)
+    return false;
+  uint16_t crc;
+  memcpy(&crc, blob + at, sizeof(crc));
+  return crc == crc16(blob, at);
+}
+
+/* Offset of the checked CRC in a stored blob, 0 if it does not check */
+static size_t crc_offset(const uint8_t *blob, size_t len) {
+  const panel_config_t *stored = (const panel_config_t *)blob;
+  if (stored->version <= CONFIG_VERSION)
+    return crc_matches(blob, len, crc_offsets[stored->version]) ? crc_offsets[stored->version] : 0;
+  // Newer firmware: the CRC is last, before padding to four bytes. Try the padded place
+  // first; a CRC followed by zeros also checks two bytes later
+  if (crc_matches(blob, len, len - 2 * sizeof(uint16_t)))
+    return len - 2 * sizeof(uint16_t);
+  return crc_matches(blob, len, len - sizeof(uint16_t)) ? len - sizeof(uint16_t) : 0;
+}
+
+/* Load the blob from NVS over the defaults; false if it is missing or damaged */
+static bool load(panel_config_t *cfg) {
+  uint8_t blob[sizeof(panel_config_t) + 64];  // Room for a blob from newer firmware
+  Preferences prefs;
+  if (!prefs.begin(CONFIG_NAMESPACE, true))
+    return false;
+  size_t len = prefs.getBytes(CONFIG_KEY, blob, sizeof(blob));
+  prefs.end();
+
+  const panel_config_t *stored = (const panel_config_t *)blob;
+  if (len < offsetof(panel_config_t, baud) + sizeof(uint16_t) || stored->size != len)
+    return false;
+  size_t crc_at = crc_offset(blob, len);
+  if (crc_at == 0)
+    return false;
+
+  // Shared leading fields come from the blob, fields it does not know keep their defaults
+  set_defaults(cfg);
+  memcpy(cfg, blob, min(crc_at, (size_t)CONFIG_CRC_LEN));
+  return valid(cfg);
+}
+
+static void config_command(int argc, char **argv);
+
+/* Load the configuration once at boot */
+void config_begin() {
+  panel_config_t cfg;
+  if (!load(&cfg)) {
+    Serial.println("Using default configuration");
+    set_defaults(&cfg);
+  }
+  seal(&cfg);
+  portENTER_CRITICAL(&config_lock);
+  active = cfg;
+  portEXIT_CRITICAL(&config_lock);
+  console_register("cfg", "Show config, or set <field> <value> ...", config_command);
+}
+
+/* Copy of the active configuration; never reads flash */
+panel_config_t config_get() {
+  portENTER_CRITICAL(&config_lock);
+  panel_config_t cfg = active;
+  portEXIT_CRITICAL(&config_lock);
+  return cfg;
+}
+
+/* Copy-on-write update: validate, persist, then replace the active struct */
+bool config_update(const panel_config_t *cfg) {
+  panel_config_t next = *cfg;
+  if (!valid(&next))
+    return false;
+  seal(&next);
+
+  Preferences prefs;
+  if (!prefs.begin(CONFIG_NAMESPACE, false))
+    return false;
+  bool ok = prefs.putBytes(CONFIG_KEY, &next, sizeof(next)) == sizeof(next);
+  prefs.end();
+  if (!ok)
+    return false;
+
+  portENTER_CRITICAL(&config_lock);
+  panel_config_t old_cfg = active;
+  active = next;  // Readers copy the old or the new struct, never a mix
+  portEXIT_CRITICAL(&config_lock);
+  for (uint8_t i = 0; i < listener_count; i++)
+    listeners[i](&old_cfg, &next);
+  return true;
+}
+
+/* Get notified of configuration changes */
+bool config_add_listener(config_listener_t listener) {
+  if (listener_count >= CONFIG_MAX_LISTENERS)
+    return false;
+  listeners[listener_count++] = listener;
+  return true;
+}
+
+/* Console: "cfg" shows the configuration, "cfg <field> <value> ..." changes it atomically */
+static void config_command(int argc, char **argv) {
+  panel_config_t next = config_get();
+
+  if (argc % 2 == 0) {
+    Serial.printf("Missing value for %s\n", argv[argc - 1]);
+    return;
+  }
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const config_field_t *field = NULL;
+    for (const config_field_t &f : fields) {
+      if (strcmp(argv[i], f.name) == 0)
+        field = &f;
+    }
+    if (field == NULL) {
+      Serial.printf("Unknown field: %s\n", argv[i]);
+      return;
+    }
+    char *end;
+    uint32_t v = strtoul(argv[i + 1], &end, 0);
+    if (end == argv[i + 1] || *end != '\0' || argv[i + 1][0] == '-') {
+      Serial.printf("Not a number: %s %s\n", argv[i], argv[i + 1]);
+      return;
+    }
+    if (v < field->min || v > field->max) {
+      Serial.printf("%s must be %u..%u\n", field->name, field->min, field->max);
+      return;
+    }
+    memcpy((uint8_t *)&next + field->offset, &v, field->size);
+  }
+
+  if (argc > 1 && !config_update(&next)) {
+    Serial.println("Configuration rejected");
+    return;
+  }
+
+  const panel_config_t cfg = config_get();
+  Serial.printf("config v%u\n", cfg.version);
+  for (const config_field_t &f : fields) {
+    uint32_t v = 0;
+    memcpy(&v, (const uint8_t *)&cfg + f.offset, f.size);
+    Serial.printf("  %-18s %u\n", f.name, v);
+  }
+}
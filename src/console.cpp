@@ -0,0 +1,79 @@
+/*
+ * Description:
+ * Serial command console. See console.h.
+ */
+
+#include "console.h"
+
+/* One registered command */
+struct console_command_t {
+  const char *name;
+  const char *help;
+  console_handler_t handler;
+};
+
+static console_command_t commands[CONSOLE_MAX_COMMANDS];
+static uint8_t command_count = 0;
+
+static char line[CONSOLE_LINE_LEN];  // Characters of the line being typed
+static uint8_t line_len = 0;
+static volatile bool suspended = false;
+
+/* Add a command; the name and help strings must stay valid for the program lifetime */
+bool console_register(const char *name, const char *help, console_handler_t handler) {
+  if (command_count >= CONSOLE_MAX_COMMANDS)
+    return false;
+  commands[command_count++] = {name, help, handler};
+  return true;
+}
+
+/* Print the list of commands */
+static void print_help() {
+  for (uint8_t i = 0; i < command_count; i++)
+    Serial.printf("  %-8s %s\n", commands[i].name, commands[i].help);
+}
+
+/* Split the finished line into words and run the matching command */
+static void dispatch() {
+  char *argv[CONSOLE_MAX_ARGS];
+  int argc = 0;
+  char *save = NULL;
+
+  for (char *word = strtok_r(line, " \t", &save); word != NULL && argc < CONSOLE_MAX_ARGS;
+       word = strtok_r(NULL, " \t", &save))
+    argv[argc++] = word;
+  if (argc == 0)
+    return;
+
+  for (uint8_t i = 0; i < command_count; i++) {
+    if (strcmp(argv[0], commands[i].name) == 0) {
+      commands[i].handler(argc, argv);
+      return;
+    }
+  }
+
+  if (strcmp(argv[0], "help") != 0)
+    Serial.printf("Unknown command: %s\n", argv[0]);
+  print_help();
+}
+
+/* Read available input and run complete commands */
+void console_poll() {
+  while (!suspended && Serial.available() > 0) {
+    char c = Serial.read();
+    if (c == '\r' || c == '\n') {
+      line[line_len] = '\0';
+      line_len = 0;
+      dispatch();
+    } else if (line_len < CONSOLE_LINE_LEN - 1) {
+      line[line_len++] = c;  // Overlong lines are truncated
+    }
+  }
+}
+
+/* Stop or resume reading the Serial port, e.g. while a binary transfer owns it */
+void console_suspend(bool suspend) {
+  if (suspend)
+    line_len = 0;  // Drop any partial command
+  suspended = suspend;
+}
@@ -0,0 +1,23 @@
+/*
+ * Description:
+ * Nibble-table CRC-16/MODBUS. A 16-entry table keeps the footprint small while
+ * still avoiding the bit-by-bit loop.
+ */
+
+#include "crc16.h"
+
+static const uint16_t crc_table[16] = {
+  0x0000, 0xCC01, 0xD801, 0x1400, 0xF001, 0x3C00, 0x2800, 0xE401,
+  0xA001, 0x6C00, 0x7800, 0xB401, 0x5000, 0x9C01, 0x8801, 0x4400,
+};
+
+/* Update a running CRC with a block of bytes */
+uint16_t crc16_update(uint16_t crc, const void *data, size_t len) {
+  const uint8_t *p = (const uint8_t *)data;
+  while (len--) {
+    crc ^= *p++;
+    crc = (crc >> 4) ^ crc_table[crc & 0x0F];  // Low nibble
+    crc = (crc >> 4) ^ crc_table[crc & 0x0F];  // High nibble
+  }
+  return crc;
+}
@@ -0,0 +1,759 @@
+/*
+ * Description:
+ * Tiered flash data logger. See datalog.h for the retention policy.
+ *
+ * Each tier is a ring of segment files named "/log_<tier><slot>". Every segment starts
+ * with a CRC-sealed header carrying a sequence number, and every record carries its own
+ * sequence number and CRC. The log task owns all segment state; other tasks only talk
+ * to it through the sample queue.
+ *
+ * Power-loss recovery never scans the log. Slots are written in order around the ring
+ * and compacted segments stay in place until their slot is reused, so the head is found
+ * by a binary search over the slot headers, and the last intact record of the head by
+ * a binary search over its records. A torn tail is sealed off by starting a new segment.
+ * A cut during compaction restarts that segment. Its output is the same every time, so
+ * a small watermark file, written when the compaction starts, records the next record
+ * number of the destination tier; the restarted job drops as many aggregates as the
+ * destination already holds past that point instead of writing them twice.
+ */
+
+#include "datalog.h"
+#include "console.h"
+#include "crc16.h"
+#include "storage.h"
+#include <time.h>
+
+#define LOG_MAGIC 0x32474C52u   // "RLG2"
+#define LOG_QUEUE_DEPTH 64      // Samples buffered between callers and the log task
+#define LOG_FLUSH_BATCH 16      // Samples written to flash per append
+#define LOG_COMPACT_SLOTS 32    // Open aggregation buckets while compacting
+#define LOG_COMPACT_CHUNK 16    // Records read from the source segment per step, at most LOG_COMPACT_SLOTS
+
+#define LOG_EXPORT_SYNC1 0xA5   // First byte of every export frame
+#define LOG_EXPORT_SYNC2 0x5A   // Second byte of every export frame
+#define LOG_EXPORT_ACK 0x06     // Host received the frame intact
+#define LOG_EXPORT_NAK 0x15     // Host wants the frame again
+#define LOG_EXPORT_HEADER 10    // Sync, tier, seq, chunk and length bytes
+
+#define LOG_SEGMENT_COMPACTED 0x01  // Segment flag: already folded into the next tier
+#define LOG_WATERMARK_FILE "/log_wm"  // Compaction in progress, for a restart after a cut
+
+static_assert(LOG_COMPACT_CHUNK <= LOG_COMPACT_SLOTS, "a compaction chunk must fit the output buffer");
+
+/* Header at the start of every segment file */
+struct log_segment_header_t {
+  uint32_t magic;         // LOG_MAGIC
+  uint32_t seq;           // Increases by one for every new segment of the tier
+  uint32_t first_record;  // Sequence number of the first record in the segment
+  uint8_t tier;           // datalog_tier_t the segment belongs to
+  uint8_t flags;          // LOG_SEGMENT_* flags, updated in place and not covered by the CRC
+  uint16_t crc;           // CRC-16 of the fields before flags
+};
+
+#define LOG_HEADER_CRC_LEN offsetof(log_segment_header_t, flags)
+
+/* Compaction watermark: where the output of a source segment starts in the next tier */
+struct log_watermark_t {
+  uint32_t magic;         // LOG_MAGIC
+  uint32_t src_seq;       // Sequence number of the source segment
+  uint32_t dest_record;   // Next record number of the destination tier when the job started
+  uint8_t tier;           // Tier of the source segment
+  uint8_t reserved;
+  uint16_t crc;           // CRC-16 of the fields before this one
+};
+
+/* Ring bookkeeping for one tier */
+struct log_tier_state_t {
+  char prefix;            // Letter used in the segment file names
+  uint8_t segments;       // Number of slots in the ring
+  uint32_t bucket;        // Seconds per aggregate, 0 for raw samples
+  int8_t head;            // Slot being appended to, -1 if the tier is empty
+  uint8_t used;           // Segments not yet compacted, ending at head
+  uint8_t stored;         // Segments still on flash, ending at head
+  uint32_t head_seq;      // Sequence number of the head segment
+  uint16_t head_records;  // Records in the head segment; LOG_SEGMENT_RECORDS once sealed
+  uint32_t next_record;   // Sequence number for the next record
+};
+
+/* Running aggregate for one tag during compaction */
+struct log_bucket_t {
+  bool open;        // Slot holds a bucket
+  uint16_t tag;     // Tag being aggregated
+  uint32_t time;    // Bucket start time
+  uint32_t count;   // Samples folded in so far
+  int32_t min;
+  int32_t max;
+  int64_t sum;      // Sum of samples, avg = sum / count
+};
+
+/* State of the compaction job in progress */
+struct log_compaction_t {
+  bool active;        // A segment is being compacted
+  bool draining;      // Source fully read, emitting the remaining buckets
+  uint8_t tier;       // Tier of the source segment
+  int8_t slot;        // Slot of the source segment
+  uint32_t next;      // Sequence number of the next source record
+  uint32_t skip;      // Aggregates already in the next tier from an interrupted run
+  File src;           // Source segment, kept open between steps
+  log_bucket_t buckets[LOG_COMPACT_SLOTS];
+  log_record_t out[LOG_COMPACT_SLOTS];  // Aggregates waiting for write budget
+  uint8_t out_count;
+};
+
+static log_tier_state_t tiers[LOG_TIER_COUNT] = {
+  {'r', LOG_RAW_SEGMENTS, 0, -1, 0, 0, 0, 0, 0},
+  {'m', LOG_MINUTE_SEGMENTS, 60, -1, 0, 0, 0, 0, 0},
+  {'h', LOG_HOUR_SEGMENTS, 3600, -1, 0, 0, 0, 0, 0},
+};
+
+/* State of the segment export in progress */
+struct log_export_t {
+  volatile bool requested;  // Set by the console, picked up by the log task
+  bool active;              // Frames are being sent
+  uint8_t tier;             // Tier of the exported segment
+  int8_t slot;              // Slot of the exported segment
+  uint32_t seq;             // Sequence number of the exported segment
+  uint16_t chunk;           // Frame waiting for acknowledgement
+  uint16_t acked;           // Frames acknowledged so far; the resume point
+  uint32_t size;            // Segment size when the export started
+  uint8_t retries;          // Resends of the current frame
+  bool ack_pending;         // ACK received, its chunk byte not yet
+  uint32_t sent_ms;         // When the current frame was sent
+  File file;
+  uint8_t frame[LOG_EXPORT_HEADER + LOG_EXPORT_CHUNK + 2];
+};
+
+static log_compaction_t job;
+static log_export_t xfer;
+static QueueHandle_t log_queue = NULL;
+static datalog_stats_t stats;
+
+static uint32_t write_tokens = LOG_COMPACT_WRITE_BUDGET * 1000; // Compaction budget in byte-milliseconds
+static uint32_t tokens_updated_ms = 0;                   // Last token refill
+
+/* Build the file name of a segment slot */
+static void slot_path(uint8_t tier, uint8_t slot, char *path, size_t len) {
+  snprintf(path, len, "/log_%c%u", tiers[tier].prefix, slot);
+}
+
+/* Slot of the oldest segment in a tier */
+static int8_t oldest_slot(uint8_t tier) {
+  log_tier_state_t &t = tiers[tier];
+  return (t.head - t.used + 1 + t.segments) % t.segments;
+}
+
+/* Slot k segments before the head */
+static uint8_t slot_back(uint8_t tier, uint8_t k) {
+  log_tier_state_t &t = tiers[tier];
+  return (t.head - k + t.segments) % t.segments;
+}
+
+/* CRC of a record, computed with its crc field zero */
+static uint16_t record_crc(const log_record_t &r) {
+  log_record_t copy = r;
+  copy.crc = 0;
+  return crc16(&copy, sizeof(copy));
+}
+
+/* Read and check the header of a segment slot, false if missing or damaged */
+static bool read_header(uint8_t tier, uint8_t slot, log_segment_header_t *hdr, size_t *size = NULL) {
+  char path[16];
+  slot_path(tier, slot, path, sizeof(path));
+  if (!storage_fs().exists(path))
+    return false;
+
+  File f = storage_fs().open(path, "r");
+  if (!f)
+    return false;
+  bool ok = f.read((uint8_t *)hdr, sizeof(*hdr)) == sizeof(*hdr) && hdr->magic == LOG_MAGIC &&
+            hdr->tier == tier && hdr->crc == crc16(hdr, LOG_HEADER_CRC_LEN);
+  if (size != NULL)
+    *size = f.size();
+  f.close();
+  return ok;
+}
+
+/* Read record i of an open segment and check its CRC and sequence number */
+static bool read_record(File &f, uint32_t i, uint32_t expected_seq, log_record_t *r) {
+  f.seek(sizeof(log_segment_header_t) + i * sizeof(log_record_t));
+  return f.read((uint8_t *)r, sizeof(*r)) == sizeof(*r) && r->seq == expected_seq &&
+         r->crc == record_crc(*r);
+}
+
+/* Find the head slot by binary search. Going round the ring from slot 0, sequence numbers
+   rise up to the head and then drop, so "seq >= seq of slot 0" holds for a prefix. */
+static bool find_head(uint8_t tier, log_segment_header_t *head) {
+  log_tier_state_t &t = tiers[tier];
+  log_segment_header_t first, hdr;
+
+  if (!read_header(tier, 0, &first)) {
+    // Slot 0 is only unreadable on a fresh log or after a cut while it was being
+    // reopened; fall back to checking every slot, which is rare and still bounded.
+    bool found = false;
+    for (uint8_t slot = 1; slot < t.segments; slot++) {
+      if (read_header(tier, slot, &hdr) && (!found || hdr.seq > head->seq)) {
+        *head = hdr;
+        t.head = slot;
+        found = true;
+      }
+    }
+    return found;
+  }
+
+  uint8_t lo = 0, hi = t.segments;  // Slot lo is in the prefix, hi is past it
+  while (hi - lo > 1) {
+    uint8_t mid = (lo + hi) / 2;
+    if (read_header(tier, mid, &hdr) && hdr.seq >= first.seq)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  t.head = lo;
+  return read_header(tier, lo, head);
+}
+
+/* Count the segments back from the head that are intact, and live if asked, by binary search */
+static uint8_t count_back(uint8_t tier, uint8_t limit, bool live_only) {
+  log_tier_state_t &t = tiers[tier];
+  uint8_t lo = 0, hi = limit;  // Segments before lo match, those from hi on do not
+  while (lo < hi) {
+    uint8_t k = (lo + hi) / 2;
+    log_segment_header_t hdr;
+    bool match = read_header(tier, slot_back(tier, k), &hdr) && hdr.seq == t.head_seq - k &&
+                 !(live_only && (hdr.flags & LOG_SEGMENT_COMPACTED));
+    if (match)
+      lo = k + 1;
+    else
+      hi = k;
+  }
+  return lo;
+}
+
+/* Rebuild the ring state of a tier after a reboot without scanning the log */
+static void tier_recover(uint8_t tier) {
+  log_tier_state_t &t = tiers[tier];
+  log_segment_header_t head;
+  if (!find_head(tier, &head)) {
+    t.head = -1;
+    return;
+  }
+  t.head_seq = head.seq;
+  t.stored = count_back(tier, t.segments, false);
+  t.used = count_back(tier, t.stored, true);
+
+  // Records form an intact prefix of the head segment; find where it ends
+  char path[16];
+  slot_path(tier, t.head, path, sizeof(path));
+  File f = storage_fs().open(path, "r");
+  uint32_t on_flash = f ? (f.size() - sizeof(head)) / sizeof(log_record_t) : 0;
+  uint32_t lo = 0, hi = min(on_flash, (uint32_t)LOG_SEGMENT_RECORDS);
+  while (lo < hi) {
+    uint32_t mid = (lo + hi) / 2;
+    log_record_t r;
+    if (read_record(f, mid, head.first_record + mid, &r))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  bool torn = f && f.size() != sizeof(head) + lo * sizeof(log_record_t);
+  if (f)
+    f.close();
+
+  t.next_record = head.first_record + lo;
+  // Never append after damaged bytes: a torn head is sealed and the next append starts a new segment
+  t.head_records = torn ? LOG_SEGMENT_RECORDS : lo;
+}
+
+/* Start a new head segment, reusing the oldest slot */
+static bool tier_open_segment(uint8_t tier) {
+  log_tier_state_t &t = tiers[tier];
+  int8_t slot = (t.head + 1) % t.segments;
+  char path[16];
+  slot_path(tier, slot, path, sizeof(path));
+
+  if (xfer.active && xfer.tier == tier && xfer.slot == slot) {
+    xfer.file.close();
+    xfer.active = false;
+    console_suspend(false);
+  }
+  if (t.used == t.segments) {
+    // Ring is full: the oldest segment is lost without being compacted
+    if (job.active && job.tier == tier && job.slot == slot) {
+      job.src.close();
+      job.active = false;
+    }
+    t.used--;
+    stats.segments_expired++;
+  }
+  if (t.stored == t.segments)
+    t.stored--;
+
+  File f = storage_fs().open(path, "w");
+  if (!f)
+    return false;
+  log_segment_header_t hdr = {LOG_MAGIC, t.head_seq + 1, t.next_record, tier, 0, 0};
+  hdr.crc = crc16(&hdr, LOG_HEADER_CRC_LEN);
+  bool ok = f.write((const uint8_t *)&hdr, sizeof(hdr)) == sizeof(hdr);
+  f.close();
+  if (!ok)
+    return false;
+
+  t.head = slot;
+  t.head_seq = hdr.seq;
+  t.head_records = 0;
+  t.used++;
+  t.stored++;
+  return true;
+}
+
+/* Number and seal records, then append them to the head segment of a tier,
+   rolling over to new segments as needed */
+static bool tier_append(uint8_t tier, log_record_t *records, size_t count) {
+  log_tier_state_t &t = tiers[tier];
+
+  while (count > 0) {
+    if (t.head < 0 || t.head_records >= LOG_SEGMENT_RECORDS) {
+      if (!tier_open_segment(tier))
+        return false;
+    }
+
+    size_t n = min((size_t)(LOG_SEGMENT_RECORDS - t.head_records), count);
+    for (size_t i = 0; i < n; i++) {
+      records[i].seq = t.next_record + i;
+      records[i].crc = record_crc(records[i]);
+    }
+
+    char path[16];
+    slot_path(tier, t.head, path, sizeof(path));
+    File f = storage_fs().open(path, "a");
+    if (!f)
+      return false;
+    size_t bytes = n * sizeof(log_record_t);
+    bool ok = f.write((const uint8_t *)records, bytes) == bytes;
+    f.close();
+    if (!ok)
+      return false;
+
+    t.head_records += n;
+    t.next_record += n;
+    records += n;
+    count -= n;
+  }
+  return true;
+}
+
+/* Refill the compaction write budget and try to take the given number of bytes */
+static bool take_write_tokens(uint32_t bytes) {
+  uint32_t now = millis();
+  uint32_t elapsed = min(now - tokens_updated_ms, (uint32_t)1000); // A full bucket after one second
+  write_tokens += elapsed * LOG_COMPACT_WRITE_BUDGET;
+  if (write_tokens > LOG_COMPACT_WRITE_BUDGET * 1000)
+    write_tokens = LOG_COMPACT_WRITE_BUDGET * 1000;  // Allow at most one second of burst
+  tokens_updated_ms = now;
+
+  if (write_tokens < bytes * 1000)
+    return false;
+  write_tokens -= bytes * 1000;
+  return true;
+}
+
+/* Move a finished bucket to the output buffer; false, and the bucket stays open, if
+   the buffer is full */
+static bool emit_bucket(log_bucket_t &b) {
+  if (job.out_count >= LOG_COMPACT_SLOTS)
+    return false;
+  log_record_t &r = job.out[job.out_count++];
+  r.time = b.time;
+  r.tag = b.tag;
+  r.count = b.count;
+  r.min = b.min;
+  r.max = b.max;
+  r.avg = (int32_t)(b.sum / (int64_t)b.count);
+  b.open = false;
+  return true;
+}
+
+/* Bucket aggregating tag, else a free slot, else the oldest bucket, which has to be
+   closed first. Any slot can hold any tag, so tags that share their low bits never evict
+   each other while there is room */
+static log_bucket_t &find_bucket(uint16_t tag) {
+  log_bucket_t *spare = nullptr;
+  for (log_bucket_t &b : job.buckets) {
+    if (b.open && b.tag == tag)
+      return b;
+    if (!spare || (spare->open && (!b.open || b.time < spare->time)))
+      spare = &b;
+  }
+  return *spare;
+}
+
+/* Fold one source record into its destination bucket; false if the bucket it closes
+   found no room in the output buffer */
+static bool accumulate(const log_record_t &r, uint32_t width) {
+  uint32_t start = r.time - r.time % width;
+  log_bucket_t &b = find_bucket(r.tag);
+
+  // A later bucket of the same tag, or another tag in the oldest slot, closes the open one
+  if (b.open && (b.tag != r.tag || b.time != start) && !emit_bucket(b))
+    return false;
+
+  if (!b.open) {
+    b.open = true;
+    b.tag = r.tag;
+    b.time = start;
+    b.count = 0;
+    b.min = r.min;
+    b.max = r.max;
+    b.sum = 0;
+  }
+  b.count += r.count;
+  b.min = min(b.min, r.min);
+  b.max = max(b.max, r.max);
+  b.sum += (int64_t)r.avg * r.count;
+  return true;
+}
+
+/* Count the aggregates an interrupted run of this job already appended, or record
+   where its output starts if it is a fresh job */
+static uint32_t compaction_watermark(uint32_t src_seq) {
+  const log_tier_state_t &dest = tiers[job.tier + 1];
+  uint32_t dest_record = dest.head < 0 ? 0 : dest.next_record;
+  log_watermark_t wm;
+  File f = storage_fs().open(LOG_WATERMARK_FILE, "r");
+  if (f) {
+    bool ok = f.read((uint8_t *)&wm, sizeof(wm)) == sizeof(wm) && wm.magic == LOG_MAGIC &&
+              wm.crc == crc16(&wm, offsetof(log_watermark_t, crc));
+    f.close();
+    if (ok && wm.tier == job.tier && wm.src_seq == src_seq && dest_record >= wm.dest_record)
+      return dest_record - wm.dest_record;
+  }
+  wm = {LOG_MAGIC, src_seq, dest_record, job.tier, 0, 0};
+  wm.crc = crc16(&wm, offsetof(log_watermark_t, crc));
+  f = storage_fs().open(LOG_WATERMARK_FILE, "w");
+  if (f) {
+    f.write((const uint8_t *)&wm, sizeof(wm));
+    f.close();
+  }
+  return 0;
+}
+
+/* Pick the next segment that has to be compacted, coarsest tier first */
+static void compaction_start() {
+  for (int tier = LOG_TIER_COUNT - 2; tier >= 0; tier--) {
+    log_tier_state_t &t = tiers[tier];
+    // Keep one free slot so new data never has to overwrite uncompacted data
+    if (t.used < t.segments - 1)
+      continue;
+
+    char path[16];
+    log_segment_header_t hdr;
+    job.slot = oldest_slot(tier);
+    slot_path(tier, job.slot, path, sizeof(path));
+    job.src = storage_fs().open(path, "r");
+    job.tier = tier;
+    job.skip = 0;
+    if (job.src && job.src.read((uint8_t *)&hdr, sizeof(hdr)) == sizeof(hdr)) {
+      job.next = hdr.first_record;
+      job.skip = compaction_watermark(hdr.seq);
+    } else if (job.src) {
+      job.src.close();  // Unreadable segment: nothing to fold in
+    }
+    job.active = true;
+    job.draining = false;
+    job.out_count = 0;
+    memset(job.buckets, 0, sizeof(job.buckets));
+    return;
+  }
+}
+
+/* Mark the source segment compacted. It stays on flash until its slot is reused,
+   which keeps the ring contiguous for the recovery search. */
+static void compaction_finish() {
+  char path[16];
+  slot_path(job.tier, job.slot, path, sizeof(path));
+  if (job.src)
+    job.src.close();
+
+  File f = storage_fs().open(path, "r+");
+  if (f) {
+    uint8_t flags = LOG_SEGMENT_COMPACTED;
+    f.seek(offsetof(log_segment_header_t, flags));
+    f.write(&flags, 1);
+    f.close();
+  }
+
+  tiers[job.tier].used--;
+  stats.segments_compacted++;
+  job.active = false;
+}
+
+/* Do a small, budget-limited piece of compaction work */
+static void compaction_step() {
+  if (!job.active) {
+    compaction_start();
+    if (!job.active)
+      return;
+  }
+
+  // Drop the aggregates an interrupted run already wrote
+  if (job.out_count > 0 && job.skip > 0) {
+    uint8_t n = min(job.skip, (uint32_t)job.out_count);
+    memmove(job.out, job.out + n, (job.out_count - n) * sizeof(log_record_t));
+    job.out_count -= n;
+    job.skip -= n;
+  }
+
+  // Write out pending aggregates first, as far as the budget allows
+  if (job.out_count > 0) {
+    uint8_t n = job.out_count;
+    while (n > 0 && !take_write_tokens(n * sizeof(log_record_t)))
+      n /= 2;
+    if (n == 0)
+      return;
+    if (!tier_append(job.tier + 1, job.out, n))
+      return;
+    memmove(job.out, job.out + n, (job.out_count - n) * sizeof(log_record_t));
+    job.out_count -= n;
+    if (job.out_count > 0)
+      return;
+  }
+
+  // Source read: emit the open buckets into the now empty output buffer, which holds
+  // all of them, and finish once they are written
+  if (job.draining) {
+    bool emitted = false;
+    for (uint8_t i = 0; i < LOG_COMPACT_SLOTS; i++) {
+      if (job.buckets[i].open && emit_bucket(job.buckets[i]))
+        emitted = true;
+    }
+    if (!emitted)
+      compaction_finish();
+    return;
+  }
+
+  // The output buffer is empty here and each record emits at most one bucket, so a
+  // chunk fits; records that would not are read again on the next step
+  log_record_t chunk[LOG_COMPACT_CHUNK];
+  size_t n = job.src ? job.src.read((uint8_t *)chunk, sizeof(chunk)) / sizeof(log_record_t) : 0;
+  uint32_t width = tiers[job.tier + 1].bucket;
+  size_t valid = 0;
+  while (valid < n && chunk[valid].seq == job.next && chunk[valid].crc == record_crc(chunk[valid])) {
+    if (!accumulate(chunk[valid], width)) {
+      job.src.seek(job.src.position() - (n - valid) * sizeof(log_record_t));
+      return;
+    }
+    valid++;  // Stop at the first damaged record, as recovery does
+    job.next++;
+  }
+
+  if (valid < LOG_COMPACT_CHUNK)
+    job.draining = true;  // End of the segment, or a damaged or torn record
+}
+
+/* Slot holding the segment with the given sequence number, -1 if it is gone */
+static int8_t find_segment(uint8_t tier, uint32_t seq) {
+  log_tier_state_t &t = tiers[tier];
+  uint32_t age = t.head_seq - seq;
+  if (t.head < 0 || seq > t.head_seq || age >= t.stored)
+    return -1;
+  return (t.head - (int)age + t.segments) % t.segments;
+}
+
+/* Read the current chunk straight from flash into the frame buffer and send it */
+static void export_send() {
+  uint32_t offset = (uint32_t)xfer.chunk * LOG_EXPORT_CHUNK;
+  uint8_t len = 0;
+  if (offset < xfer.size) {
+    xfer.file.seek(offset);
+    len = xfer.file.read(xfer.frame + LOG_EXPORT_HEADER, min((uint32_t)LOG_EXPORT_CHUNK, xfer.size - offset));
+  }
+
+  uint8_t *f = xfer.frame;
+  f[0] = LOG_EXPORT_SYNC1;
+  f[1] = LOG_EXPORT_SYNC2;
+  f[2] = xfer.tier;
+  memcpy(f + 3, &xfer.seq, 4);    // Little endian on the ESP32
+  memcpy(f + 7, &xfer.chunk, 2);
+  f[9] = len;
+  uint16_t crc = crc16(f + 2, LOG_EXPORT_HEADER - 2 + len);
+  f[LOG_EXPORT_HEADER + len] = crc & 0xFF;
+  f[LOG_EXPORT_HEADER + len + 1] = crc >> 8;
+
+  Serial.write(f, LOG_EXPORT_HEADER + len + 2);
+  xfer.sent_ms = millis();
+}
+
+/* Stop the transfer and hand the port back to the console */
+static void export_end(bool complete) {
+  xfer.file.close();
+  xfer.active = false;
+  console_suspend(false);
+  if (!complete)
+    Serial.printf("\nExport stopped after %u chunks, use 'log resume'\n", xfer.acked);
+}
+
+/* Open the requested segment and send its first frame */
+static void export_start() {
+  xfer.requested = false;
+  xfer.slot = find_segment(xfer.tier, xfer.seq);
+  if (xfer.slot >= 0) {
+    char path[16];
+    slot_path(xfer.tier, xfer.slot, path, sizeof(path));
+    xfer.file = storage_fs().open(path, "r");
+  }
+  if (xfer.slot < 0 || !xfer.file) {
+    console_suspend(false);
+    Serial.printf("Segment %c%u not found\n", tiers[xfer.tier].prefix, xfer.seq);
+    return;
+  }
+
+  xfer.size = xfer.file.size();
+  xfer.chunk = xfer.acked;
+  xfer.retries = 0;
+  xfer.ack_pending = false;
+  xfer.active = true;
+  export_send();
+}
+
+/* Handle host replies and timeouts for the frame in flight. Only an ACK carrying the
+   chunk in flight moves on; a stray one for an earlier frame is ignored */
+static void export_step() {
+  bool resend = false;
+  while (Serial.available() > 0) {
+    int c = Serial.read();
+    if (xfer.ack_pending) {
+      xfer.ack_pending = false;
+      if (c != (xfer.chunk & 0xFF))
+        continue;
+      if ((uint32_t)xfer.chunk * LOG_EXPORT_CHUNK >= xfer.size) {
+        export_end(true);  // End frame acknowledged
+        return;
+      }
+      xfer.acked = ++xfer.chunk;
+      xfer.retries = 0;
+      export_send();
+    } else if (c == LOG_EXPORT_ACK) {
+      xfer.ack_pending = true;
+    } else if (c == LOG_EXPORT_NAK) {
+      resend = true;
+    }
+  }
+
+  if (!resend && millis() - xfer.sent_ms < LOG_EXPORT_TIMEOUT_MS)
+    return;
+  if (++xfer.retries > LOG_EXPORT_RETRIES) {
+    export_end(false);
+    return;
+  }
+  export_send();
+}
+
+/* Background task: flush queued samples, then compact in the idle time */
+static void log_task(void *arg) {
+  log_record_t batch[LOG_FLUSH_BATCH];
+
+  for (;;) {
+    size_t n = 0;
+    // Wait a little for samples, then take whatever else is already queued
+    TickType_t wait = pdMS_TO_TICKS(xfer.active ? 5 : 100);
+    if (xQueueReceive(log_queue, &batch[n], wait) == pdTRUE) {
+      n++;
+      while (n < LOG_FLUSH_BATCH && xQueueReceive(log_queue, &batch[n], 0) == pdTRUE)
+        n++;
+    }
+
+    if (n > 0)
+      tier_append(LOG_TIER_RAW, batch, n);
+
+    if (xfer.requested)
+      export_start();
+    if (xfer.active)
+      export_step();   // Compaction waits so the exported segment stays in place
+    else
+      compaction_step();
+
+    for (uint8_t tier = 0; tier < LOG_TIER_COUNT; tier++)
+      stats.used[tier] = tiers[tier].used;
+  }
+}
+
+/* Tier index from its file name letter, -1 if unknown */
+static int tier_from_name(const char *name) {
+  for (uint8_t tier = 0; tier < LOG_TIER_COUNT; tier++) {
+    if (name[0] == tiers[tier].prefix && name[1] == '\0')
+      return tier;
+  }
+  return -1;
+}
+
+/* Console: "log", "log export <r|m|h> <seq> [chunk]" or "log resume" */
+static void log_command(int argc, char **argv) {
+  if (argc >= 4 && strcmp(argv[1], "export") == 0) {
+    int tier = tier_from_name(argv[2]);
+    if (tier < 0) {
+      Serial.println("Tier must be r, m or h");
+      return;
+    }
+    uint16_t chunk = argc >= 5 ? atoi(argv[4]) : 0;
+    datalog_export(tier, strtoul(argv[3], NULL, 10), chunk);
+  } else if (argc >= 2 && strcmp(argv[1], "resume") == 0) {
+    datalog_export(xfer.tier, xfer.seq, xfer.acked);
+  } else {
+    for (uint8_t tier = 0; tier < LOG_TIER_COUNT; tier++) {
+      log_tier_state_t &t = tiers[tier];
+      Serial.printf("%c: %u/%u segments, %u not compacted", t.prefix, t.stored, t.segments, t.used);
+      if (t.stored > 0)
+        Serial.printf(", seq %u..%u", t.head_seq - t.stored + 1, t.head_seq);
+      Serial.println();
+    }
+    Serial.printf("appended %u, dropped %u, compacted %u, expired %u\n", stats.appended,
+                  stats.dropped, stats.segments_compacted, stats.segments_expired);
+  }
+}
+
+/* Recover segment state and start the log task. The file system must be mounted. */
+bool datalog_begin() {
+  for (uint8_t tier = 0; tier < LOG_TIER_COUNT; tier++)
+    tier_recover(tier);
+
+  log_queue = xQueueCreate(LOG_QUEUE_DEPTH, sizeof(log_record_t));
+  if (log_queue == NULL)
+    return false;
+
+  tokens_updated_ms = millis();
+  console_register("log", "Log status, export <r|m|h> <seq> [chunk], resume", log_command);
+  return xTaskCreatePinnedToCore(log_task, "datalog", 4096, NULL, LOG_TASK_PRIORITY,
+                                 NULL, LOG_TASK_CORE) == pdPASS;
+}
+
+/* Queue a sample for the log task; drops the sample rather than block the caller */
+bool datalog_append(uint16_t tag, int32_t value) {
+  if (log_queue == NULL)
+    return false;
+
+  log_record_t r = {0, (uint32_t)time(NULL), tag, 0, 1, value, value, value};  // Sealed by the log task
+  if (xQueueSend(log_queue, &r, 0) != pdTRUE) {
+    stats.dropped++;
+    return false;
+  }
+  stats.appended++;
+  return true;
+}
+
+/* Snapshot the logger counters */
+void datalog_get_stats(datalog_stats_t *out) {
+  *out = stats;
+}
+
+/* Ask the log task to stream a segment over Serial, starting at the given chunk */
+bool datalog_export(uint8_t tier, uint32_t seq, uint16_t first_chunk) {
+  if (log_queue == NULL || tier >= LOG_TIER_COUNT || xfer.active || xfer.requested)
+    return false;
+
+  console_suspend(true);  // The host's ACK/NAK bytes must not reach the command parser
+  xfer.tier = tier;
+  xfer.seq = seq;
+  xfer.acked = first_chunk;
+  xfer.requested = true;
+  return true;
+}
@@ -0,0 +1,161 @@
+/*
+ * Description:
+ * Modbus diagnostics and link-quality probing. See diag.h.
+ */
+
+#include "diag.h"
+#include "bus.h"
+#include "bus_load.h"
+#include "config.h"
+#include "console.h"
+#include "datalog.h"
+#include "modbus_rtu.h"
+
+static diag_link_t links[DIAG_MAX_SLAVES];
+static portMUX_TYPE diag_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t probe_due_ms = 0;
+static uint8_t probe_next = 0;              // Index of the next slave to probe
+static volatile uint8_t readout_slave = 0;  // Counter readout asked for from the console
+
+/* Statistics entry of a slave, claiming a free one on first use */
+static diag_link_t *link_of(uint8_t slave) {
+  for (uint8_t i = 0; i < DIAG_MAX_SLAVES; i++) {
+    if (links[i].slave == slave)
+      return &links[i];
+    if (links[i].slave == 0) {
+      links[i] = {slave, 0, 0, 0, UINT32_MAX, 0};
+      return &links[i];
+    }
+  }
+  return NULL;
+}
+
+/* Send one FC08 request and check the echo of the sub-function; the reply data is the
+   last word of the response. The round trip time goes to rtt_us */
+static bool transact(uint8_t slave, uint16_t sub_function, uint16_t data, uint16_t *reply, uint32_t *rtt_us) {
+  uint32_t baud = config_get().baud;
+  uint32_t gap_us = bus_gap_us(baud);
+  uint8_t payload[4] = {(uint8_t)(sub_function >> 8), (uint8_t)sub_function, (uint8_t)(data >> 8), (uint8_t)data};
+  uint8_t request[8];
+  uint8_t response[16];
+  size_t len = rtu_frame(request, slave, 0x08, payload, sizeof(payload));
+
+  uint32_t start_us = micros();
+  rtu_send(Serial2, request, len, gap_us);
+  size_t got = rtu_receive(Serial2, response, sizeof(response), DIAG_TIMEOUT_MS, gap_us);
+  *rtt_us = micros() - start_us;
+  bus_load_record(slave, POLL_BACKGROUND, bus_wire_us(baud, len, got));
+
+  bool ok = got == 8 && rtu_valid(response, got) && response[0] == slave && response[1] == 0x08 &&
+            memcmp(response + 2, payload, 2) == 0;
+  bus_count_frame(start_us, ok);
+  if (!ok)
+    return false;  // Lost, damaged, or an exception (function 0x88)
+  *reply = (response[4] << 8) | response[5];
+  return true;
+}
+
+/* One FC08 request from the bus task */
+bool diag_request(uint8_t slave, uint16_t sub_function, uint16_t data, uint16_t *reply) {
+  uint32_t rtt_us;
+  return transact(slave, sub_function, data, reply, &rtt_us);
+}
+
+/* Loopback probe: time the echo and update the slave's link statistics and trend */
+static void probe(uint8_t slave) {
+  uint16_t data = (uint16_t)esp_random();
+  uint16_t echo = 0;
+  uint32_t rtt_us;
+  bool ok = transact(slave, DIAG_RETURN_QUERY_DATA, data, &echo, &rtt_us) && echo == data;
+
+  portENTER_CRITICAL(&diag_lock);
+  diag_link_t *l = link_of(slave);
+  if (l != NULL) {
+    l->probes++;
+    if (!ok) {
+      l->lost++;
+    } else {
+      l->rtt_us = l->probes - l->lost == 1 ? rtt_us : l->rtt_us + ((int32_t)(rtt_us - l->rtt_us) >> 3);
+      l->rtt_min_us = min(l->rtt_min_us, rtt_us);
+      l->rtt_max_us = max(l->rtt_max_us, rtt_us);
+    }
+  }
+  portEXIT_CRITICAL(&diag_lock);
+
+  if (ok)
+    datalog_append(DIAG_TAG_RTT(slave), rtt_us);
+  datalog_append(DIAG_TAG_LOSS(slave), ok ? 0 : 1000);
+}
+
+/* Print the slave's own view of the link */
+static void readout(uint8_t slave) {
+  static const struct {
+    uint16_t sub_function;
+    const char *name;
+  } counters[] = {
+    {DIAG_BUS_MESSAGE_COUNT, "bus messages"},
+    {DIAG_BUS_CRC_ERROR_COUNT, "CRC errors"},
+    {DIAG_BUS_EXCEPTION_COUNT, "exceptions"},
+  };
+
+  Serial.printf("slave %u counters:\n", slave);
+  for (const auto &c : counters) {
+    uint16_t value;
+    if (diag_request(slave, c.sub_function, 0, &value))
+      Serial.printf("  %-13s %u\n", c.name, value);
+    else
+      Serial.printf("  %-13s no answer\n", c.name);
+  }
+}
+
+/* Bus task: run a console readout and the next probe when due; returns ms until the
+   next probe */
+int32_t diag_service(uint32_t now, const uint8_t *slaves, uint8_t count) {
+  uint8_t slave = readout_slave;
+  if (slave != 0) {
+    readout(slave);
+    readout_slave = 0;
+  }
+
+  if (count == 0)
+    return DIAG_PROBE_MS;
+  int32_t wait = probe_due_ms - now;
+  if (wait > 0)
+    return wait;
+  probe(slaves[probe_next++ % count]);
+  probe_due_ms = now + DIAG_PROBE_MS;
+  return DIAG_PROBE_MS;
+}
+
+/* Console: "diag" lists link statistics, "diag <slave>" reads the slave's counters */
+static void diag_command(int argc, char **argv) {
+  if (argc > 1) {
+    char *end;
+    unsigned long slave = strtoul(argv[1], &end, 10);
+    if (*end != '\0' || slave < 1 || slave > 247)
+      Serial.println("Slave must be 1-247");
+    else
+      readout_slave = (uint8_t)slave;  // Printed by the bus task between polls
+    return;
+  }
+
+  diag_link_t copy[DIAG_MAX_SLAVES];
+  portENTER_CRITICAL(&diag_lock);
+  memcpy(copy, links, sizeof(copy));
+  portEXIT_CRITICAL(&diag_lock);
+
+  Serial.println("slave  probes  loss%   rtt ms  min ms  max ms");
+  for (uint8_t i = 0; i < DIAG_MAX_SLAVES && copy[i].slave != 0; i++) {
+    const diag_link_t &l = copy[i];
+    Serial.printf("%5u  %6u  %5.1f", l.slave, l.probes, l.probes ? l.lost * 100.0f / l.probes : 0.0f);
+    if (l.probes > l.lost)
+      Serial.printf("  %7.1f  %6.1f  %6.1f\n", l.rtt_us / 1000.0f, l.rtt_min_us / 1000.0f, l.rtt_max_us / 1000.0f);
+    else
+      Serial.println("        -       -       -");
+  }
+}
+
+/* Register the console command */
+void diag_begin() {
+  console_register("diag", "Link quality per slave, or <slave> for its FC08 counters", diag_command);
+}
@@ -0,0 +1,265 @@
+/*
+ * Description:
+ * Expression compiler and bytecode interpreter. See expr.h.
+ *
+ * The compiler is a precedence-climbing parser that emits postfix code as it goes.
+ */
+
+#include "expr.h"
+#include <ctype.h>
+
+/* Opcodes; OP_CONST is followed by an int32 and OP_TAG by a tag ID byte */
+enum {
+  OP_CONST = 0, OP_TAG,
+  OP_NEG, OP_NOT, OP_BNOT, OP_ABS,                      // Unary
+  OP_MUL, OP_DIV, OP_MOD, OP_ADD, OP_SUB, OP_SHL, OP_SHR,
+  OP_LT, OP_LE, OP_GT, OP_GE, OP_EQ, OP_NE,
+  OP_AND, OP_XOR, OP_OR, OP_LAND, OP_LOR, OP_MIN, OP_MAX // Binary
+};
+
+/* Binary operators, longest spelling first so "<=" is not read as "<" */
+static const struct {
+  const char *text;
+  uint8_t precedence;   // Higher binds tighter
+  uint8_t op;
+} binary_ops[] = {
+  {"<<", 8, OP_SHL}, {">>", 8, OP_SHR}, {"<=", 7, OP_LE}, {">=", 7, OP_GE},
+  {"==", 6, OP_EQ}, {"!=", 6, OP_NE}, {"&&", 2, OP_LAND}, {"||", 1, OP_LOR},
+  {"*", 10, OP_MUL}, {"/", 10, OP_DIV}, {"%", 10, OP_MOD}, {"+", 9, OP_ADD}, {"-", 9, OP_SUB},
+  {"<", 7, OP_LT}, {">", 7, OP_GT}, {"&", 5, OP_AND}, {"^", 4, OP_XOR}, {"|", 3, OP_OR},
+};
+
+/* Compiler state */
+struct compiler_t {
+  const char *p;        // Next character
+  uint8_t *code;
+  size_t len;
+  size_t max;
+  int depth;            // Stack depth after the code so far
+  tag_mask_t inputs;
+  const char *error;
+};
+
+/* Append bytes of code; the stack changes by delta */
+static bool emit(compiler_t &c, const void *bytes, size_t n, int delta) {
+  if (c.len + n > c.max) {
+    c.error = "expression too long";
+    return false;
+  }
+  memcpy(c.code + c.len, bytes, n);
+  c.len += n;
+  c.depth += delta;
+  if (c.depth > EXPR_STACK) {
+    c.error = "expression too deep";
+    return false;
+  }
+  return true;
+}
+
+static bool emit_op(compiler_t &c, uint8_t op, int delta) {
+  return emit(c, &op, 1, delta);
+}
+
+static void skip_space(compiler_t &c) {
+  while (isspace((unsigned char)*c.p))
+    c.p++;
+}
+
+/* Consume text if it comes next */
+static bool accept(compiler_t &c, const char *text) {
+  skip_space(c);
+  size_t n = strlen(text);
+  if (strncmp(c.p, text, n) != 0)
+    return false;
+  c.p += n;
+  return true;
+}
+
+static bool expect(compiler_t &c, const char *text) {
+  if (accept(c, text))
+    return true;
+  c.error = *text == ')' ? "missing )" : "missing ,";
+  return false;
+}
+
+static bool parse_expr(compiler_t &c, uint8_t min_precedence);
+
+/* Function call after its name: abs(x), min(a, b), max(a, b) */
+static bool parse_call(compiler_t &c, const char *name, size_t n) {
+  bool two = strncmp(name, "min", n) == 0 || strncmp(name, "max", n) == 0;
+  if (n != 3 || (!two && strncmp(name, "abs", n) != 0)) {
+    c.error = "unknown function";
+    return false;
+  }
+  if (!parse_expr(c, 0))
+    return false;
+  if (!two)
+    return expect(c, ")") && emit_op(c, OP_ABS, 0);
+  return expect(c, ",") && parse_expr(c, 0) && expect(c, ")") &&
+         emit_op(c, name[1] == 'i' ? OP_MIN : OP_MAX, -1);
+}
+
+/* Operand: constant, tag, call, parenthesised or unary expression */
+static bool parse_operand(compiler_t &c) {
+  skip_space(c);
+  if (accept(c, "("))
+    return parse_expr(c, 0) && expect(c, ")");
+  if (accept(c, "-"))
+    return parse_operand(c) && emit_op(c, OP_NEG, 0);
+  if (accept(c, "!"))
+    return parse_operand(c) && emit_op(c, OP_NOT, 0);
+  if (accept(c, "~"))
+    return parse_operand(c) && emit_op(c, OP_BNOT, 0);
+
+  if (isdigit((unsigned char)*c.p)) {
+    char *end;
+    bool hex = c.p[0] == '0' && (c.p[1] == 'x' || c.p[1] == 'X');
+    int32_t v = (int32_t)strtoul(c.p, &end, hex ? 16 : 10);  // A leading zero is not octal
+    c.p = end;
+    return emit_op(c, OP_CONST, 1) && emit(c, &v, sizeof(v), 0);
+  }
+
+  const char *name = c.p;
+  while (isalnum((unsigned char)*c.p) || *c.p == '_')
+    c.p++;
+  size_t n = c.p - name;
+  if (n == 0) {
+    c.error = "operand expected";
+    return false;
+  }
+  if (accept(c, "("))
+    return parse_call(c, name, n);
+
+  char tag_name[32];
+  if (n >= sizeof(tag_name)) {
+    c.error = "name too long";
+    return false;
+  }
+  memcpy(tag_name, name, n);
+  tag_name[n] = '\0';
+  int id = tag_find(tag_name);
+  if (id < 0) {
+    c.error = "unknown tag";
+    return false;
+  }
+  c.inputs |= TAG_BIT(id);
+  uint8_t id8 = id;
+  return emit_op(c, OP_TAG, 1) && emit(c, &id8, 1, 0);
+}
+
+/* Operand followed by binary operators binding at least as tight as min_precedence */
+static bool parse_expr(compiler_t &c, uint8_t min_precedence) {
+  if (!parse_operand(c))
+    return false;
+  for (;;) {
+    skip_space(c);
+    const auto *match = &binary_ops[0];
+    bool found = false;
+    for (const auto &b : binary_ops) {
+      if (strncmp(c.p, b.text, strlen(b.text)) == 0) {
+        match = &b;
+        found = true;
+        break;
+      }
+    }
+    if (!found || match->precedence < min_precedence)
+      return true;
+    c.p += strlen(match->text);
+    if (!parse_expr(c, match->precedence + 1) || !emit_op(c, match->op, -1))
+      return false;
+  }
+}
+
+/* Compile text into code */
+bool expr_compile(const char *text, uint8_t *code, size_t max, size_t *len, tag_mask_t *inputs,
+                  const char **error) {
+  compiler_t c = {text, code, 0, max, 0, 0, NULL};
+  if (parse_expr(c, 0)) {
+    skip_space(c);
+    if (*c.p != '\0')
+      c.error = "unexpected text";
+  }
+  *len = c.len;
+  *inputs = c.inputs;
+  *error = c.error;
+  return c.error == NULL;
+}
+
+/* Quality of a result given the quality of one more input: bad beats stale beats good */
+static uint8_t worse(uint8_t a, uint8_t b) {
+  if (a == TAG_QUALITY_BAD || b == TAG_QUALITY_BAD)
+    return TAG_QUALITY_BAD;
+  return a == TAG_QUALITY_STALE || b == TAG_QUALITY_STALE ? TAG_QUALITY_STALE : TAG_QUALITY_GOOD;
+}
+
+/* Run compiled code against the tag cache */
+bool expr_eval(const uint8_t *code, size_t len, int32_t *value, uint8_t *quality) {
+  int32_t stack[EXPR_STACK];
+  int sp = 0;  // Depth checked by the compiler
+  uint8_t q = TAG_QUALITY_GOOD;
+
+  for (size_t pc = 0; pc < len;) {
+    uint8_t op = code[pc++];
+    if (op == OP_CONST) {
+      memcpy(&stack[sp++], code + pc, sizeof(int32_t));
+      pc += sizeof(int32_t);
+      continue;
+    }
+    if (op == OP_TAG) {
+      tag_value_t v;
+      tag_read(code[pc++], &v);
+      if (v.quality == TAG_QUALITY_NONE)
+        return false;
+      q = worse(q, v.quality);
+      stack[sp++] = v.value;
+      continue;
+    }
+    if (op <= OP_ABS) {
+      int32_t &a = stack[sp - 1];
+      uint32_t ua = a;
+      switch (op) {
+        case OP_NEG: a = (int32_t)(0u - ua); break;
+        case OP_NOT: a = !a; break;
+        case OP_BNOT: a = ~a; break;
+        case OP_ABS: a = a < 0 ? (int32_t)(0u - ua) : a; break;
+      }
+      continue;
+    }
+
+    int32_t b = stack[--sp];
+    int32_t &a = stack[sp - 1];
+    uint32_t ua = a, ub = b;
+    switch (op) {
+      case OP_MUL: a = (int32_t)(ua * ub); break;
+      case OP_DIV:
+      case OP_MOD:
+        if (b == 0 || (a == INT32_MIN && b == -1)) {
+          *quality = TAG_QUALITY_BAD;
+          *value = 0;
+          return true;
+        }
+        a = op == OP_DIV ? a / b : a % b;
+        break;
+      case OP_ADD: a = (int32_t)(ua + ub); break;
+      case OP_SUB: a = (int32_t)(ua - ub); break;
+      case OP_SHL: a = (int32_t)(ua << (ub & 31)); break;
+      case OP_SHR: a = a >> (ub & 31); break;
+      case OP_LT: a = a < b; break;
+      case OP_LE: a = a <= b; break;
+      case OP_GT: a = a > b; break;
+      case OP_GE: a = a >= b; break;
+      case OP_EQ: a = a == b; break;
+      case OP_NE: a = a != b; break;
+      case OP_AND: a &= b; break;
+      case OP_XOR: a ^= b; break;
+      case OP_OR: a |= b; break;
+      case OP_LAND: a = a && b; break;
+      case OP_LOR: a = a || b; break;
+      case OP_MIN: a = min(a, b); break;
+      case OP_MAX: a = max(a, b); break;
+    }
+  }
+  *value = stack[0];
+  *quality = q;
+  return true;
+}
@@ -0,0 +1,69 @@
+/*
+ * Description:
+ * Heap fragmentation monitoring. See heapstat.h.
+ */
+
+#include "heapstat.h"
+#include "console.h"
+#include "datalog.h"
+#include <lvgl.h>
+
+#if PANEL_STATIC_HEAP && LV_MEM_CUSTOM
+#error "PANEL_STATIC_HEAP needs LVGL's own arena: set LV_MEM_CUSTOM 0 in lv_conf.h"
+#endif
+
+static uint32_t boot_free = 0;       // Free system heap when setup() finished
+static volatile uint32_t failed_allocs = 0; // Allocations the system heap refused
+
+/* Fragmentation in 0.1 %: the share of free memory outside the largest free block */
+uint32_t heapstat_frag(uint32_t free_bytes, uint32_t largest) {
+  if (free_bytes == 0)
+    return 0;
+  return 1000 - (uint32_t)((uint64_t)largest * 1000 / free_bytes);
+}
+
+/* Count refused allocations; runs in the failing task, so it only counts */
+static void alloc_failed(size_t size, uint32_t caps, const char *function) {
+  failed_allocs++;
+}
+
+/* Log the system heap figures */
+static void log_sample(lv_timer_t *t) {
+  uint32_t free_bytes = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+  uint32_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+  datalog_append(HEAPSTAT_TAG_FREE, free_bytes);
+  datalog_append(HEAPSTAT_TAG_LARGEST, largest);
+  datalog_append(HEAPSTAT_TAG_FRAG, heapstat_frag(free_bytes, largest));
+}
+
+/* Console: system heap and LVGL arena figures */
+static void heap_command(int argc, char **argv) {
+  uint32_t free_bytes = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+  uint32_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+  uint32_t frag = heapstat_frag(free_bytes, largest);
+  Serial.printf("heap  free %u, largest block %u, fragmentation %u.%u%%\n", free_bytes, largest, frag / 10,
+                frag % 10);
+  Serial.printf("      lowest %u, %+d since boot, %u failed allocations\n",
+                (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT), (int)(free_bytes - boot_free),
+                failed_allocs);
+#if LV_MEM_CUSTOM == 0
+  lv_mem_monitor_t mon;
+  lv_mem_monitor(&mon);
+  Serial.printf("lvgl  free %u of %u, largest block %u, fragmentation %u%%, peak use %u\n", (unsigned)mon.free_size,
+                (unsigned)mon.total_size, (unsigned)mon.free_biggest_size, mon.frag_pct, (unsigned)mon.max_used);
+#else
+  Serial.println("lvgl  allocates from the system heap (LV_MEM_CUSTOM)");
+#endif
+#if PANEL_STATIC_HEAP
+  if (free_bytes < boot_free)
+    Serial.printf("static mode: %u bytes allocated after boot\n", boot_free - free_bytes);
+#endif
+}
+
+/* Record the baseline and start logging; call at the end of setup() */
+void heapstat_begin() {
+  heap_caps_register_failed_alloc_callback(alloc_failed);
+  lv_timer_create(log_sample, HEAPSTAT_LOG_S * 1000u, NULL);
+  console_register("heap", "Heap and LVGL arena use and fragmentation", heap_command);
+  boot_free = heap_caps_get_free_size(MALLOC_CAP_8BIT);  // Last, after our own allocations
+}
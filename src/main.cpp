@@ -13,30 +13,43 @@
  * - ModbusMaster: For handling Modbus RS485 communication.
  * - TFT_eSPI: For controlling the TFT display.
  * - LVGL: For creating GUI elements like buttons and labels.
- * - SPIFFS: For file system handling, used for touch calibration.
+ * - SPIFFS or LittleFS: For file system handling, used for touch calibration and logging.
  * - SPI: For SPI communication with the display.
  */
 
 #include <Arduino.h>    // Base library for ESP32 development
-#include <FS.h>         // File system library for handling SPIFFS
+#include <FS.h>         // File system library for calibration and log files
 #include <SPI.h>        // SPI library for communication with the display
 #include <lvgl.h>       // LVGL library for GUI elements
 #include <TFT_eSPI.h>   // Library for controlling the TFT display
-#include <ModbusMaster.h>  // ModbusMaster library for handling Modbus RS485 communication
+#include "browser.h"       // Register browser for commissioning
+#include "bus.h"           // Modbus bus task that polls the tag table
+#include "config.h"        // Versioned panel configuration in NVS
+#include "console.h"       // Serial command console
+#include "datalog.h"       // Flash data logger with tiered retention
+#include "heapstat.h"      // Heap fragmentation and the static allocation mode
+#include "perf.h"          // FPS, CPU, bus and heap overlay
+#include "recipe.h"        // Recipe storage and download
+#include "rules.h"         // Local interlock rules
+#include "snapshot.h"      // Warm-start snapshot of the tag cache
+#include "storage.h"       // SPIFFS or LittleFS backend, chosen at build time
+#include "tagmap.h"        // Register map file and hot reload
+#include "tags.h"          // Tag table and register cache
+#include "touch.h"         // Three-point affine touch calibration
+#include "ui_dispatch.h"   // Batched tag updates from the bus task to LVGL
+#include "ui_styles.h"     // Shared style sheet and panel theme
+#include "vtags.h"         // Virtual tags computed from polled ones
 
 #define TOUCH_CS 21        // Chip select pin for the touch interface
 #define BUTTON_PIN_1 25    // GPIO pin 25 for Button 1
 #define BUZZER_PIN 13      // GPIO pin 13 for the buzzer
 
-#define RXD_PIN 26         // RS-485 receive pin connected to ESP32
-#define TXD_PIN 12         // RS-485 transmit pin connected to ESP32
-
-#define CALIBRATION_FILE "/TouchCalData3"   // File to store touch calibration data
 #define REPEAT_CAL true    // If true, forces a touch calibration each time
+#define TOUCH_Z_THRESHOLD 600 // Touch pressure that counts as a press, as in TFT_eSPI getTouch()
+#define TOUCH_CAL_SAMPLES 8   // Raw readings averaged per calibration target
 #define LVGL_REFRESH_TIME 5u // Refresh rate for the LVGL library in milliseconds
 
 TFT_eSPI tft = TFT_eSPI();   // Initialize TFT display object
-ModbusMaster node;           // Create a ModbusMaster object for handling Modbus communication
 
 /* Screen resolution */
 static const uint32_t screenWidth = 320;   // Define screen width (in pixels)
@@ -44,74 +57,99 @@ static const uint32_t screenHeight = 240;  // Define screen height (in pixels)
 
 static lv_disp_draw_buf_t draw_buf;        // Buffer for LVGL drawing
 static lv_color_t buf[screenWidth * 10];   // Buffer size (number of pixels in width * 10)
-
-/* GUI styles */
-static lv_style_t style_default, style_pressed;
+static lv_disp_drv_t disp_drv;             // Display driver; its resolution follows the rotation
 
 lv_obj_t *label;           // Label to display received Modbus data
 lv_obj_t *keyboard = NULL; // Object for the on-screen keyboard
 lv_obj_t *textarea = NULL; // Text area for keyboard input
-
-String receivedData = "No data received yet."; // String to store Modbus received data
-
-/* Touch calibration function */
-void touch_calibrate() {
-  uint16_t calData[5];   // Array to store calibration data
-  uint8_t calDataOK = 0; // Flag to check if calibration data exists
-
-  // Initialize SPIFFS and check if calibration data exists
-  if (!SPIFFS.begin()) {
-    Serial.println("Formatting file system");
-    SPIFFS.format();
-    SPIFFS.begin();
-  }
-
-  // If calibration data exists and repeat calibration is false, load calibration data
-  if (SPIFFS.exists(CALIBRATION_FILE)) {
-    if (!REPEAT_CAL) {
-      File f = SPIFFS.open(CALIBRATION_FILE, "r");
-      if (f) {
-        if (f.readBytes((char *)calData, 14) == 14)
-          calDataOK = 1;
-        f.close();
-      }
+lv_obj_t *bus_status;      // Bus degradation level, shown while the bus is overloaded
+lv_obj_t *recipe_bar;      // Recipe download progress, shown while a job runs
+lv_obj_t *recipe_status;   // Recipe name and phase above the bar
+
+/* Average raw readings of one press, then wait for the release */
+static void read_calibration_touch(uint16_t *raw_x, uint16_t *raw_y) {
+  uint32_t sum_x = 0, sum_y = 0;
+  uint8_t samples = 0;
+  while (samples < TOUCH_CAL_SAMPLES) {
+    uint16_t x, y;
+    if (tft.getTouchRawZ() > TOUCH_Z_THRESHOLD && tft.getTouchRaw(&x, &y)) {
+      sum_x += x;
+      sum_y += y;
+      samples++;
     }
+    delay(10);
   }
+  *raw_x = sum_x / TOUCH_CAL_SAMPLES;
+  *raw_y = sum_y / TOUCH_CAL_SAMPLES;
+  while (tft.getTouchRawZ() > TOUCH_Z_THRESHOLD / 2)
+    delay(10);
+  delay(200);  // Let the panel settle before the next target
+}
 
-  // If calibration data is valid, use it; otherwise, calibrate touch and save the data
-  if (calDataOK && !REPEAT_CAL) {
-    tft.setTouch(calData);
-  } else {
+/* Touch three targets and store the result; repeats until the points are usable */
+static void run_calibration(touch_cal_t *cal) {
+  tft.setRotation(0);  // Targets are in native panel coordinates
+  touch_targets(cal, tft.width(), tft.height());
+  do {
     tft.fillScreen(TFT_BLACK);     // Clear the screen
     tft.setCursor(20, 0);          // Set cursor position
     tft.setTextFont(2);            // Set text font size
     tft.setTextSize(1);            // Set text size
     tft.setTextColor(TFT_WHITE, TFT_BLACK); // Set text color
+    tft.println("Touch the crosses as indicated");
+
+    for (uint8_t i = 0; i < TOUCH_CAL_POINTS; i++) {
+      tft.drawFastHLine(cal->x[i] - 10, cal->y[i], 21, TFT_MAGENTA);
+      tft.drawFastVLine(cal->x[i], cal->y[i] - 10, 21, TFT_MAGENTA);
+      read_calibration_touch(&cal->raw_x[i], &cal->raw_y[i]);
+      tft.drawFastHLine(cal->x[i] - 10, cal->y[i], 21, TFT_BLACK);
+      tft.drawFastVLine(cal->x[i], cal->y[i] - 10, 21, TFT_BLACK);
+    }
+  } while (!touch_set_calibration(cal));
+  if (!touch_save(cal))
+    Serial.println("Touch calibration not saved");
+}
+
+/* Touch calibration function */
+void touch_calibrate() {
+  touch_cal_t cal;
+  if (REPEAT_CAL || !touch_load(&cal) || !touch_set_calibration(&cal))
+    run_calibration(&cal);
+}
 
-    tft.println("Touch corners as indicated");  // Display instructions for touch calibration
+/* Display and touch at a rotation; LVGL redraws at the new resolution */
+static void apply_rotation(uint8_t rotation) {
+  tft.setRotation(rotation);
+  disp_drv.hor_res = rotation & 1 ? screenWidth : screenHeight;  // Odd rotations are landscape
+  disp_drv.ver_res = rotation & 1 ? screenHeight : screenWidth;
+  lv_disp_t *disp = lv_disp_get_default();
+  if (disp != NULL)
+    lv_disp_drv_update(disp, &disp_drv);
+  touch_set_rotation(rotation, disp_drv.hor_res, disp_drv.ver_res);
+}
 
-    // Calibrate touch and save the data to file
-    tft.calibrateTouch(calData, TFT_MAGENTA, TFT_BLACK, 15);
-    File f = SPIFFS.open(CALIBRATION_FILE, "w");
-    if (f) {
-      f.write((const unsigned char *)calData, 14);
-      f.close();
-    }
-  }
+/* Rotate at once when "cfg rotation" changes; the touch calibration stays valid */
+static void config_changed(const panel_config_t *old_cfg, const panel_config_t *new_cfg) {
+  if (new_cfg->rotation != old_cfg->rotation)
+    apply_rotation(new_cfg->rotation);
 }
 
 /* Function to read touch inputs and pass to LVGL */
 void lvgl_port_tp_read(lv_indev_drv_t *indev, lv_indev_data_t *data) {
-  uint16_t touchX, touchY;         // Variables to hold touch coordinates
-  bool touched = tft.getTouch(&touchX, &touchY); // Get touch status and coordinates
+  uint16_t raw_x, raw_y;           // Raw touch controller readings
+  int16_t x, y;                    // Screen pixel at the current rotation
+  int64_t sample_us = esp_timer_get_time(); // Start of touch-to-photon latency
+  bool touched = tft.getTouchRawZ() > TOUCH_Z_THRESHOLD && tft.getTouchRaw(&raw_x, &raw_y) &&
+                 touch_map(raw_x, raw_y, &x, &y); // Two multiply-adds per axis
+  touch_sample(touched, sample_us);
 
   // If touched, update LVGL with coordinates, otherwise mark as released
   if (!touched) {
     data->state = LV_INDEV_STATE_REL;
   } else {
     data->state = LV_INDEV_STATE_PR;
-    data->point.x = touchX;
-    data->point.y = touchY;
+    data->point.x = x;
+    data->point.y = y;
   }
 }
 
@@ -124,60 +162,169 @@ void my_disp_flush(lv_disp_drv_t *disp, const lv_area_t *area, lv_color_t *color
   tft.setAddrWindow(area->x1, area->y1, w, h); // Set the address window for the drawing area
   tft.pushColors((uint16_t *)&color_p->full, w * h, true); // Push pixel data to the display
   tft.endWrite();                         // End writing
+  touch_flushed(area, esp_timer_get_time()); // The pixels are on the panel now
 
   lv_disp_flush_ready(disp);              // Notify LVGL that flushing is complete
 }
 
 /* Send data via Modbus */
 void sendModbusData(const char *data) {
-  node.writeSingleRegister(0x40001, atoi(data)); // Send the data to Modbus register 40001
+  const panel_config_t cfg = config_get();
+  bus_write(cfg.slave_id, cfg.setpoint_reg, atoi(data)); // Queue the write for the bus task
 }
 
+/* Show the polled PLC value on the label; called from ui_dispatch_drain() */
+static void show_plc_data(uint16_t id, const tag_value_t *v) {
+  if (v->quality == TAG_QUALITY_GOOD)
+    lv_label_set_text_fmt(label, "PLC Data: %d", (int)v->value);
+  else if (v->quality == TAG_QUALITY_STALE) // Last-known value from before the reboot
+    lv_label_set_text_fmt(label, "PLC Data: %d (stale)", (int)v->value);
+  else
+    lv_label_set_text(label, "Error reading data");
+}
+
+static void hide_keyboard();
+
 /* Event handler for keyboard input */
 static void kb_event_handler(lv_event_t *e) {
   lv_event_code_t code = lv_event_get_code(e); // Get the event code
-  lv_obj_t *kb = lv_event_get_target(e);       // Get the target object (keyboard)
 
   // If the event is "ready" or "cancel", send data via Modbus
   if (code == LV_EVENT_READY || code == LV_EVENT_CANCEL) {
     const char *text = lv_textarea_get_text(textarea); // Get the text from the textarea
 
     sendModbusData(text);          // Send the text via Modbus
-    Serial.println("Sent to Modbus: " + String(text)); // Debug output
+    Serial.printf("Sent to Modbus: %s\n", text); // Debug output, no String on the heap
 
-    // Remove the textarea and keyboard from the screen
-    lv_obj_del(textarea);
-    textarea = NULL;
-    lv_obj_del(kb);
-    keyboard = NULL;
+    hide_keyboard();               // Take the textarea and keyboard off the screen
   }
 }
 
+/* Create the textarea and keyboard, hidden; they are kept and only shown and hidden, so
+   typing a setpoint does not churn the LVGL heap */
+static void create_keyboard() {
+  textarea = lv_textarea_create(lv_scr_act());   // Create textarea
+  lv_obj_align(textarea, LV_ALIGN_TOP_MID, 0, 60); // Position it on the screen
+  lv_textarea_set_one_line(textarea, true);     // Make it single-line input
+  lv_obj_add_flag(textarea, LV_OBJ_FLAG_HIDDEN);
+
+  keyboard = lv_keyboard_create(lv_scr_act());  // Create keyboard
+  lv_keyboard_set_textarea(keyboard, textarea); // Attach keyboard to textarea
+  lv_obj_set_size(keyboard, LV_PCT(100), LV_PCT(50)); // Bottom half of the screen at any rotation
+  lv_keyboard_set_mode(keyboard, LV_KEYBOARD_MODE_TEXT_LOWER); // Lowercase input mode
+  lv_obj_add_event_cb(keyboard, kb_event_handler, LV_EVENT_ALL, NULL); // Attach event handler
+  lv_obj_add_flag(keyboard, LV_OBJ_FLAG_HIDDEN);
+}
+
+/* True while the keyboard is on screen */
+static bool keyboard_shown() {
+  return keyboard != NULL && !lv_obj_has_flag(keyboard, LV_OBJ_FLAG_HIDDEN);
+}
+
+/* Show the textarea and keyboard with an empty entry */
+static void show_keyboard() {
+  if (keyboard == NULL)
+    create_keyboard();
+  if (keyboard_shown())
+    return;
+
+  lv_textarea_set_text(textarea, "");
+  lv_obj_clear_flag(textarea, LV_OBJ_FLAG_HIDDEN);
+  lv_obj_clear_flag(keyboard, LV_OBJ_FLAG_HIDDEN);
+  lv_obj_move_foreground(textarea);
+  lv_obj_move_foreground(keyboard);
+}
+
+/* Take the textarea and keyboard off the screen */
+static void hide_keyboard() {
+  if (!keyboard_shown())
+    return;
+
+  lv_obj_add_flag(textarea, LV_OBJ_FLAG_HIDDEN);
+  lv_obj_add_flag(keyboard, LV_OBJ_FLAG_HIDDEN);
+}
+
 /* Event handler for Button 2 (shows the keyboard) */
 static void event_handler_btn2(lv_event_t *e) {
   lv_event_code_t code = lv_event_get_code(e); // Get event code
 
-  if (code == LV_EVENT_CLICKED) {  // If button is clicked, show the keyboard
-    if (keyboard == NULL) {
-      textarea = lv_textarea_create(lv_scr_act());   // Create textarea
-      lv_obj_align(textarea, LV_ALIGN_TOP_MID, 0, 60); // Position it on the screen
-      lv_textarea_set_one_line(textarea, true);     // Make it single-line input
-
-      keyboard = lv_keyboard_create(lv_scr_act());  // Create keyboard
-      lv_keyboard_set_textarea(keyboard, textarea); // Attach keyboard to textarea
-      lv_obj_set_size(keyboard, screenWidth, screenHeight / 2); // Set size of the keyboard
-      lv_keyboard_set_mode(keyboard, LV_KEYBOARD_MODE_TEXT_LOWER); // Lowercase input mode
-      lv_obj_add_event_cb(keyboard, kb_event_handler, LV_EVENT_ALL, NULL); // Attach event handler
-    }
+  if (code == LV_EVENT_CLICKED)    // If button is clicked, show the keyboard
+    show_keyboard();
+}
+
+/* Event handler for Button 3 (opens the register browser) */
+static void event_handler_btn3(lv_event_t *e) {
+  lv_event_code_t code = lv_event_get_code(e); // Get event code
+
+  if (code == LV_EVENT_CLICKED)    // Browse the holding registers of the configured slave
+    browser_open(config_get().slave_id, 3, 0);
+}
+
+/* Show the bus degradation level; hidden while every class polls at its nominal rate */
+static void show_bus_status(lv_timer_t *t) {
+  static uint8_t shown_level = 0;
+  uint8_t level = bus_shed_level();
+  if (level == shown_level)
+    return;  // Only redraw on a change
+  shown_level = level;
+
+  if (level == 0) {
+    lv_obj_add_flag(bus_status, LV_OBJ_FLAG_HIDDEN);
+  } else {
+    lv_label_set_text_fmt(bus_status, "Bus overload: level %u/%u", level, BUS_SHED_LEVELS - 1);
+    lv_obj_clear_flag(bus_status, LV_OBJ_FLAG_HIDDEN);
+  }
+}
+
+/* Show recipe download progress; the result stays up for RECIPE_SHOW_MS after the job */
+static void show_recipe(lv_timer_t *t) {
+  static const uint32_t RECIPE_SHOW_MS = 5000;
+  static const char *phases[] = {"", "Writing", "Verifying", "Reading", "Done", "Failed"};
+  recipe_progress_t p;
+  recipe_get_progress(&p);
+  bool running = p.state == RECIPE_WRITING || p.state == RECIPE_VERIFYING || p.state == RECIPE_CAPTURING;
+  static uint32_t finished_ms = 0;
+  if (running)
+    finished_ms = 0;
+  else if (finished_ms == 0 && p.state != RECIPE_IDLE)
+    finished_ms = millis();
+
+  if (p.state == RECIPE_IDLE || (!running && millis() - finished_ms > RECIPE_SHOW_MS)) {
+    lv_obj_add_flag(recipe_bar, LV_OBJ_FLAG_HIDDEN);
+    lv_obj_add_flag(recipe_status, LV_OBJ_FLAG_HIDDEN);
+    return;
   }
+  lv_bar_set_range(recipe_bar, 0, p.total);
+  lv_bar_set_value(recipe_bar, p.state == RECIPE_DONE ? p.total : p.done, LV_ANIM_OFF);
+  if (p.state == RECIPE_FAILED)
+    lv_label_set_text_fmt(recipe_status, "%s: %s", p.name, p.error);
+  else
+    lv_label_set_text_fmt(recipe_status, "%s: %s %u/%u", p.name, phases[p.state], p.done, p.total);
+  lv_obj_clear_flag(recipe_bar, LV_OBJ_FLAG_HIDDEN);
+  lv_obj_clear_flag(recipe_status, LV_OBJ_FLAG_HIDDEN);
 }
 
 /* Create buttons for the screen */
 void lv_example_buttons(void) {
   label = lv_label_create(lv_scr_act());          // Create label to show received data
-  lv_label_set_text(label, receivedData.c_str()); // Initialize label text
+  lv_label_set_text(label, "No data received yet."); // Shown until the first poll completes
   lv_obj_align(label, LV_ALIGN_BOTTOM_MID, 0, -10); // Position label
 
+  bus_status = lv_label_create(lv_scr_act());     // Degradation level, see show_bus_status()
+  lv_obj_set_style_text_color(bus_status, lv_palette_main(LV_PALETTE_RED), 0);
+  lv_obj_align(bus_status, LV_ALIGN_TOP_LEFT, 5, 5); // Top left, clear of the perf overlay
+  lv_obj_add_flag(bus_status, LV_OBJ_FLAG_HIDDEN);
+  lv_timer_create(show_bus_status, 1000, NULL);   // Check the level once a second
+
+  recipe_bar = lv_bar_create(lv_scr_act());       // Recipe progress, see show_recipe()
+  lv_obj_set_size(recipe_bar, 200, 10);
+  lv_obj_align(recipe_bar, LV_ALIGN_TOP_MID, 0, 45);
+  lv_obj_add_flag(recipe_bar, LV_OBJ_FLAG_HIDDEN);
+  recipe_status = lv_label_create(lv_scr_act());
+  lv_obj_align_to(recipe_status, recipe_bar, LV_ALIGN_OUT_TOP_MID, 0, -4);
+  lv_obj_add_flag(recipe_status, LV_OBJ_FLAG_HIDDEN);
+  lv_timer_create(show_recipe, 100, NULL);        // Fast enough to follow single chunks
+
   const int button_width = 120;   // Button width in pixels
   const int button_height = 60;   // Button height in pixels
 
@@ -188,42 +335,103 @@ void lv_example_buttons(void) {
 
   lv_obj_t *btn2_label = lv_label_create(btn2);  // Add label to Button 2
   lv_label_set_text(btn2_label, "Option 2");     // Set label text
+
+  lv_obj_t *btn3 = lv_btn_create(lv_scr_act());   // Create Button 3
+  lv_obj_set_size(btn3, button_width, button_height); // Set button size
+  lv_obj_add_event_cb(btn3, event_handler_btn3, LV_EVENT_ALL, NULL); // Add event handler
+  lv_obj_align(btn3, LV_ALIGN_CENTER, 0, 30);  // Below Button 2
+
+  lv_obj_t *btn3_label = lv_label_create(btn3);  // Add label to Button 3
+  lv_label_set_text(btn3_label, "Registers");    // Set label text
+}
+
+/* Average time of a full-screen redraw in microseconds */
+static uint32_t time_full_redraw(uint8_t frames) {
+  uint32_t start = micros();
+  for (uint8_t i = 0; i < frames; i++) {
+    lv_obj_invalidate(lv_scr_act()); // Force every pixel to be rendered and flushed
+    lv_refr_now(NULL);
+  }
+  return (micros() - start) / frames;
+}
+
+/* Console: time full redraws of the button screen and the keyboard screen */
+static void ui_command(int argc, char **argv) {
+  bool had_keyboard = keyboard_shown();
+  hide_keyboard();
+  uint32_t buttons_us = time_full_redraw(10);
+  show_keyboard();
+  uint32_t keyboard_us = time_full_redraw(10);
+  if (!had_keyboard)
+    hide_keyboard();
+
+  Serial.printf("%s profile: buttons %u us, keyboard %u us per full redraw\n",
+                UI_RENDER_LITE ? "lite" : "full", buttons_us, keyboard_us);
 }
 
 /* Setup function */
 void setup() {
   Serial.begin(115200);           // Initialize serial communication at 115200 baud
-  node.begin(1, Serial2);         // Begin Modbus communication on Serial2 with slave ID 1
-  Serial2.begin(9600, SERIAL_8N1, RXD_PIN, TXD_PIN); // Set up RS485 serial communication
+  config_begin();                 // Load pins, baud rate and addresses from NVS
 
   tft.begin();                    // Initialize the TFT display
-  tft.setRotation(1);             // Set display rotation
   lv_init();                      // Initialize the LVGL library
 
   lv_disp_draw_buf_init(&draw_buf, buf, NULL, screenWidth * 10); // Initialize the drawing buffer
 
   // Initialize the display driver for LVGL
-  static lv_disp_drv_t disp_drv;
   lv_disp_drv_init(&disp_drv);
-  disp_drv.hor_res = screenWidth;
-  disp_drv.ver_res = screenHeight;
+  apply_rotation(config_get().rotation); // Display rotation and the matching resolution
   disp_drv.flush_cb = my_disp_flush;
   disp_drv.draw_buf = &draw_buf;
-  lv_disp_drv_register(&disp_drv);
+  disp_drv.antialiasing = !UI_RENDER_LITE; // The lite render profile skips anti-aliasing
+  disp_drv.monitor_cb = perf_monitor_cb;   // Count frames for the performance overlay
+  lv_disp_t *disp = lv_disp_drv_register(&disp_drv);
+  ui_styles_init(disp);           // Shared styles and panel theme for every widget
 
   // Initialize the touch input driver for LVGL
   static lv_indev_drv_t indev_drv;
   lv_indev_drv_init(&indev_drv);
   indev_drv.type = LV_INDEV_TYPE_POINTER;
   indev_drv.read_cb = lvgl_port_tp_read;
+  indev_drv.feedback_cb = touch_feedback_cb; // Object a press landed on, for touch latency
   lv_indev_drv_register(&indev_drv);
 
+  if (!storage_begin()) // Mount the file system for calibration and logging
+    Serial.println("File system unavailable");
   touch_calibrate();    // Calibrate the touch screen
+  apply_rotation(config_get().rotation); // Calibration runs at rotation 0; map touches at the configured one
+  config_add_listener(config_changed);    // "cfg rotation" rotates at runtime
+  touch_begin();        // "touch" console command
+  if (!datalog_begin()) // Start the data logger once the file system is mounted
+    Serial.println("Data logger failed to start");
+  if (!tagmap_begin())   // Polled tags from the map, before anything refers to them by name
+    Serial.println("Register map has errors, using the built-in tags");
+  if (!vtags_begin())    // Add the virtual tags before their snapshot values are restored
+    Serial.println("Virtual tag definitions have errors");
+  if (!rules_begin())    // Rules may read virtual tags
+    Serial.println("Rule definitions have errors");
+  if (!snapshot_begin()) // Last-known values, shown as stale until the first polls
+    Serial.println("Cache snapshot task failed to start");
   lv_example_buttons(); // Create on-screen buttons
+  perf_begin();         // Performance overlay, hidden until "perf on"
+
+  ui_dispatch_bind(TAG_PLC_DATA, show_plc_data); // Label follows the polled PLC value
+  recipe_begin();       // "recipe" console command
+  console_register("ui", "Time full redraws of the button and keyboard screens", ui_command);
+  if (!bus_begin())     // Start polling once the screen can show the results
+    Serial.println("Modbus bus task failed to start");
+#if PANEL_STATIC_HEAP
+  create_keyboard();    // Every screen exists before the heap baseline is taken
+  browser_begin();
+#endif
+  heapstat_begin();     // Last: the heap baseline for leak reports
 }
 
 /* Main loop */
 void loop() {
+  ui_dispatch_drain();  // Apply tag updates from the bus task in one pass
   lv_timer_handler();   // Call LVGL handler to update GUI
+  console_poll();       // Run any command typed on the Serial console
   delay(LVGL_REFRESH_TIME); // Add delay to control GUI refresh rate
 }
@@ -0,0 +1,82 @@
+/*
+ * Description:
+ * Raw Modbus RTU frames. See modbus_rtu.h.
+ */
+
+#include "modbus_rtu.h"
+#include "crc16.h"
+
+/* Frame = slave, function, payload, CRC (low byte first) */
+size_t rtu_frame(uint8_t *frame, uint8_t slave, uint8_t function, const uint8_t *payload, size_t len) {
+  frame[0] = slave;
+  frame[1] = function;
+  memcpy(frame + 2, payload, len);
+  uint16_t crc = crc16(frame, len + 2);
+  frame[len + 2] = crc & 0xFF;
+  frame[len + 3] = crc >> 8;
+  return len + 4;
+}
+
+/* Register write request: FC06 for one register, FC16 for up to MODBUS_RTU_MAX_WRITE */
+size_t rtu_write_frame(uint8_t *frame, uint8_t slave, uint16_t address, const uint16_t *values,
+                       uint8_t count) {
+  uint8_t payload[5 + 2 * MODBUS_RTU_MAX_WRITE];
+  payload[0] = address >> 8;
+  payload[1] = address & 0xFF;
+  if (count == 1) {
+    payload[2] = values[0] >> 8;
+    payload[3] = values[0] & 0xFF;
+    return rtu_frame(frame, slave, 0x06, payload, 4);
+  }
+
+  count = min(count, (uint8_t)MODBUS_RTU_MAX_WRITE);
+  payload[2] = 0;
+  payload[3] = count;
+  payload[4] = 2 * count;  // Byte count
+  for (uint8_t i = 0; i < count; i++) {
+    payload[5 + 2 * i] = values[i] >> 8;
+    payload[6 + 2 * i] = values[i] & 0xFF;
+  }
+  return rtu_frame(frame, slave, 0x10, payload, 5 + 2 * count);
+}
+
+/* Keep the line silent for gap_us so the frame start is recognised, then send the
+   frame and wait until its last bit has left the UART */
+void rtu_send(HardwareSerial &port, const uint8_t *frame, size_t len, uint32_t gap_us) {
+  while (port.available())
+    port.read();  // Drop the tail of an earlier reply that timed out
+  delayMicroseconds(gap_us);
+  port.write(frame, len);
+  port.flush();
+}
+
+/* Read one frame: wait up to timeout_ms for its first byte, then take bytes until the
+   line has been silent for gap_us. Returns the length, 0 if nothing arrived */
+size_t rtu_receive(HardwareSerial &port, uint8_t *frame, size_t max, uint32_t timeout_ms, uint32_t gap_us) {
+  uint32_t start_ms = millis();
+  while (!port.available()) {
+    if (millis() - start_ms >= timeout_ms)
+      return 0;
+    vTaskDelay(1);
+  }
+
+  size_t len = 0;
+  uint32_t last_us = micros();
+  while (micros() - last_us < gap_us) {
+    if (port.available()) {
+      int c = port.read();
+      if (len < max)
+        frame[len++] = c;  // Excess bytes are dropped; the CRC check fails
+      last_us = micros();
+    }
+  }
+  return len;
+}
+
+/* True if the frame is long enough and its CRC matches */
+bool rtu_valid(const uint8_t *frame, size_t len) {
+  if (len < 4)
+    return false;
+  uint16_t crc = crc16(frame, len - 2);
+  return frame[len - 2] == (crc & 0xFF) && frame[len - 1] == (crc >> 8);
+}
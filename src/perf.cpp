@@ -0,0 +1,122 @@
+/*
+ * Description:
+ * Performance overlay. See perf.h.
+ *
+ * CPU load comes from idle hooks: while a core is idle its idle task calls the hook in a
+ * tight loop, so the time between consecutive calls is idle time as long as the gap is
+ * short. A long gap means other tasks ran in between. The hooks return false to keep the
+ * idle loop spinning instead of waiting for an interrupt; that only costs idle power.
+ */
+
+#include "perf.h"
+#include "bus.h"
+#include "bus_load.h"
+#include "console.h"
+#include <esp_freertos_hooks.h>
+
+#define PERF_CORES 2
+
+static volatile uint32_t idle_us[PERF_CORES];   // Idle time per core, wraps
+static uint32_t last_hook_us[PERF_CORES];       // Previous idle hook call per core
+static volatile uint32_t frames = 0;            // Refreshes reported by LVGL
+
+static lv_obj_t *overlay = NULL;
+static lv_timer_t *timer = NULL;
+static char text[96];                           // Overlay text, shown without copying
+
+/* Accumulate idle time on one core */
+static inline void idle_tick(uint8_t core) {
+  uint32_t now = (uint32_t)esp_timer_get_time();
+  uint32_t gap = now - last_hook_us[core];
+  last_hook_us[core] = now;
+  if (gap < PERF_IDLE_GAP_US)
+    idle_us[core] += gap;
+}
+
+static bool idle_hook_core0() {
+  idle_tick(0);
+  return false;  // Keep spinning so idle time stays measurable
+}
+
+static bool idle_hook_core1() {
+  idle_tick(1);
+  return false;
+}
+
+/* Display driver monitor hook: called once per completed refresh */
+void perf_monitor_cb(lv_disp_drv_t *drv, uint32_t time_ms, uint32_t px) {
+  frames++;
+}
+
+/* Recompute the figures and redraw the overlay */
+static void update(lv_timer_t *t) {
+  static uint32_t last_ms, last_frames, last_idle[PERF_CORES], last_busy_us;
+  static bus_stats_t last_bus;
+
+  uint32_t now = millis();
+  uint32_t elapsed_ms = now - last_ms;
+  if (elapsed_ms == 0)
+    return;
+
+  uint32_t load[PERF_CORES];
+  for (uint8_t core = 0; core < PERF_CORES; core++) {
+    uint32_t idle = idle_us[core];
+    uint32_t idle_ms = (idle - last_idle[core]) / 1000;
+    load[core] = idle_ms >= elapsed_ms ? 0 : 100 - idle_ms * 100 / elapsed_ms;
+    last_idle[core] = idle;
+  }
+
+  bus_stats_t bus;
+  bus_get_stats(&bus);
+  uint32_t busy_us = bus_load_busy_us();  // Wire time, from frame sizes and baud rate
+  uint32_t busy_ms = (busy_us - last_busy_us) / 1000;
+  uint32_t tx = bus.transactions - last_bus.transactions;
+  uint32_t fps = (frames - last_frames) * 1000 / elapsed_ms;
+
+  snprintf(text, sizeof(text), "FPS %u\nCPU %u%% %u%%\nBus %u%% %u/s\nHeap %uk", fps, load[0], load[1],
+           min(busy_ms * 100 / elapsed_ms, (uint32_t)100), tx * 1000 / elapsed_ms,
+           (unsigned)(heap_caps_get_free_size(MALLOC_CAP_8BIT) / 1024));
+  lv_label_set_text_static(overlay, text);  // Same buffer: LVGL only re-measures and invalidates the label
+
+  last_ms = now;
+  last_frames = frames;
+  last_bus = bus;
+  last_busy_us = busy_us;
+}
+
+/* Show or hide the overlay */
+void perf_show(bool show) {
+  if (show) {
+    lv_obj_clear_flag(overlay, LV_OBJ_FLAG_HIDDEN);
+    lv_timer_resume(timer);
+  } else {
+    lv_obj_add_flag(overlay, LV_OBJ_FLAG_HIDDEN);
+    lv_timer_pause(timer);
+  }
+}
+
+/* Console: "perf on" or "perf off" */
+static void perf_command(int argc, char **argv) {
+  perf_show(argc < 2 || strcmp(argv[1], "off") != 0);
+}
+
+/* Install the idle hooks and create the hidden overlay */
+void perf_begin() {
+  esp_register_freertos_idle_hook_for_cpu(idle_hook_core0, 0);
+  esp_register_freertos_idle_hook_for_cpu(idle_hook_core1, 1);
+
+  // Fixed size and opaque background: updates never change the invalidated area
+  // and need no blending with what is underneath
+  overlay = lv_label_create(lv_layer_top());
+  lv_obj_set_size(overlay, 96, 64);
+  lv_obj_align(overlay, LV_ALIGN_TOP_RIGHT, 0, 0);
+  lv_obj_set_style_bg_color(overlay, lv_color_black(), 0);
+  lv_obj_set_style_bg_opa(overlay, LV_OPA_COVER, 0);
+  lv_obj_set_style_text_color(overlay, lv_color_white(), 0);
+  lv_obj_set_style_pad_all(overlay, 2, 0);
+  lv_label_set_text_static(overlay, "");
+
+  timer = lv_timer_create(update, PERF_UPDATE_MS, NULL);
+  perf_show(false);
+  console_register("perf", "Performance overlay on|off", perf_command);
+}
@@ -0,0 +1,109 @@
+/*
+ * Description:
+ * Fixed-point PID controller and loop jitter statistics. See pid.h.
+ */
+
+#include "pid.h"
+#include "console.h"
+
+#define Q16 65536LL
+
+static const uint32_t bucket_limit_us[PID_JITTER_BUCKETS - 1] = {100, 500, 1000, 2000, 5000};
+
+/* Loop statistics, written by the bus task */
+struct pid_stats_t {
+  uint32_t ticks;
+  uint32_t failed;          // Ticks whose read or write failed
+  int64_t sum_us;           // Sum of start lateness
+  int64_t sum_sq_us;        // Sum of squared lateness, for the standard deviation
+  uint32_t worst_us;
+  int64_t worst_at_us;      // esp_timer time of the worst tick
+  uint32_t histogram[PID_JITTER_BUCKETS];
+  int32_t pv;               // Last process value
+  int32_t out;              // Last output
+};
+
+static pid_stats_t stats;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* One controller update in Q16.16; returns the output clamped to the limits */
+int32_t pid_step(pid_state_t *state, const panel_config_t *cfg, int32_t pv, uint32_t dt_ms) {
+  int64_t lo = cfg->pid_out_min * Q16;
+  int64_t hi = cfg->pid_out_max * Q16;
+  int64_t error = (int64_t)cfg->pid_setpoint - pv;
+
+  // Gains are hundredths; dt is milliseconds
+  int64_t p = error * cfg->pid_kp * Q16 / 100;
+  state->integral += error * cfg->pid_ki * Q16 * dt_ms / 100000;
+  state->integral = constrain(state->integral, lo, hi);  // Anti-windup
+  int64_t d = 0;
+  if (state->primed && dt_ms > 0)
+    d = -(int64_t)(pv - state->last_pv) * cfg->pid_kd * Q16 * 10 / dt_ms;  // kd / 100 * 1000 / dt
+  state->last_pv = pv;
+  state->primed = true;
+
+  return (int32_t)(constrain(p + state->integral + d, lo, hi) / Q16);
+}
+
+/* Account one tick: how late it started, and what it read and wrote */
+void pid_record(int64_t due_us, int64_t start_us, int32_t pv, int32_t out, bool ok) {
+  uint32_t late_us = start_us > due_us ? (uint32_t)(start_us - due_us) : 0;
+  uint8_t bucket = 0;
+  while (bucket < PID_JITTER_BUCKETS - 1 && late_us >= bucket_limit_us[bucket])
+    bucket++;
+
+  portENTER_CRITICAL(&stats_lock);
+  stats.ticks++;
+  if (!ok)
+    stats.failed++;
+  stats.sum_us += late_us;
+  stats.sum_sq_us += (int64_t)late_us * late_us;
+  if (late_us > stats.worst_us) {
+    stats.worst_us = late_us;
+    stats.worst_at_us = start_us;
+  }
+  stats.histogram[bucket]++;
+  if (ok) {
+    stats.pv = pv;
+    stats.out = out;
+  }
+  portEXIT_CRITICAL(&stats_lock);
+}
+
+/* Console: "pid" shows the loop and its jitter, "pid reset" clears the statistics */
+static void pid_command(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+    portENTER_CRITICAL(&stats_lock);
+    memset(&stats, 0, sizeof(stats));
+    portEXIT_CRITICAL(&stats_lock);
+    return;
+  }
+
+  pid_stats_t s;
+  portENTER_CRITICAL(&stats_lock);
+  s = stats;
+  portEXIT_CRITICAL(&stats_lock);
+
+  const panel_config_t cfg = config_get();
+  if (cfg.pid_period_ms == 0) {
+    Serial.println("PID off (cfg pid_period_ms)");
+    return;
+  }
+  Serial.printf("PID every %u ms: sp %u pv %d out %d, %u ticks, %u failed\n", cfg.pid_period_ms,
+                cfg.pid_setpoint, s.pv, s.out, s.ticks, s.failed);
+  if (s.ticks == 0)
+    return;
+
+  float mean = (float)s.sum_us / s.ticks;
+  float sd = sqrtf(max((float)s.sum_sq_us / s.ticks - mean * mean, 0.0f));
+  Serial.printf("start jitter: mean %.0f us, sd %.0f us, worst %u us at %.3f s\n", mean, sd, s.worst_us,
+                s.worst_at_us / 1e6);
+  static const char *labels[PID_JITTER_BUCKETS] = {"<100us", "<500us", "<1ms", "<2ms", "<5ms", ">=5ms"};
+  for (uint8_t i = 0; i < PID_JITTER_BUCKETS; i++)
+    Serial.printf("  %-7s %u\n", labels[i], s.histogram[i]);
+}
+
+/* Register the console command */
+void pid_begin() {
+  console_register("pid", "PID loop state and period jitter, or reset", pid_command);
+}
@@ -0,0 +1,313 @@
+/*
+ * Description:
+ * Recipe storage and download engine. See recipe.h.
+ */
+
+#include "recipe.h"
+#include "bus.h"
+#include "bus_load.h"
+#include "bus_model.h"
+#include "config.h"
+#include "console.h"
+#include "crc16.h"
+#include "modbus_rtu.h"
+#include "storage.h"
+
+#define RECIPE_MAGIC 0x31504352u  // "RCP1"
+
+/* File header, followed by count values */
+struct recipe_header_t {
+  uint32_t magic;
+  uint8_t slave;
+  uint8_t reserved;
+  uint16_t start;     // First holding register
+  uint16_t count;     // Registers in the recipe
+  uint16_t crc;       // CRC-16 of the values
+};
+
+static uint16_t values[RECIPE_MAX_REGS];  // Owned by the bus task while a job runs
+static recipe_header_t job;               // Slave and range of the current job
+static recipe_progress_t progress;
+static uint32_t start_ms = 0;
+static uint8_t retries = 0;               // Resends of the current chunk
+static uint32_t wire_us = 0;              // Wire time of the current job
+static bool claimed = false;              // A job is being set up; guarded by recipe_lock
+static portMUX_TYPE recipe_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* File name of a recipe */
+static void recipe_path(char *path, size_t size, const char *name) {
+  snprintf(path, size, "/rcp_%s", name);
+}
+
+/* True while a job owns the engine */
+static bool busy(uint8_t state) {
+  return state == RECIPE_WRITING || state == RECIPE_VERIFYING || state == RECIPE_CAPTURING;
+}
+
+/* Claim the engine for a new job; false if one is running or being set up. Until
+   begin_job() or release(), values belong to the caller and the bus task keeps away */
+static bool claim() {
+  bool ok = false;
+  portENTER_CRITICAL(&recipe_lock);
+  if (!busy(progress.state) && !claimed) {
+    claimed = true;
+    ok = true;
+  }
+  portEXIT_CRITICAL(&recipe_lock);
+  return ok;
+}
+
+/* Give up a claim without starting a job */
+static void release() {
+  portENTER_CRITICAL(&recipe_lock);
+  claimed = false;
+  portEXIT_CRITICAL(&recipe_lock);
+}
+
+/* Start the claimed job; hands job and values to the bus task */
+static void begin_job(const char *name, uint8_t state, const recipe_header_t &h) {
+  portENTER_CRITICAL(&recipe_lock);
+  job = h;
+  strlcpy(progress.name, name, sizeof(progress.name));
+  progress.done = 0;
+  progress.total = job.count;
+  progress.wire_ms = 0;
+  wire_us = 0;
+  progress.error = NULL;
+  retries = 0;
+  start_ms = millis();
+  progress.state = state;
+  claimed = false;
+  portEXIT_CRITICAL(&recipe_lock);
+}
+
+/* Load a recipe from flash and start the download */
+bool recipe_download(const char *name) {
+  char path[8 + RECIPE_NAME_LEN];
+  recipe_path(path, sizeof(path), name);
+  if (!claim()) {
+    Serial.println("Recipe job already running");
+    return false;
+  }
+
+  File f = storage_fs().open(path, "r");
+  if (!f) {
+    release();
+    Serial.printf("No recipe %s\n", name);
+    return false;
+  }
+  recipe_header_t h;
+  bool ok = f.read((uint8_t *)&h, sizeof(h)) == sizeof(h) && h.magic == RECIPE_MAGIC && h.count > 0 &&
+            h.count <= RECIPE_MAX_REGS && h.slave >= 1 && h.slave <= 247 &&
+            f.read((uint8_t *)values, h.count * 2) == h.count * 2u && h.crc == crc16(values, h.count * 2);
+  f.close();
+  if (!ok) {
+    release();
+    Serial.printf("Recipe %s is damaged\n", name);
+    return false;
+  }
+  begin_job(name, RECIPE_WRITING, h);
+  return true;
+}
+
+/* Start reading count registers of a slave into a new recipe */
+bool recipe_capture(const char *name, uint8_t slave, uint16_t start, uint16_t count) {
+  if (count == 0 || count > RECIPE_MAX_REGS || strlen(name) >= RECIPE_NAME_LEN)
+    return false;
+  if (!claim())
+    return false;
+  begin_job(name, RECIPE_CAPTURING, {RECIPE_MAGIC, slave, 0, start, count, 0});
+  return true;
+}
+
+/* Write the captured values to flash */
+static bool save() {
+  char path[8 + RECIPE_NAME_LEN];
+  recipe_path(path, sizeof(path), progress.name);
+  job.crc = crc16(values, job.count * 2);
+  File f = storage_fs().open(path, "w");
+  if (!f)
+    return false;
+  bool ok = f.write((const uint8_t *)&job, sizeof(job)) == sizeof(job) &&
+            f.write((const uint8_t *)values, job.count * 2) == job.count * 2u;
+  f.close();
+  return ok;
+}
+
+/* End the job */
+static void finish(const char *error) {
+  progress.elapsed_ms = millis() - start_ms;
+  progress.error = error;
+  progress.state = error == NULL ? RECIPE_DONE : RECIPE_FAILED;
+}
+
+/* Send one request and receive its response; accounts the wire time */
+static size_t transact(const uint8_t *request, size_t len, uint8_t *response, size_t expected) {
+  uint32_t baud = config_get().baud;
+  uint32_t gap_us = bus_gap_us(baud);
+  uint32_t start_us = micros();
+  rtu_send(Serial2, request, len, gap_us);
+  size_t got = rtu_receive(Serial2, response, MODBUS_RTU_MAX_FRAME, RECIPE_TIMEOUT_MS, gap_us);
+  uint32_t frame_us = bus_wire_us(baud, len, got);
+  bus_load_record(job.slave, BUS_LOAD_WRITES, frame_us);
+  wire_us += frame_us;
+  progress.wire_ms = wire_us / 1000;
+
+  bool ok = got == expected && rtu_valid(response, got) && response[0] == job.slave && response[1] == request[1];
+  bus_count_frame(start_us, ok);
+  return ok ? got : 0;  // Lost, damaged, or an exception (function | 0x80)
+}
+
+/* Write the next chunk */
+static bool write_chunk() {
+  uint8_t request[MODBUS_RTU_MAX_FRAME];
+  uint8_t response[MODBUS_RTU_MAX_FRAME];
+  uint8_t n = min(progress.total - progress.done, RECIPE_WRITE_CHUNK);
+  size_t len = rtu_write_frame(request, job.slave, job.start + progress.done, values + progress.done, n);
+  // FC06 and FC16 both answer with 8 bytes that repeat the address
+  return transact(request, len, response, 8) != 0 && memcmp(response + 2, request + 2, 4) == 0;
+}
+
+/* Read the next chunk; compare it with the recipe, or store it when capturing */
+static bool read_chunk(bool capture, bool *mismatch) {
+  uint8_t request[8];
+  uint8_t response[MODBUS_RTU_MAX_FRAME];
+  uint8_t n = min(progress.total - progress.done, RECIPE_READ_CHUNK);
+  uint16_t address = job.start + progress.done;
+  uint8_t payload[4] = {(uint8_t)(address >> 8), (uint8_t)address, 0, n};
+  size_t len = rtu_frame(request, job.slave, 3, payload, sizeof(payload));
+  if (transact(request, len, response, MODBUS_READ_RESPONSE(n)) == 0 || response[2] != n * 2)
+    return false;
+
+  for (uint8_t i = 0; i < n; i++) {
+    uint16_t v = (response[3 + 2 * i] << 8) | response[4 + 2 * i];
+    if (capture)
+      values[progress.done + i] = v;
+    else if (v != values[progress.done + i])
+      *mismatch = true;
+  }
+  return true;
+}
+
+/* Bus task: predicted bus time of the next chunk, wire time and slave latency; 0 if no
+   job runs */
+uint32_t recipe_next_us() {
+  uint8_t state = progress.state;
+  if (!busy(state))
+    return 0;
+  uint32_t baud = config_get().baud;
+  int left = progress.total - progress.done;
+  if (state == RECIPE_WRITING) {
+    uint16_t n = min(left, RECIPE_WRITE_CHUNK);
+    return (n == 1 ? bus_wire_us(baud, MODBUS_WRITE_SINGLE, MODBUS_WRITE_SINGLE)
+                   : bus_wire_us(baud, MODBUS_WRITE_MULTIPLE_REQUEST(n), MODBUS_WRITE_MULTIPLE_RESPONSE)) +
+           bus_model_latency_us(job.slave, n == 1 ? 6 : 16, n);
+  }
+  uint16_t n = min(left, RECIPE_READ_CHUNK);
+  return bus_wire_us(baud, MODBUS_READ_REQUEST, MODBUS_READ_RESPONSE(n)) + bus_model_latency_us(job.slave, 3, n);
+}
+
+/* Bus task: transfer one chunk of the current job; true while a job runs */
+bool recipe_step() {
+  uint8_t state = progress.state;
+  if (!busy(state))
+    return false;
+
+  bool mismatch = false;
+  bool ok = state == RECIPE_WRITING ? write_chunk() : read_chunk(state == RECIPE_CAPTURING, &mismatch);
+  if (mismatch) {
+    finish("readback differs");
+    return false;
+  }
+  if (!ok) {
+    if (++retries > RECIPE_RETRIES)
+      finish(state == RECIPE_WRITING ? "write failed" : "read failed");
+    return busy(progress.state);
+  }
+
+  retries = 0;
+  progress.done += min(progress.total - progress.done, state == RECIPE_WRITING ? RECIPE_WRITE_CHUNK : RECIPE_READ_CHUNK);
+  if (progress.done < progress.total)
+    return true;
+  if (state == RECIPE_WRITING) {
+    progress.done = 0;
+    progress.state = RECIPE_VERIFYING;
+    return true;
+  }
+  finish(state == RECIPE_CAPTURING && !save() ? "flash write failed" : NULL);
+  return false;
+}
+
+/* Snapshot of the progress */
+void recipe_get_progress(recipe_progress_t *out) {
+  portENTER_CRITICAL(&recipe_lock);
+  *out = progress;
+  portEXIT_CRITICAL(&recipe_lock);
+  if (busy(out->state))
+    out->elapsed_ms = millis() - start_ms;
+}
+
+/* Wire time of a download at the current baud rate: every chunk written and read back,
+   with the gap after each frame */
+static uint32_t wire_limit_ms(uint16_t count) {
+  uint32_t baud = config_get().baud;
+  uint32_t us = 0;
+  for (uint16_t done = 0; done < count; done += RECIPE_WRITE_CHUNK) {
+    uint16_t n = min(count - done, RECIPE_WRITE_CHUNK);
+    us += n == 1 ? bus_wire_us(baud, MODBUS_WRITE_SINGLE, MODBUS_WRITE_SINGLE)
+                 : bus_wire_us(baud, MODBUS_WRITE_MULTIPLE_REQUEST(n), MODBUS_WRITE_MULTIPLE_RESPONSE);
+  }
+  for (uint16_t done = 0; done < count; done += RECIPE_READ_CHUNK)
+    us += bus_wire_us(baud, MODBUS_READ_REQUEST, MODBUS_READ_RESPONSE(min(count - done, RECIPE_READ_CHUNK)));
+  return us / 1000;
+}
+
+/* Console: "recipe" shows the last job, "recipe list", "recipe load <name>",
+   "recipe save <name> <slave> <start> <count>" */
+static void recipe_command(int argc, char **argv) {
+  if (argc == 3 && strcmp(argv[1], "load") == 0) {
+    if (strlen(argv[2]) >= RECIPE_NAME_LEN)
+      Serial.println("Name too long");
+    else if (recipe_download(argv[2]))
+      Serial.printf("Downloading %s: %u registers, wire limit %lu ms\n", argv[2], job.count,
+                    (unsigned long)wire_limit_ms(job.count));
+    return;
+  }
+  if (argc == 6 && strcmp(argv[1], "save") == 0) {
+    int slave = atoi(argv[3]);
+    if (slave < 1 || slave > 247 || !recipe_capture(argv[2], slave, atoi(argv[4]), atoi(argv[5])))
+      Serial.printf("Usage: recipe save <name> <slave 1-247> <start> <count 1-%u>, one job at a time\n",
+                    RECIPE_MAX_REGS);
+    return;
+  }
+  if (argc == 2 && strcmp(argv[1], "list") == 0) {
+    File dir = storage_fs().open("/");
+    for (File f = dir.openNextFile(); f; f = dir.openNextFile()) {
+      const char *name = strrchr(f.name(), '/');
+      name = name != NULL ? name + 1 : f.name();
+      if (strncmp(name, "rcp_", 4) == 0)
+        Serial.printf("  %-15s %u registers\n", name + 4, (unsigned)(f.size() - sizeof(recipe_header_t)) / 2);
+    }
+    return;
+  }
+
+  static const char *states[] = {"idle", "writing", "verifying", "capturing", "done", "failed"};
+  recipe_progress_t p;
+  recipe_get_progress(&p);
+  if (p.state == RECIPE_IDLE) {
+    Serial.println("No recipe job yet");
+    return;
+  }
+  Serial.printf("%s: %s %u/%u, %lu ms", p.name, states[p.state], p.done, p.total, (unsigned long)p.elapsed_ms);
+  if (p.state == RECIPE_DONE && p.elapsed_ms > 0)
+    Serial.printf(" (%lu ms on the wire, %lu%%)", (unsigned long)p.wire_ms,
+                  (unsigned long)(p.wire_ms * 100 / p.elapsed_ms));
+  if (p.error != NULL)
+    Serial.printf(" - %s", p.error);
+  Serial.println();
+}
+
+/* Register the "recipe" console command */
+void recipe_begin() {
+  console_register("recipe", "Recipes: list, load <name>, save <name> <slave> <start> <count>", recipe_command);
+}
@@ -0,0 +1,223 @@
+/*
+ * Description:
+ * Rule engine. See rules.h.
+ */
+
+#include "rules.h"
+#include "bus.h"
+#include "config.h"
+#include "console.h"
+#include "expr.h"
+#include "storage.h"
+#include "textfile.h"
+
+/* One compiled rule */
+struct rule_t {
+  uint16_t condition;     // Offset of the condition code in code_pool
+  uint16_t condition_len;
+  uint16_t value;         // Offset of the value code
+  uint16_t value_len;
+  tag_mask_t inputs;      // Tags read by condition and value
+  uint16_t target;        // Tag written
+  uint32_t interval_ms;   // Shortest time between two writes
+  bool level;             // "while": repeat while true; "if": once per rising edge
+  bool active;            // Condition was true at the last evaluation
+  bool armed;             // Edge seen but not yet written, waiting for the rate limit
+  uint32_t written_ms;    // millis() of the last write
+  uint32_t writes;
+};
+
+static rule_t rules[RULES_MAX];
+static uint8_t rule_count = 0;
+static uint8_t code_pool[RULES_CODE_BYTES];
+static uint16_t code_used = 0;
+static uint32_t pending = 0;          // Rules still to evaluate, one bit each
+static uint32_t tokens_ms = 0;        // Write budget in write-milliseconds, see take_token()
+static uint32_t tokens_at_ms = 0;
+static uint32_t dropped = 0;          // Writes suppressed by the global rate limit
+
+/* Global rate limit: a token bucket refilled at RULES_MAX_WRITES_PER_S */
+static bool take_token(uint32_t now) {
+  uint32_t elapsed = min(now - tokens_at_ms, (uint32_t)1000);
+  tokens_at_ms = now;
+  tokens_ms = min(tokens_ms + elapsed * RULES_MAX_WRITES_PER_S, (uint32_t)RULES_MAX_WRITES_PER_S * 1000);
+  if (tokens_ms < 1000)
+    return false;
+  tokens_ms -= 1000;
+  return true;
+}
+
+/* Evaluate one rule and queue its write when it fires */
+static void run(rule_t &r, uint32_t now) {
+  int32_t condition;
+  uint8_t quality;
+  bool on = expr_eval(code_pool + r.condition, r.condition_len, &condition, &quality) &&
+            quality == TAG_QUALITY_GOOD && condition != 0;
+  if (on && !r.active)
+    r.armed = true;  // Rising edge
+  r.active = on;
+  if (!on) {
+    r.armed = false;
+    return;
+  }
+  if (!(r.armed || r.level) || now - r.written_ms < r.interval_ms)
+    return;
+
+  int32_t value;
+  if (!expr_eval(code_pool + r.value, r.value_len, &value, &quality) || quality != TAG_QUALITY_GOOD)
+    return;
+  const tag_desc_t *d = tag_desc(r.target);
+  if (d->function != 3)
+    return;  // A register map reload retired the target or moved it off the holding registers
+  if (!take_token(now)) {
+    dropped++;
+    return;
+  }
+  uint8_t slave = d->slave == TAG_DEFAULT_SLAVE ? config_get().slave_id : d->slave;
+  if (bus_write_priority(slave, d->address, (uint16_t)value)) {
+    r.armed = false;
+    r.written_ms = now;
+    r.writes++;
+  }
+}
+
+/* Evaluate the rules whose inputs changed, plus active "while" rules and the rules left
+   over from the last cycle, until the time budget is spent */
+void rules_update(tag_mask_t changed) {
+  for (uint8_t i = 0; i < rule_count; i++) {
+    const rule_t &r = rules[i];
+    if ((r.inputs & changed) != 0 || (r.active && (r.level || r.armed)))
+      pending |= 1u << i;
+  }
+  if (pending == 0)
+    return;
+
+  uint32_t start_us = micros();
+  uint32_t now = millis();
+  for (uint8_t i = 0; i < rule_count && pending != 0; i++) {
+    if ((pending & (1u << i)) == 0)
+      continue;
+    if (micros() - start_us >= RULES_BUDGET_US)
+      break;  // The rest waits for the next cycle
+    pending &= ~(1u << i);
+    run(rules[i], now);
+  }
+}
+
+/* Compile one expression into the code pool */
+static bool compile(const char *text, uint16_t *offset, uint16_t *len, tag_mask_t *inputs, uint16_t line_no) {
+  size_t n;
+  tag_mask_t used;
+  const char *error;
+  if (!expr_compile(text, code_pool + code_used, sizeof(code_pool) - code_used, &n, &used, &error)) {
+    Serial.printf("%s:%u: %s\n", RULES_FILE, line_no, error);
+    return false;
+  }
+  *offset = code_used;
+  *len = n;
+  *inputs |= used;
+  code_used += n;
+  return true;
+}
+
+/* Parse "if|while <condition> then <tag> = <value> [every <ms>]" */
+static bool define(char *line, uint16_t line_no) {
+  rule_t r = {};
+  r.interval_ms = RULES_MIN_INTERVAL_MS;
+
+  char *rest = NULL;
+  char *keyword = strtok_r(line, " \t", &rest);
+  r.level = strcmp(keyword, "while") == 0;
+  char *then = strstr(rest, " then ");
+  char *eq = then != NULL ? strchr(then, '=') : NULL;
+  if ((!r.level && strcmp(keyword, "if") != 0) || eq == NULL) {
+    Serial.printf("%s:%u: expected if|while ... then tag = value\n", RULES_FILE, line_no);
+    return false;
+  }
+  *then = '\0';
+  *eq = '\0';
+
+  char *every = strstr(eq + 1, " every ");
+  if (every != NULL) {
+    *every = '\0';
+    char *end;
+    unsigned long ms = strtoul(every + 7, &end, 10);
+    if (end == every + 7 || end[strspn(end, " \t")] != '\0' || ms > RULES_MAX_INTERVAL_MS) {
+      Serial.printf("%s:%u: every takes milliseconds, at most %lu\n", RULES_FILE, line_no,
+                    (unsigned long)RULES_MAX_INTERVAL_MS);
+      return false;
+    }
+    r.interval_ms = max(ms, (unsigned long)RULES_MIN_INTERVAL_MS);
+  }
+
+  char *after = NULL;
+  char *name = strtok_r(then + 6, " \t", &after);
+  int target = name != NULL ? tag_find(name) : -1;
+  tag_desc_t d;
+  if (target < 0 || !tag_get_desc(target, &d) || d.function != 3) {
+    Serial.printf("%s:%u: target must be a holding register tag\n", RULES_FILE, line_no);
+    return false;
+  }
+  if (after != NULL && after[strspn(after, " \t")] != '\0') {
+    Serial.printf("%s:%u: unexpected \"%s\" after the target\n", RULES_FILE, line_no, after);
+    return false;
+  }
+  r.target = target;
+
+  if (rule_count >= RULES_MAX) {
+    Serial.printf("%s:%u: more than %u rules\n", RULES_FILE, line_no, RULES_MAX);
+    return false;
+  }
+  uint16_t code_mark = code_used;
+  if (!compile(rest, &r.condition, &r.condition_len, &r.inputs, line_no) ||
+      !compile(eq + 1, &r.value, &r.value_len, &r.inputs, line_no)) {
+    code_used = code_mark;
+    return false;
+  }
+  rules[rule_count++] = r;
+  return true;
+}
+
+static void rules_command(int argc, char **argv);
+
+/* Load and compile the rules; a bad line is reported and skipped */
+bool rules_begin() {
+  console_register("rules", "Rule states and write counts", rules_command);
+  File f = storage_fs().open(RULES_FILE, "r");
+  if (!f)
+    return true;  // No rules configured
+
+  char line[RULES_LINE_LEN];
+  uint16_t line_no = 0;
+  bool ok = true;
+  char *text;
+  bool too_long;
+  while ((text = textfile_read_line(f, line, sizeof(line), &too_long)) != NULL) {
+    line_no++;
+    if (too_long) {
+      Serial.printf("%s:%u: longer than %u characters\n", RULES_FILE, line_no, (unsigned)sizeof(line) - 1);
+      ok = false;
+    } else if (*text != '\0' && !define(text, line_no)) {
+      ok = false;
+    }
+  }
+  f.close();
+  Serial.printf("%u rules, %u bytes of code\n", rule_count, code_used);
+  return ok;
+}
+
+/* Console: "rules" lists every rule's state */
+static void rules_command(int argc, char **argv) {
+  uint32_t now = millis();
+  Serial.printf("%u rules, %u writes dropped by the rate limit\n", rule_count, dropped);
+  for (uint8_t i = 0; i < rule_count; i++) {
+    const rule_t &r = rules[i];
+    tag_desc_t d;
+    tag_get_desc(r.target, &d);
+    Serial.printf("  %2u %-5s -> %-12s %s  writes %u", i, r.level ? "while" : "if",
+                  d.name, r.active ? "true " : "false", r.writes);
+    if (r.writes > 0)
+      Serial.printf(", last %u s ago", (now - r.written_ms) / 1000);
+    Serial.println();
+  }
+}
@@ -0,0 +1,161 @@
+/*
+ * Description:
+ * Warm-start snapshot of the tag cache. See snapshot.h.
+ */
+
+#include "snapshot.h"
+#include "bus.h"
+#include "config.h"
+#include "crc16.h"
+#include "storage.h"
+#include "tags.h"
+#include "ui_dispatch.h"
+
+#define SNAPSHOT_MAGIC 0x31534352u  // "RCS1"
+
+/* File header, followed by count records */
+struct snapshot_header_t {
+  uint32_t magic;
+  uint16_t count;     // Records in the file
+  uint16_t crc;       // CRC-16 of the records
+};
+
+/* One cached tag */
+struct snapshot_record_t {
+  int32_t value;      // Last good value
+  uint32_t time;      // Epoch seconds of the last poll, 0 if the clock was not set
+  uint16_t address;   // Tag the record belongs to
+  uint8_t slave;
+  uint8_t function;
+  uint8_t quality;    // tag_quality_t when saved
+  uint8_t reserved[3];
+};
+
+static snapshot_record_t records[TAG_MAX];
+static uint16_t saved_crc = 0;        // Records CRC of the last save, times excluded
+
+/* Slave a tag is polled from, with TAG_DEFAULT_SLAVE resolved, so a record still
+   matches after the default slave ID changes */
+static uint8_t tag_slave(const tag_desc_t *d) {
+  return d->slave == TAG_DEFAULT_SLAVE ? config_get().slave_id : d->slave;
+}
+
+/* Fill records from the cache; returns the count and the CRC of values and qualities */
+static uint16_t collect(uint16_t *content_crc) {
+  uint32_t now_ms = millis();
+  uint32_t now = (uint32_t)time(NULL);
+  uint16_t n = 0;
+  uint16_t crc = CRC16_INIT;
+
+  tag_desc_t d;
+  for (uint16_t id = 0; n < TAG_MAX && tag_get_desc(id, &d); id++) {
+    tag_value_t v;
+    if (!tag_read(id, &v) || v.quality == TAG_QUALITY_NONE)
+      continue;
+    snapshot_record_t &r = records[n++];
+    memset(&r, 0, sizeof(r));
+    r.value = v.value;
+    r.time = now >= BUS_CLOCK_VALID ? now - (now_ms - v.time_ms) / 1000 : 0;
+    r.address = d.address;
+    r.slave = tag_slave(&d);
+    r.function = d.function;
+    r.quality = v.quality;
+    crc = crc16_update(crc, &r.value, sizeof(r.value));
+    crc = crc16_update(crc, &r.quality, sizeof(r.quality));
+  }
+  *content_crc = crc;
+  return n;
+}
+
+/* Save the cache if any value or quality changed since the last save */
+bool snapshot_save() {
+  uint16_t content_crc;
+  uint16_t n = collect(&content_crc);
+  if (n == 0 || content_crc == saved_crc)
+    return true;  // Poll times alone do not justify a flash write
+
+  fs::FS &fs = storage_fs();
+  File f = fs.open(SNAPSHOT_TEMP_FILE, "w");
+  if (!f)
+    return false;
+  snapshot_header_t h = {SNAPSHOT_MAGIC, n, crc16(records, n * sizeof(records[0]))};
+  bool ok = f.write((const uint8_t *)&h, sizeof(h)) == sizeof(h) &&
+            f.write((const uint8_t *)records, n * sizeof(records[0])) == n * sizeof(records[0]);
+  f.close();
+  if (!ok) {
+    fs.remove(SNAPSHOT_TEMP_FILE);  // Keep the last good snapshot
+    return false;
+  }
+
+  // SPIFFS cannot rename over an existing file; a restore falls back to the temp file
+  fs.remove(SNAPSHOT_FILE);
+  if (!fs.rename(SNAPSHOT_TEMP_FILE, SNAPSHOT_FILE))
+    return false;
+  saved_crc = content_crc;
+  return true;
+}
+
+/* Read and check one snapshot file into records; returns the record count */
+static uint16_t load(const char *path) {
+  File f = storage_fs().open(path, "r");
+  if (!f)
+    return 0;
+  snapshot_header_t h;
+  uint16_t n = 0;
+  if (f.read((uint8_t *)&h, sizeof(h)) == sizeof(h) && h.magic == SNAPSHOT_MAGIC && h.count <= TAG_MAX &&
+      f.read((uint8_t *)records, h.count * sizeof(records[0])) == h.count * sizeof(records[0]) &&
+      h.crc == crc16(records, h.count * sizeof(records[0])))
+    n = h.count;
+  f.close();
+  return n;
+}
+
+/* Put the records back into the cache as stale values */
+static uint16_t restore(uint16_t n) {
+  uint32_t now_ms = millis();
+  uint32_t now = (uint32_t)time(NULL);
+  uint16_t restored = 0;
+
+  tag_desc_t d;
+  for (uint16_t id = 0; tag_get_desc(id, &d); id++) {
+    uint8_t slave = tag_slave(&d);
+    for (uint16_t i = 0; i < n; i++) {
+      const snapshot_record_t &r = records[i];
+      if (r.slave != slave || r.function != d.function || r.address != d.address)
+        continue;
+      // Poll time relative to millis(); before boot it wraps, which keeps ages right
+      uint32_t time_ms = 0;
+      if (r.time != 0 && now >= BUS_CLOCK_VALID && now >= r.time)
+        time_ms = now_ms - (now - r.time) * 1000;
+      if (tag_restore(id, r.value, time_ms)) {
+        ui_dispatch_mark(id);
+        restored++;
+      }
+      break;
+    }
+  }
+  return restored;
+}
+
+/* Save periodically; flash writes stay on this low-priority task */
+static void snapshot_task(void *arg) {
+  for (;;) {
+    vTaskDelay(pdMS_TO_TICKS(SNAPSHOT_PERIOD_MS));
+    if (!snapshot_save())
+      Serial.println("Cache snapshot failed");
+  }
+}
+
+/* Restore the last snapshot into the cache and start saving */
+bool snapshot_begin() {
+  uint16_t n = load(SNAPSHOT_FILE);
+  if (n == 0)
+    n = load(SNAPSHOT_TEMP_FILE);  // Power was lost between remove and rename
+  if (n > 0) {
+    Serial.printf("Restored %u of %u cached tags\n", restore(n), n);
+    collect(&saved_crc);  // The restored cache is on flash already; do not write it back
+  }
+
+  return xTaskCreatePinnedToCore(snapshot_task, "snapshot", 3072, NULL, SNAPSHOT_TASK_PRIORITY, NULL,
+                                 SNAPSHOT_TASK_CORE) == pdPASS;
+}
@@ -0,0 +1,46 @@
+/*
+ * Description:
+ * Build-time selection of the file system backend. See storage.h.
+ */
+
+#include "storage.h"
+
+#if STORAGE_BACKEND == STORAGE_BACKEND_LITTLEFS
+#include <LittleFS.h>
+#define STORAGE_FS LittleFS
+#define STORAGE_NAME "LittleFS"
+#else
+#include <SPIFFS.h>
+#define STORAGE_FS SPIFFS
+#define STORAGE_NAME "SPIFFS"
+#endif
+
+/* Mount the file system, formatting only if it cannot be mounted */
+bool storage_begin() {
+  if (STORAGE_FS.begin())
+    return true;
+
+  Serial.println("Formatting file system");
+  STORAGE_FS.format();
+  return STORAGE_FS.begin();
+}
+
+/* File system used for all panel files */
+fs::FS &storage_fs() {
+  return STORAGE_FS;
+}
+
+/* Backend name for diagnostics */
+const char *storage_name() {
+  return STORAGE_NAME;
+}
+
+/* Partition size */
+size_t storage_total_bytes() {
+  return STORAGE_FS.totalBytes();
+}
+
+/* Bytes in use */
+size_t storage_used_bytes() {
+  return STORAGE_FS.usedBytes();
+}
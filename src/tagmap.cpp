@@ -0,0 +1,182 @@
+/*
+ * Description:
+ * Register map loading and hot reload. See tagmap.h.
+ */
+
+#include "tagmap.h"
+#include "bus.h"
+#include "config.h"
+#include "console.h"
+#include "storage.h"
+#include "textfile.h"
+#include "tags.h"
+
+static char names[TAG_MAX][TAGMAP_NAME_LEN];  // Names of map tags, by ID; IDs are never reused
+
+static const char *class_names[POLL_CLASS_COUNT] = {"alarm", "operator", "trend", "background"};
+
+/* Poll class by name, or -1 */
+static int class_of(const char *name) {
+  for (uint8_t c = 0; c < POLL_CLASS_COUNT; c++) {
+    if (name != NULL && strcmp(name, class_names[c]) == 0)
+      return c;
+  }
+  return -1;
+}
+
+/* Apply one "name slave function address class" line to the staged table */
+static bool define(char *line, uint16_t line_no, tag_desc_t *table, uint16_t *count, tag_mask_t *seen) {
+  char *rest = NULL;
+  char *name = strtok_r(line, " \t", &rest);
+  char *slave = strtok_r(NULL, " \t", &rest);
+  char *function = strtok_r(NULL, " \t", &rest);
+  char *address = strtok_r(NULL, " \t", &rest);
+  int poll_class = class_of(strtok_r(NULL, " \t", &rest));
+  if (address == NULL || poll_class < 0 || strtok_r(NULL, " \t", &rest) != NULL) {
+    Serial.printf("%s:%u: expected name slave function address class\n", TAGMAP_FILE, line_no);
+    return false;
+  }
+
+  char *end;
+  unsigned long s = strtoul(slave, &end, 10);
+  bool ok = *end == '\0' && s <= 247;
+  unsigned long f = strtoul(function, &end, 10);
+  ok = ok && *end == '\0' && (f == 3 || f == 4);
+  unsigned long a = strtoul(address, &end, 0);
+  ok = ok && *end == '\0' && a <= 0xFFFF;
+  if (!ok || strlen(name) >= TAGMAP_NAME_LEN) {
+    Serial.printf("%s:%u: bad name, slave, function or address\n", TAGMAP_FILE, line_no);
+    return false;
+  }
+
+  uint16_t id = 0;
+  while (id < *count && strcmp(table[id].name, name) != 0)
+    id++;
+  if (id < *count && ((*seen & TAG_BIT(id)) != 0 || table[id].function == TAG_FUNCTION_VIRTUAL)) {
+    Serial.printf("%s:%u: %s is defined twice or is a virtual tag\n", TAGMAP_FILE, line_no, name);
+    return false;
+  }
+  if (id == *count) {
+    if (*count >= TAG_MAX) {
+      Serial.printf("%s:%u: tag table full\n", TAGMAP_FILE, line_no);
+      return false;
+    }
+    strcpy(names[id], name);
+    table[id].name = names[id];
+    (*count)++;
+  }
+  table[id].slave = s;
+  table[id].function = f;
+  table[id].address = a;
+  table[id].poll_class = poll_class;
+  *seen |= TAG_BIT(id);
+  return true;
+}
+
+/* Slave a tag is polled from, with the default slave resolved */
+static uint8_t polled_slave(const tag_desc_t &d) {
+  return d.slave == TAG_DEFAULT_SLAVE ? config_get().slave_id : d.slave;
+}
+
+/* Report polled tags that read the same register, which registers.csv rejects too */
+static bool duplicates(const tag_desc_t *table, uint16_t count) {
+  bool found = false;
+  for (uint16_t i = 0; i < count; i++) {
+    const tag_desc_t &a = table[i];
+    if (a.function != 3 && a.function != 4)
+      continue;
+    for (uint16_t j = i + 1; j < count; j++) {
+      const tag_desc_t &b = table[j];
+      if (b.function == a.function && b.address == a.address && polled_slave(b) == polled_slave(a)) {
+        Serial.printf("%s: %s and %s read the same register\n", TAGMAP_FILE, a.name, b.name);
+        found = true;
+      }
+    }
+  }
+  return found;
+}
+
+/* Parse the map into the spare tag table; false if the file is missing or has errors */
+static bool load(tag_desc_t **table, uint16_t *count) {
+  File f = storage_fs().open(TAGMAP_FILE, "r");
+  if (!f)
+    return false;
+
+  *table = tag_stage(count);
+  tag_mask_t seen = 0;
+  char line[TAGMAP_LINE_LEN];
+  uint16_t line_no = 0;
+  bool ok = true;
+  char *text;
+  bool too_long;
+  while ((text = textfile_read_line(f, line, sizeof(line), &too_long)) != NULL) {
+    line_no++;
+    if (too_long) {
+      Serial.printf("%s:%u: longer than %u characters\n", TAGMAP_FILE, line_no, (unsigned)sizeof(line) - 1);
+      ok = false;
+    } else if (*text != '\0' && !define(text, line_no, *table, count, &seen)) {
+      ok = false;
+    }
+  }
+  f.close();
+
+  // Polled tags the map no longer lists stop being polled but keep their IDs
+  for (uint16_t id = TAG_BUILTIN_COUNT; id < *count; id++) {
+    tag_desc_t &d = (*table)[id];
+    if ((seen & TAG_BIT(id)) == 0 && (d.function == 3 || d.function == 4))
+      d.function = TAG_FUNCTION_RETIRED;
+  }
+  return ok && !duplicates(*table, *count);
+}
+
+/* Parse the map and hand it to the bus task */
+bool tagmap_reload() {
+  if (bus_reload_pending()) {
+    Serial.println("Last reload not applied yet");
+    return false;
+  }
+  tag_desc_t *table;
+  uint16_t count;
+  if (!load(&table, &count)) {
+    Serial.printf("%s not loaded, register map unchanged\n", TAGMAP_FILE);
+    return false;
+  }
+  return bus_reload(table, count);
+}
+
+/* Console: "tags" lists the tag table with cached values, "tags reload" reloads the map */
+static void tags_command(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "reload") == 0) {
+    if (tagmap_reload())
+      Serial.println("Register map staged, swapped in before the next poll");
+    return;
+  }
+
+  static const char *qualities[] = {"none", "good", "bad", "stale"};
+  tag_desc_t d;
+  for (uint16_t id = 0; tag_get_desc(id, &d); id++) {
+    tag_value_t v;
+    tag_read(id, &v);
+    if (d.function == TAG_FUNCTION_VIRTUAL || d.function == TAG_FUNCTION_RETIRED)
+      Serial.printf("%2u %-15s %-25s", id, d.name, d.function == TAG_FUNCTION_VIRTUAL ? "virtual" : "retired");
+    else
+      Serial.printf("%2u %-15s %3u fc%u 0x%04X %-10s", id, d.name, d.slave, d.function, d.address,
+                    class_names[d.poll_class < POLL_CLASS_COUNT ? d.poll_class : POLL_BACKGROUND]);
+    Serial.printf(" %ld (%s)\n", (long)v.value, qualities[v.quality]);
+  }
+}
+
+/* Load the map before the bus starts; no file keeps the built-in tags */
+bool tagmap_begin() {
+  console_register("tags", "List tags, or reload the register map", tags_command);
+  if (!storage_fs().exists(TAGMAP_FILE))
+    return true;
+
+  tag_desc_t *table;
+  uint16_t count;
+  if (!load(&table, &count))
+    return false;
+  tag_swap(count);  // The bus task is not running yet
+  Serial.printf("%u tags in the register map\n", count);
+  return true;
+}
@@ -0,0 +1,180 @@
+/*
+ * Description:
+ * Built-in tag table and the register cache. See tags.h.
+ */
+
+#include "tags.h"
+#include "generated/tag_table.h"
+
+static const uint16_t class_period_ms[POLL_CLASS_COUNT] = {
+  POLL_PERIOD_ALARM, POLL_PERIOD_OPERATOR, POLL_PERIOD_TREND, POLL_PERIOD_BACKGROUND,
+};
+
+/* True if two descriptors name the same register */
+static constexpr bool same_register(const tag_desc_t &a, const tag_desc_t &b) {
+  return a.slave == b.slave && a.function == b.function && a.address == b.address;
+}
+
+/* True if no generated tag from j on reads the register of tag i */
+static constexpr bool unique_from(uint16_t i, uint16_t j) {
+  return j >= TAG_BUILTIN_COUNT || (!same_register(tag_generated[i], tag_generated[j]) && unique_from(i, j + 1));
+}
+
+/* True if the generated tags from i on are polled and read distinct registers */
+static constexpr bool generated_valid(uint16_t i) {
+  return i >= TAG_BUILTIN_COUNT ||
+         ((tag_generated[i].function == 3 || tag_generated[i].function == 4) && unique_from(i, i + 1) &&
+          generated_valid(i + 1));
+}
+
+// tools/gen_tags.py rejects these already; this catches a stale or hand-edited header
+static_assert(TAG_BUILTIN_COUNT <= TAG_MAX, "registers.csv has more tags than the cache holds");
+static_assert(sizeof(tag_generated) / sizeof(tag_generated[0]) == TAG_BUILTIN_COUNT, "stale generated headers");
+static_assert(generated_valid(0), "registers.csv: function other than 3 or 4, or a register used twice");
+
+/* Two descriptor tables: the live one and the spare a reload is staged in */
+static tag_desc_t tables[2][TAG_MAX] = {{TAG_GENERATED_DESCRIPTORS}};
+static uint16_t counts[2] = {TAG_BUILTIN_COUNT, 0};
+static volatile uint8_t live = 0;         // Index of the live table
+static bool compiled = true;              // Polled tags are still the generated ones
+static tag_value_t cache[TAG_MAX];
+static portMUX_TYPE cache_lock = portMUX_INITIALIZER_UNLOCKED;  // Writers and readers run on both cores
+
+/* Tags in the table */
+uint16_t tag_count() {
+  return counts[live];
+}
+
+/* Descriptor of a tag. The pointer is only safe on the bus task, which swaps tables, or
+   before it starts: after a swap the next reload stages into the table it points to */
+const tag_desc_t *tag_desc(uint16_t id) {
+  uint8_t t = live;
+  return id < counts[t] ? &tables[t][id] : NULL;
+}
+
+/* Copy of a descriptor, taken under the lock the swap holds so it never comes from a
+   table that is being staged */
+bool tag_get_desc(uint16_t id, tag_desc_t *out) {
+  portENTER_CRITICAL(&cache_lock);
+  uint8_t t = live;
+  bool ok = id < counts[t];
+  if (ok)
+    *out = tables[t][id];
+  portEXIT_CRITICAL(&cache_lock);
+  return ok;
+}
+
+/* Append a tag; only at boot, before the bus task builds its plan. The name must stay
+   valid for the program lifetime */
+int tag_add(const tag_desc_t *desc) {
+  uint8_t t = live;
+  if (counts[t] >= TAG_MAX)
+    return -1;
+  tables[t][counts[t]] = *desc;
+  if (desc->function != TAG_FUNCTION_VIRTUAL)
+    compiled = false;  // The generated plan does not poll it
+  return counts[t]++;
+}
+
+/* Copy the live table into the spare one for editing; returns the spare table and its
+   count in *count */
+tag_desc_t *tag_stage(uint16_t *count) {
+  uint8_t t = live;
+  memcpy(tables[!t], tables[t], sizeof(tables[t]));
+  *count = counts[t];
+  return tables[!t];
+}
+
+/* True if a tag reads a different register in the two descriptors */
+static bool moved(const tag_desc_t &a, const tag_desc_t &b) {
+  return a.slave != b.slave || a.function != b.function || a.address != b.address;
+}
+
+/* Make the staged table live with count tags. Cache entries of tags that still read the
+   same register carry over; tags that moved or are new start without a value. Returns
+   the tags whose cache entry was cleared */
+tag_mask_t tag_swap(uint16_t count) {
+  uint8_t t = live;
+  const tag_desc_t *old_table = tables[t];
+  const tag_desc_t *new_table = tables[!t];
+  tag_mask_t cleared = 0;
+
+  portENTER_CRITICAL(&cache_lock);
+  for (uint16_t id = 0; id < count; id++) {
+    if (id >= counts[t] || moved(old_table[id], new_table[id])) {
+      cache[id] = {0, TAG_QUALITY_NONE, 0};
+      cleared |= TAG_BIT(id);
+    }
+  }
+  counts[!t] = count;
+  live = !t;
+  compiled = false;
+  portEXIT_CRITICAL(&cache_lock);
+  return cleared;
+}
+
+/* Generated poll plan and its tag order; NULL once a loaded map replaced the compiled one */
+const tag_block_t *tag_compiled_plan(uint8_t *blocks, const uint16_t **tags) {
+  if (!compiled)
+    return NULL;
+  *blocks = sizeof(tag_generated_plan) / sizeof(tag_generated_plan[0]);
+  *tags = tag_generated_plan_tags;
+  return tag_generated_plan;
+}
+
+/* ID of a tag by name, or -1 */
+int tag_find(const char *name) {
+  tag_desc_t d;
+  for (uint16_t id = 0; tag_get_desc(id, &d); id++) {
+    if (strcmp(d.name, name) == 0)
+      return id;
+  }
+  return -1;
+}
+
+/* Nominal period of a poll class */
+uint16_t tag_period_ms(uint8_t poll_class) {
+  return class_period_ms[poll_class < POLL_CLASS_COUNT ? poll_class : POLL_BACKGROUND];
+}
+
+/* Update the cache; true if the value or quality changed */
+bool tag_store(uint16_t id, int32_t value, uint8_t quality) {
+  if (id >= TAG_MAX)
+    return false;
+
+  portENTER_CRITICAL(&cache_lock);
+  tag_value_t &c = cache[id];
+  if (quality == TAG_QUALITY_BAD)
+    value = c.value;  // Keep the last good value
+  bool changed = c.value != value || c.quality != quality;
+  c.value = value;
+  c.quality = quality;
+  c.time_ms = millis();
+  portEXIT_CRITICAL(&cache_lock);
+  return changed;
+}
+
+/* Consistent copy of a cached value */
+bool tag_read(uint16_t id, tag_value_t *out) {
+  if (id >= TAG_MAX)
+    return false;
+
+  portENTER_CRITICAL(&cache_lock);
+  *out = cache[id];
+  portEXIT_CRITICAL(&cache_lock);
+  return true;
+}
+
+/* Seed a tag that has not been polled yet with a stale value; live data always wins */
+bool tag_restore(uint16_t id, int32_t value, uint32_t time_ms) {
+  if (id >= TAG_MAX)
+    return false;
+
+  portENTER_CRITICAL(&cache_lock);
+  tag_value_t &c = cache[id];
+  bool restored = c.quality == TAG_QUALITY_NONE;
+  if (restored)
+    c = {value, TAG_QUALITY_STALE, time_ms};
+  portEXIT_CRITICAL(&cache_lock);
+  return restored;
+}
@@ -0,0 +1,25 @@
+/*
+ * Description:
+ * Line reader for the text configuration files. See textfile.h.
+ */
+
+#include "textfile.h"
+
+/* Read one line, skipping whatever does not fit the buffer */
+char *textfile_read_line(fs::File &f, char *line, size_t len, bool *too_long) {
+  if (!f.available())
+    return NULL;
+  size_t n = 0;
+  int c;
+  *too_long = false;
+  while ((c = f.read()) >= 0 && c != '\n') {
+    if (n < len - 1)
+      line[n++] = (char)c;
+    else
+      *too_long = true;
+  }
+  line[n] = '\0';
+  char *text = line + strspn(line, " \t\r");
+  text[strcspn(text, "\r#")] = '\0';  // Strip comments and DOS line ends
+  return text;
+}
@@ -0,0 +1,239 @@
+/*
+ * Description:
+ * Three-point affine touch calibration. See touch.h.
+ */
+
+#include "touch.h"
+#include "console.h"
+#include "crc16.h"
+#include "storage.h"
+
+#define TOUCH_MAGIC 0x31414354u  // "TCA1"
+
+/* Affine map x' = a * x + b * y + c, y' = d * x + e * y + f */
+struct affine_t {
+  float a, b, c, d, e, f;
+};
+
+/* The same map quantized to Q16 for the sampling path */
+struct touch_matrix_t {
+  int32_t a, b, c, d, e, f;
+};
+
+static affine_t native;                  // Raw to panel pixels at rotation 0
+static bool calibrated = false;
+static touch_matrix_t matrix;            // Raw to screen pixels at the current rotation
+static bool ready = false;               // matrix holds a usable map
+static uint8_t rotation = 0;
+static uint16_t width = 0;               // Screen size at the current rotation
+static uint16_t height = 0;
+
+/* Touch-to-photon measurement, all on the UI thread: touch read, LVGL input and flush */
+enum latency_phase_t {
+  LATENCY_IDLE = 0,
+  LATENCY_PRESSED,      // New press sampled, waiting for LVGL to find its object
+  LATENCY_REDRAW,       // Object known, waiting for a flush that covers it
+};
+
+/* Touch-to-photon statistics */
+struct latency_stats_t {
+  uint32_t presses;         // Presses measured
+  uint32_t unmeasured;      // Presses on the bare screen or not redrawn in time
+  uint64_t sum_us;
+  uint32_t worst_us;
+  uint32_t histogram[TOUCH_LATENCY_BUCKETS];
+};
+
+static const uint32_t bucket_limit_us[TOUCH_LATENCY_BUCKETS - 1] = {20000, 35000, 50000, 75000, 100000, 150000};
+static uint8_t phase = LATENCY_IDLE;
+static bool was_pressed = false;
+static int64_t press_us;                 // esp_timer time of the raw sample that started the press
+static lv_area_t target;                 // Object the press landed on
+static latency_stats_t latency;
+
+/* Targets near three corners of the panel, well apart and not on one line */
+void touch_targets(touch_cal_t *cal, uint16_t panel_width, uint16_t panel_height) {
+  cal->x[0] = panel_width / 8;
+  cal->y[0] = panel_height / 8;
+  cal->x[1] = panel_width - panel_width / 8;
+  cal->y[1] = panel_height / 2;
+  cal->x[2] = panel_width / 2;
+  cal->y[2] = panel_height - panel_height / 8;
+}
+
+/* Quantize a map, with the rounding offset folded into the constant term */
+static int32_t q16(float v) {
+  return (int32_t)lroundf(v * (1 << TOUCH_FRAC_BITS));
+}
+
+/* Fold the rotation into the native map and quantize it; runs once per rotation */
+static void build_matrix() {
+  if (!calibrated || width == 0)
+    return;
+  // Panel size at rotation 0; odd rotations swap the axes
+  float w0 = (rotation & 1 ? height : width) - 1;
+  float h0 = (rotation & 1 ? width : height) - 1;
+  const affine_t &n = native;
+  affine_t m;
+  switch (rotation & 3) {
+    case 0: m = n; break;
+    case 1: m = {n.d, n.e, n.f, -n.a, -n.b, w0 - n.c}; break;
+    case 2: m = {-n.a, -n.b, w0 - n.c, -n.d, -n.e, h0 - n.f}; break;
+    default: m = {-n.d, -n.e, h0 - n.f, n.a, n.b, n.c}; break;
+  }
+  matrix = {q16(m.a), q16(m.b), q16(m.c + 0.5f), q16(m.d), q16(m.e), q16(m.f + 0.5f)};
+  ready = true;
+}
+
+/* Solve the affine map through the three calibration points (Cramer's rule) */
+bool touch_set_calibration(const touch_cal_t *cal) {
+  float x0 = cal->raw_x[0], x1 = cal->raw_x[1], x2 = cal->raw_x[2];
+  float y0 = cal->raw_y[0], y1 = cal->raw_y[1], y2 = cal->raw_y[2];
+  float det = (x0 - x2) * (y1 - y2) - (x1 - x2) * (y0 - y2);
+  if (fabsf(det) < 1.0f)
+    return false;  // Points on one line, or the same point touched twice
+
+  float u0 = cal->x[0], u1 = cal->x[1], u2 = cal->x[2];
+  float v0 = cal->y[0], v1 = cal->y[1], v2 = cal->y[2];
+  affine_t n;
+  n.a = ((u0 - u2) * (y1 - y2) - (u1 - u2) * (y0 - y2)) / det;
+  n.b = ((x0 - x2) * (u1 - u2) - (u0 - u2) * (x1 - x2)) / det;
+  n.c = u0 - n.a * x0 - n.b * y0;
+  n.d = ((v0 - v2) * (y1 - y2) - (v1 - v2) * (y0 - y2)) / det;
+  n.e = ((x0 - x2) * (v1 - v2) - (v0 - v2) * (x1 - x2)) / det;
+  n.f = v0 - n.d * x0 - n.e * y0;
+  native = n;
+  calibrated = true;
+  build_matrix();
+  return true;
+}
+
+/* Read the stored calibration */
+bool touch_load(touch_cal_t *cal) {
+  File f = storage_fs().open(TOUCH_CAL_FILE, "r");
+  if (!f)
+    return false;
+  bool ok = f.read((uint8_t *)cal, sizeof(*cal)) == sizeof(*cal) && cal->magic == TOUCH_MAGIC &&
+            cal->crc == crc16(cal, offsetof(touch_cal_t, crc));
+  f.close();
+  return ok;
+}
+
+/* Store a calibration */
+bool touch_save(touch_cal_t *cal) {
+  cal->magic = TOUCH_MAGIC;
+  cal->crc = crc16(cal, offsetof(touch_cal_t, crc));
+  File f = storage_fs().open(TOUCH_CAL_FILE, "w");
+  if (!f)
+    return false;
+  bool ok = f.write((const uint8_t *)cal, sizeof(*cal)) == sizeof(*cal);
+  f.close();
+  return ok;
+}
+
+/* Switch the map to another display rotation; the calibration stays as it is. UI thread
+   only, like the touch read it affects */
+void touch_set_rotation(uint8_t new_rotation, uint16_t new_width, uint16_t new_height) {
+  rotation = new_rotation & 3;
+  width = new_width;
+  height = new_height;
+  build_matrix();
+}
+
+/* Raw sample to screen pixel: two multiply-adds per axis, clamped to the screen */
+bool touch_map(uint16_t raw_x, uint16_t raw_y, int16_t *x, int16_t *y) {
+  if (!ready)
+    return false;
+  int32_t sx = (matrix.a * raw_x + matrix.b * raw_y + matrix.c) >> TOUCH_FRAC_BITS;
+  int32_t sy = (matrix.d * raw_x + matrix.e * raw_y + matrix.f) >> TOUCH_FRAC_BITS;
+  *x = constrain(sx, 0, width - 1);
+  *y = constrain(sy, 0, height - 1);
+  return true;
+}
+
+/* A press that was not redrawn in time no longer waits for a flush */
+static void expire(int64_t now_us) {
+  if (phase != LATENCY_IDLE && now_us - press_us > TOUCH_LATENCY_TIMEOUT_MS * 1000LL) {
+    phase = LATENCY_IDLE;
+    latency.unmeasured++;
+  }
+}
+
+/* Touch read: a released-to-pressed edge starts a measurement at the raw sample time */
+void touch_sample(bool pressed, int64_t sample_us) {
+  expire(sample_us);
+  if (pressed && !was_pressed && phase == LATENCY_IDLE) {
+    press_us = sample_us;
+    phase = LATENCY_PRESSED;
+  }
+  was_pressed = pressed;
+}
+
+/* LVGL sent LV_EVENT_PRESSED: the object it went to is the area that must be redrawn */
+void touch_feedback_cb(lv_indev_drv_t *drv, uint8_t code) {
+  if (code != LV_EVENT_PRESSED || phase != LATENCY_PRESSED)
+    return;
+  lv_obj_t *obj = lv_indev_get_obj_act();
+  if (obj == NULL || obj == lv_scr_act()) {
+    phase = LATENCY_IDLE;  // Nothing to redraw
+    latency.unmeasured++;
+    return;
+  }
+  lv_obj_get_coords(obj, &target);
+  phase = LATENCY_REDRAW;
+}
+
+/* A flush reached the panel; the first one over the pressed object ends the measurement */
+void touch_flushed(const lv_area_t *area, int64_t done_us) {
+  expire(done_us);
+  if (phase != LATENCY_REDRAW || area->x1 > target.x2 || area->x2 < target.x1 || area->y1 > target.y2 ||
+      area->y2 < target.y1)
+    return;
+  phase = LATENCY_IDLE;
+  uint32_t us = done_us - press_us;
+  uint8_t bucket = 0;
+  while (bucket < TOUCH_LATENCY_BUCKETS - 1 && us >= bucket_limit_us[bucket])
+    bucket++;
+  latency.presses++;
+  latency.sum_us += us;
+  latency.worst_us = max(latency.worst_us, us);
+  latency.histogram[bucket]++;
+}
+
+/* "touch latency": the touch-to-photon histogram */
+static void show_latency() {
+  const latency_stats_t &s = latency;
+  Serial.printf("touch-to-photon: %u presses measured, %u unmeasured\n", s.presses, s.unmeasured);
+  if (s.presses == 0)
+    return;
+  Serial.printf("mean %.1f ms, worst %.1f ms\n", s.sum_us / 1000.0 / s.presses, s.worst_us / 1000.0);
+  static const char *labels[TOUCH_LATENCY_BUCKETS] = {"<20ms", "<35ms", "<50ms", "<75ms",
+                                                     "<100ms", "<150ms", ">=150ms"};
+  for (uint8_t i = 0; i < TOUCH_LATENCY_BUCKETS; i++)
+    Serial.printf("  %-7s %u\n", labels[i], s.histogram[i]);
+}
+
+/* Console: "touch" shows the calibration and the matrix in use, "touch latency [reset]"
+   the touch-to-photon histogram */
+static void touch_command(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "latency") == 0) {
+    if (argc > 2 && strcmp(argv[2], "reset") == 0)
+      memset(&latency, 0, sizeof(latency));
+    else
+      show_latency();
+    return;
+  }
+  if (!calibrated) {
+    Serial.println("Touch not calibrated");
+    return;
+  }
+  Serial.printf("native  x = %.4f rx %+.4f ry %+.1f\n", native.a, native.b, native.c);
+  Serial.printf("        y = %.4f rx %+.4f ry %+.1f\n", native.d, native.e, native.f);
+  Serial.printf("rotation %u, %ux%u, Q%u matrix %d %d %d / %d %d %d\n", rotation, width, height, TOUCH_FRAC_BITS,
+                (int)matrix.a, (int)matrix.b, (int)matrix.c, (int)matrix.d, (int)matrix.e, (int)matrix.f);
+}
+
+/* Register the console command */
+void touch_begin() {
+  console_register("touch", "Touch calibration and matrix, or latency [reset]", touch_command);
+}
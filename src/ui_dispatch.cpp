@@ -0,0 +1,41 @@
+/*
+ * Description:
+ * Dirty bitmap between the bus task and the UI thread. See ui_dispatch.h.
+ */
+
+#include "ui_dispatch.h"
+#include <atomic>
+
+#define DIRTY_WORDS ((TAG_MAX + 31) / 32)
+
+static std::atomic<uint32_t> dirty[DIRTY_WORDS];
+static ui_tag_handler_t handlers[TAG_MAX];
+
+/* Flag a tag as changed; safe from any task */
+void ui_dispatch_mark(uint16_t id) {
+  if (id < TAG_MAX)
+    dirty[id / 32].fetch_or(1u << (id % 32), std::memory_order_release);
+}
+
+/* Set the handler of a tag, or NULL to ignore its updates */
+void ui_dispatch_bind(uint16_t id, ui_tag_handler_t handler) {
+  if (id < TAG_MAX)
+    handlers[id] = handler;
+}
+
+/* Apply all pending updates in one pass; call from the UI thread before lv_timer_handler() */
+void ui_dispatch_drain() {
+  for (uint8_t w = 0; w < DIRTY_WORDS; w++) {
+    if (dirty[w].load(std::memory_order_relaxed) == 0)
+      continue;  // Cheap check avoids a locked exchange on idle words
+    uint32_t bits = dirty[w].exchange(0, std::memory_order_acquire);
+
+    while (bits != 0) {
+      uint16_t id = w * 32 + __builtin_ctz(bits);
+      bits &= bits - 1;  // Clear the lowest set bit
+      tag_value_t value;
+      if (handlers[id] != NULL && tag_read(id, &value))
+        handlers[id](id, &value);  // Reads the latest value; intermediate updates are skipped
+    }
+  }
+}
@@ -0,0 +1,151 @@
+/*
+ * Description:
+ * Shared style sheet and panel theme. See ui_styles.h.
+ */
+
+#include "ui_styles.h"
+
+#define UI_COLOR_SCREEN 0x1E2A38   // Screen background
+#define UI_COLOR_PRIMARY 0x2F7DD1  // Buttons
+#define UI_COLOR_PRESSED 0x1B4F8A  // Buttons while pressed
+#define UI_COLOR_KEY 0x3A4B5E      // Keyboard keys
+#define UI_COLOR_TEXT 0xFFFFFF     // Text on dark backgrounds
+#define UI_RADIUS (UI_RENDER_LITE ? 0 : 6)
+
+lv_style_t style_default;          // Button, released
+lv_style_t style_pressed;          // Button, pressed
+static lv_style_t style_screen;    // Screen background and default text colour
+static lv_style_t style_keyboard;  // Keyboard background
+static lv_style_t style_key;       // Keyboard key, released
+static lv_style_t style_key_pressed; // Keyboard key, pressed or checked
+static lv_style_t style_textarea;  // Text input box
+static lv_style_t style_cursor;    // Text input cursor
+static lv_style_t style_table;     // Table background and frame
+static lv_style_t style_cell;      // Table cell
+static lv_style_t style_track;     // Slider and bar track
+static lv_style_t style_indicator; // Slider and bar filled part
+static lv_style_t style_knob;      // Slider knob
+
+static lv_theme_t panel_theme;
+
+/* Attach the shared styles to a newly created widget */
+static void apply_theme(lv_theme_t *th, lv_obj_t *obj) {
+  if (lv_obj_get_parent(obj) == NULL) {
+    lv_obj_add_style(obj, &style_screen, 0);
+  } else if (lv_obj_check_type(obj, &lv_btn_class)) {
+    lv_obj_add_style(obj, &style_default, 0);
+    lv_obj_add_style(obj, &style_pressed, LV_STATE_PRESSED);
+  } else if (lv_obj_check_type(obj, &lv_keyboard_class)) {
+    lv_obj_add_style(obj, &style_keyboard, 0);
+    lv_obj_add_style(obj, &style_key, LV_PART_ITEMS);
+    lv_obj_add_style(obj, &style_key_pressed, LV_PART_ITEMS | LV_STATE_PRESSED);
+    lv_obj_add_style(obj, &style_key_pressed, LV_PART_ITEMS | LV_STATE_CHECKED);
+  } else if (lv_obj_check_type(obj, &lv_textarea_class)) {
+    lv_obj_add_style(obj, &style_textarea, 0);
+    lv_obj_add_style(obj, &style_cursor, LV_PART_CURSOR | LV_STATE_FOCUSED);
+  } else if (lv_obj_check_type(obj, &lv_table_class)) {
+    lv_obj_add_style(obj, &style_table, 0);
+    lv_obj_add_style(obj, &style_cell, LV_PART_ITEMS);
+  } else if (lv_obj_check_type(obj, &lv_bar_class)) {
+    lv_obj_add_style(obj, &style_track, 0);
+    lv_obj_add_style(obj, &style_indicator, LV_PART_INDICATOR);
+  } else if (lv_obj_check_type(obj, &lv_slider_class)) {
+    lv_obj_add_style(obj, &style_track, 0);
+    lv_obj_add_style(obj, &style_indicator, LV_PART_INDICATOR);
+    lv_obj_add_style(obj, &style_knob, LV_PART_KNOB);
+    lv_obj_add_style(obj, &style_pressed, LV_PART_KNOB | LV_STATE_PRESSED);
+  }
+}
+
+/* Background, corners, shadow and gradient shared by buttons and keys */
+static void init_surface(lv_style_t *s, uint32_t color) {
+  lv_style_init(s);
+  lv_style_set_bg_color(s, lv_color_hex(color));
+  lv_style_set_bg_opa(s, LV_OPA_COVER);
+  lv_style_set_radius(s, UI_RADIUS);
+  lv_style_set_text_color(s, lv_color_hex(UI_COLOR_TEXT));
+#if !UI_RENDER_LITE
+  lv_style_set_bg_grad_color(s, lv_color_hex(UI_COLOR_PRESSED));
+  lv_style_set_bg_grad_dir(s, LV_GRAD_DIR_VER);
+  lv_style_set_shadow_width(s, 8);
+  lv_style_set_shadow_ofs_y(s, 3);
+  lv_style_set_shadow_opa(s, LV_OPA_50);
+#endif
+}
+
+/* Build the style sheet and install the panel theme on the display */
+void ui_styles_init(lv_disp_t *disp) {
+  lv_style_init(&style_screen);
+  lv_style_set_bg_color(&style_screen, lv_color_hex(UI_COLOR_SCREEN));
+  lv_style_set_bg_opa(&style_screen, LV_OPA_COVER);
+  lv_style_set_text_color(&style_screen, lv_color_hex(UI_COLOR_TEXT));
+
+  init_surface(&style_default, UI_COLOR_PRIMARY);
+  lv_style_init(&style_pressed);
+  lv_style_set_bg_color(&style_pressed, lv_color_hex(UI_COLOR_PRESSED));
+#if !UI_RENDER_LITE
+  lv_style_set_shadow_ofs_y(&style_pressed, 1);  // Button appears to sink
+#endif
+
+  lv_style_init(&style_keyboard);
+  lv_style_set_bg_color(&style_keyboard, lv_color_hex(UI_COLOR_SCREEN));
+  lv_style_set_bg_opa(&style_keyboard, LV_OPA_COVER);
+  lv_style_set_pad_all(&style_keyboard, 4);
+  lv_style_set_pad_gap(&style_keyboard, 4);
+
+  init_surface(&style_key, UI_COLOR_KEY);
+  lv_style_init(&style_key_pressed);
+  lv_style_set_bg_color(&style_key_pressed, lv_color_hex(UI_COLOR_PRIMARY));
+
+  lv_style_init(&style_textarea);
+  lv_style_set_bg_color(&style_textarea, lv_color_white());
+  lv_style_set_bg_opa(&style_textarea, LV_OPA_COVER);
+  lv_style_set_text_color(&style_textarea, lv_color_black());
+  lv_style_set_border_width(&style_textarea, 1);
+  lv_style_set_border_color(&style_textarea, lv_color_hex(UI_COLOR_PRIMARY));
+  lv_style_set_radius(&style_textarea, UI_RADIUS);
+  lv_style_set_pad_all(&style_textarea, 6);
+
+  lv_style_init(&style_cursor);
+  lv_style_set_border_color(&style_cursor, lv_color_black());
+  lv_style_set_border_width(&style_cursor, 2);
+  lv_style_set_border_side(&style_cursor, LV_BORDER_SIDE_LEFT);
+  lv_style_set_pad_left(&style_cursor, -1);
+#if !UI_RENDER_LITE
+  lv_style_set_anim_time(&style_cursor, 400);  // Blinking cursor
+#endif
+
+  lv_style_init(&style_table);
+  lv_style_set_bg_color(&style_table, lv_color_hex(UI_COLOR_SCREEN));
+  lv_style_set_bg_opa(&style_table, LV_OPA_COVER);
+  lv_style_set_border_width(&style_table, 1);
+  lv_style_set_border_color(&style_table, lv_color_hex(UI_COLOR_KEY));
+
+  lv_style_init(&style_cell);
+  lv_style_set_text_color(&style_cell, lv_color_hex(UI_COLOR_TEXT));
+  lv_style_set_border_width(&style_cell, 1);
+  lv_style_set_border_color(&style_cell, lv_color_hex(UI_COLOR_KEY));
+  lv_style_set_border_side(&style_cell, LV_BORDER_SIDE_BOTTOM);
+  lv_style_set_pad_hor(&style_cell, 6);
+
+  lv_style_init(&style_track);
+  lv_style_set_bg_color(&style_track, lv_color_hex(UI_COLOR_KEY));
+  lv_style_set_bg_opa(&style_track, LV_OPA_COVER);
+  lv_style_set_radius(&style_track, UI_RADIUS);
+
+  lv_style_init(&style_indicator);
+  lv_style_set_bg_color(&style_indicator, lv_color_hex(UI_COLOR_PRIMARY));
+  lv_style_set_bg_opa(&style_indicator, LV_OPA_COVER);
+  lv_style_set_radius(&style_indicator, UI_RADIUS);
+
+  init_surface(&style_knob, UI_COLOR_PRIMARY);
+  lv_style_set_pad_all(&style_knob, 4);  // Knob stands out of the track
+
+  // The panel theme replaces the default theme, so widgets only carry the shared styles
+  panel_theme.disp = disp;
+  panel_theme.font_small = LV_FONT_DEFAULT;
+  panel_theme.font_normal = LV_FONT_DEFAULT;
+  panel_theme.font_large = LV_FONT_DEFAULT;
+  lv_theme_set_apply_cb(&panel_theme, apply_theme);
+  lv_disp_set_theme(disp, &panel_theme);
+}
@@ -0,0 +1,111 @@
+/*
+ * Description:
+ * Virtual tags. See vtags.h.
+ */
+
+#include "vtags.h"
+#include "expr.h"
+#include "storage.h"
+#include "textfile.h"
+
+/* One compiled virtual tag */
+struct vtag_t {
+  uint16_t id;          // Tag ID of the result
+  uint16_t code;        // Offset of the bytecode in code_pool
+  uint16_t len;         // Bytecode length
+  tag_mask_t inputs;    // Tags the expression reads
+};
+
+static vtag_t vtags[VTAG_MAX];
+static uint8_t vtag_count = 0;
+static char names[VTAG_MAX][VTAG_NAME_LEN];
+static uint8_t code_pool[VTAG_CODE_BYTES];
+static uint16_t code_used = 0;
+
+/* Evaluate one virtual tag and store the result; true if the cached value changed */
+static bool evaluate(const vtag_t &v) {
+  int32_t value;
+  uint8_t quality;
+  if (!expr_eval(code_pool + v.code, v.len, &value, &quality))
+    return false;  // An input was never read
+  return tag_store(v.id, value, quality);
+}
+
+/* Compile one "name = expression" line and add its tag */
+static bool define(char *line, uint16_t line_no) {
+  char *eq = strchr(line, '=');
+  if (eq == NULL) {
+    Serial.printf("%s:%u: missing =\n", VTAG_FILE, line_no);
+    return false;
+  }
+  *eq = '\0';
+  char *rest;
+  char *name = strtok_r(line, " \t", &rest);
+  if (name == NULL || strtok_r(NULL, " \t", &rest) != NULL || strlen(name) >= VTAG_NAME_LEN ||
+      tag_find(name) >= 0) {
+    Serial.printf("%s:%u: bad or duplicate name\n", VTAG_FILE, line_no);
+    return false;
+  }
+  if (vtag_count >= VTAG_MAX) {
+    Serial.printf("%s:%u: more than %u virtual tags\n", VTAG_FILE, line_no, VTAG_MAX);
+    return false;
+  }
+
+  vtag_t &v = vtags[vtag_count];
+  size_t len;
+  const char *error;
+  if (!expr_compile(eq + 1, code_pool + code_used, sizeof(code_pool) - code_used, &len, &v.inputs, &error)) {
+    Serial.printf("%s:%u: %s\n", VTAG_FILE, line_no, error);
+    return false;
+  }
+
+  strcpy(names[vtag_count], name);
+  tag_desc_t desc = {names[vtag_count], TAG_DEFAULT_SLAVE, TAG_FUNCTION_VIRTUAL, vtag_count, POLL_BACKGROUND};
+  int id = tag_add(&desc);
+  if (id < 0) {
+    Serial.printf("%s:%u: tag table full\n", VTAG_FILE, line_no);
+    return false;
+  }
+  v.id = id;
+  v.code = code_used;
+  v.len = len;
+  code_used += len;
+  vtag_count++;
+  return true;
+}
+
+/* Load and compile the definitions; a bad line is reported and skipped */
+bool vtags_begin() {
+  File f = storage_fs().open(VTAG_FILE, "r");
+  if (!f)
+    return true;  // No virtual tags configured
+
+  char line[VTAG_LINE_LEN];
+  uint16_t line_no = 0;
+  bool ok = true;
+  char *text;
+  bool too_long;
+  while ((text = textfile_read_line(f, line, sizeof(line), &too_long)) != NULL) {
+    line_no++;
+    if (too_long) {
+      Serial.printf("%s:%u: longer than %u characters\n", VTAG_FILE, line_no, (unsigned)sizeof(line) - 1);
+      ok = false;
+    } else if (*text != '\0' && !define(text, line_no)) {
+      ok = false;
+    }
+  }
+  f.close();
+  Serial.printf("%u virtual tags, %u bytes of code\n", vtag_count, code_used);
+  return ok;
+}
+
+/* Re-evaluate the virtual tags whose inputs changed, in definition order so a virtual
+   tag built on another sees its new value */
+tag_mask_t vtags_update(tag_mask_t changed) {
+  for (uint8_t i = 0; i < vtag_count; i++) {
+    const vtag_t &v = vtags[i];
+    if ((v.inputs & changed) != 0 && evaluate(v))
+      changed |= TAG_BIT(v.id);
+  }
+  return changed;
+}
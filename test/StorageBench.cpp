@@ -0,0 +1,102 @@
+/*
+ * Description:
+ * Storage benchmark: SPIFFS against LittleFS on the panel's "spiffs" partition.
+ *
+ * For each backend the partition is formatted, filled to 50% and then 90% with a filler
+ * file, and at each fill level the sketch measures the mount time and then appends log
+ * sized records in the same 16-record batches the data logger uses, reporting throughput
+ * and the worst single append. Results are printed to the Serial Monitor.
+ *
+ * Flash this sketch on its own; it erases the partition.
+ */
+
+#include <Arduino.h>
+#include <FS.h>
+#include <SPIFFS.h>
+#include <LittleFS.h>
+
+#define RECORD_SIZE 28        // sizeof(log_record_t)
+#define BATCH_RECORDS 16      // LOG_FLUSH_BATCH
+#define BATCHES 256           // Appends measured per fill level
+#define FILL_BLOCK 4096       // Bytes written per filler write
+
+/* Format, mount and unmount hooks for one backend */
+struct backend_t {
+  const char *name;
+  fs::FS &fs;
+  bool (*begin)();
+  void (*end)();
+  bool (*format)();
+  size_t (*total)();
+  size_t (*used)();
+};
+
+static backend_t backends[] = {
+  {"SPIFFS", SPIFFS, [] { return SPIFFS.begin(); }, [] { SPIFFS.end(); }, [] { return SPIFFS.format(); },
+   [] { return SPIFFS.totalBytes(); }, [] { return SPIFFS.usedBytes(); }},
+  {"LittleFS", LittleFS, [] { return LittleFS.begin(); }, [] { LittleFS.end(); }, [] { return LittleFS.format(); },
+   [] { return LittleFS.totalBytes(); }, [] { return LittleFS.usedBytes(); }},
+};
+
+static uint8_t block[FILL_BLOCK];
+
+/* Grow the filler file until the given share of the partition is used */
+void fill_to(backend_t &b, uint8_t percent) {
+  File f = b.fs.open("/filler", "a");
+  while (f && b.used() * 100 < b.total() * percent) {
+    if (f.write(block, sizeof(block)) != sizeof(block))
+      break;  // Partition full
+  }
+  f.close();
+}
+
+/* Measure mount time, append throughput and worst append latency at the current fill level */
+void measure(backend_t &b, uint8_t percent) {
+  b.end();
+  uint32_t t0 = micros();
+  b.begin();
+  uint32_t mount_us = micros() - t0;
+
+  uint8_t batch[RECORD_SIZE * BATCH_RECORDS];
+  memset(batch, 0x5A, sizeof(batch));
+  b.fs.remove("/bench");
+
+  uint32_t worst_us = 0;
+  t0 = micros();
+  for (int i = 0; i < BATCHES; i++) {
+    uint32_t start = micros();
+    File f = b.fs.open("/bench", "a");  // Open, append, close: as the logger does
+    f.write(batch, sizeof(batch));
+    f.close();
+    worst_us = max(worst_us, micros() - start);
+  }
+  uint32_t total_us = micros() - t0;
+
+  float kbps = (float)BATCHES * sizeof(batch) * 1000.0f / total_us;  // kB/s
+  Serial.printf("%-8s %3u%%  mount %7.1f ms  append %6.1f kB/s  worst %7.1f ms\n", b.name, percent,
+                mount_us / 1000.0f, kbps, worst_us / 1000.0f);
+  b.fs.remove("/bench");
+}
+
+void setup() {
+  Serial.begin(115200);
+  delay(1000);
+  memset(block, 0xA5, sizeof(block));
+
+  for (backend_t &b : backends) {
+    b.format();
+    if (!b.begin()) {
+      Serial.printf("%s: mount failed\n", b.name);
+      continue;
+    }
+    fill_to(b, 50);
+    measure(b, 50);
+    fill_to(b, 90);
+    measure(b, 90);
+    b.end();
+  }
+  Serial.println("Done");
+}
+
+void loop() {
+}
@@ -0,0 +1,191 @@
+/*
+ * Description:
+ * Host test of the data logger's compaction on the RAM file system of the soak shims.
+ *
+ * The log task runs on the test thread: every time it waits for samples the virtual
+ * clock moves on by the wait, which refills the compaction write budget, and the test
+ * gets control back once the task has nothing left to do. Samples are timestamped with
+ * the host clock, so a run may straddle a minute; the checks hold either way.
+ *
+ *   pio test -e native-datalog
+ */
+
+#include <Arduino.h>
+#include <unity.h>
+#include "console.h"
+#include "datalog.h"
+#include "storage.h"
+
+#define RAW_TO_COMPACT ((LOG_RAW_SEGMENTS - 1) * LOG_SEGMENT_RECORDS) // Samples that start compaction
+#define SEGMENT_HEADER 16    // Bytes before the first record of a segment
+#define APPEND_BATCH 16      // Samples queued between task runs, well below the queue depth
+
+/* ---- Host runtime for the logger ---- */
+
+struct stop_t {};
+
+static uint64_t now_ms = 0;
+static TaskFunction_t task_fn = NULL;
+static bool (*stop_when)() = NULL;
+
+uint32_t millis() {
+  return (uint32_t)now_ms;
+}
+
+size_t Print::write(const uint8_t *buf, size_t len) {
+  return len;
+}
+
+size_t Print::println(const char *s) {
+  return strlen(s) + 1;
+}
+
+size_t Print::println() {
+  return 1;
+}
+
+size_t Print::printf(const char *format, ...) {
+  return 0;
+}
+
+int HardwareSerial::available() {
+  return 0;
+}
+
+int HardwareSerial::read() {
+  return -1;
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+  return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t *buf, size_t len) {
+  return len;
+}
+
+void HardwareSerial::flush() {}
+
+HardwareSerial Serial(false);
+
+bool console_register(const char *name, const char *help, console_handler_t handler) {
+  return true;
+}
+
+void console_suspend(bool suspend) {}
+
+fs::FS &storage_fs() {
+  static fs::FS flash;
+  return flash;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name, uint32_t stack, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core) {
+  task_fn = task;
+  return pdPASS;
+}
+
+struct shim_queue {
+  std::vector<uint8_t> items;
+  UBaseType_t item_size;
+  UBaseType_t length;
+  UBaseType_t head;
+  UBaseType_t count;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+  shim_queue *q = new shim_queue;  // Once, like the firmware
+  q->items.resize(length * item_size);
+  q->item_size = item_size;
+  q->length = length;
+  q->head = 0;
+  q->count = 0;
+  return q;
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t ticks) {
+  if (q->count == q->length)
+    return pdFALSE;
+  memcpy(&q->items[((q->head + q->count) % q->length) * q->item_size], item, q->item_size);
+  q->count++;
+  return pdTRUE;
+}
+
+/* An empty queue blocks the task for its wait: the clock moves on, or the test stops it */
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t ticks) {
+  if (q->count == 0) {
+    if (ticks > 0 && stop_when())
+      throw stop_t();
+    now_ms += ticks;
+    return pdFALSE;
+  }
+  memcpy(item, &q->items[q->head * q->item_size], q->item_size);
+  q->head = (q->head + 1) % q->length;
+  q->count--;
+  return pdTRUE;
+}
+
+/* Run the log task until done() when it waits for samples */
+static void run_task(bool (*done)()) {
+  stop_when = done;
+  try {
+    task_fn(NULL);
+  } catch (const stop_t &) {
+  }
+}
+
+/* ---- Tests ---- */
+
+static bool always() {
+  return true;
+}
+
+static bool compacted() {
+  datalog_stats_t stats;
+  datalog_get_stats(&stats);
+  return stats.segments_compacted > 0;
+}
+
+/* Tags that are equal in their low bits each get a bucket of their own: the first
+   minute segment holds one aggregate per tag and minute, covering every sample of the
+   compacted raw segment */
+static void test_colliding_tags() {
+  const uint16_t tags[] = {1, 33, 0xFD01, 0xFE01, 0xFF01};
+  const uint8_t n = sizeof(tags) / sizeof(tags[0]);
+  TEST_ASSERT_TRUE(datalog_begin());
+  for (uint32_t i = 0; i < RAW_TO_COMPACT; i++) {
+    TEST_ASSERT_TRUE(datalog_append(tags[i % n], (int32_t)i));
+    if ((i + 1) % APPEND_BATCH == 0)
+      run_task(always);  // Drain the queue before it fills
+  }
+  run_task(compacted);
+
+  File f = storage_fs().open("/log_m0", "r");
+  TEST_ASSERT_TRUE(f);
+  f.seek(SEGMENT_HEADER);
+  log_record_t r, seen[LOG_SEGMENT_RECORDS];
+  uint32_t aggregates = 0, count[n] = {0};
+  while (f.read((uint8_t *)&r, sizeof(r)) == sizeof(r)) {
+    uint8_t k = 0;
+    while (k < n && tags[k] != r.tag)
+      k++;
+    TEST_ASSERT_LESS_THAN(n, k);  // Only logged tags
+    for (uint32_t j = 0; j < aggregates; j++)
+      TEST_ASSERT_FALSE(seen[j].tag == r.tag && seen[j].time == r.time);
+    seen[aggregates++] = r;
+    count[k] += r.count;
+  }
+  f.close();
+  for (uint8_t k = 0; k < n; k++)
+    TEST_ASSERT_EQUAL(LOG_SEGMENT_RECORDS / n + (k < LOG_SEGMENT_RECORDS % n), count[k]);
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_colliding_tags);
+  return UNITY_END();
+}
@@ -0,0 +1,84 @@
+/*
+ * Description:
+ * Host shim of the Arduino core for the native soak test.
+ *
+ * Only what the firmware modules under test use. Time is virtual (see sim.h): millis(),
+ * micros() and esp_timer_get_time() read the simulation clock, and every read moves it on
+ * by one microsecond, so busy-wait loops in the firmware terminate.
+ */
+
+#ifndef SHIM_ARDUINO_H
+#define SHIM_ARDUINO_H
+
+#include <algorithm>
+#include <ctype.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_timer.h"
+
+using std::max;
+using std::min;
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+#define SERIAL_8N1 0x800001c
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+uint32_t esp_random();
+
+/* glibc only has strlcpy from 2.38 on */
+size_t shim_strlcpy(char *dst, const char *src, size_t size);
+#define strlcpy shim_strlcpy
+
+/* Text output; the soak test keeps firmware messages off the report unless verbose */
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buf, size_t len);
+  size_t print(const char *s);
+  size_t println(const char *s);
+  size_t println();
+  size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+  virtual void flush() {}
+};
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  size_t readBytesUntil(char terminator, char *buf, size_t len);
+  using Print::write;
+};
+
+/* Serial is the console, Serial2 the RS485 line to the simulated slaves */
+class HardwareSerial : public Stream {
+public:
+  explicit HardwareSerial(bool line) : line(line) {}
+  void begin(unsigned long baud, uint32_t config = SERIAL_8N1, int8_t rx = -1, int8_t tx = -1);
+  void end() {}
+  int available() override;
+  int read() override;
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t *buf, size_t len) override;
+  void flush() override;
+
+private:
+  bool line;
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial2;
+
+#endif
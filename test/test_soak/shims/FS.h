@@ -0,0 +1,101 @@
+/*
+ * Host shim of the Arduino file system API: files live in memory and storage_fs()
+ * starts empty, so modules that read their files at boot fall back to their built-in
+ * defaults. Modes "r" and "r+" need an existing file, "w" truncates and "a" appends.
+ */
+
+#ifndef SHIM_FS_H
+#define SHIM_FS_H
+
+#include "Arduino.h"
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace fs {
+
+typedef std::shared_ptr<std::vector<uint8_t>> shim_file_data_t;
+
+class File : public Stream {
+public:
+  File() {}
+  File(const shim_file_data_t &data, const char *path, bool append)
+      : data(data), path(path), pos(append ? data->size() : 0), append(append) {}
+  int available() override { return data ? (int)(data->size() - pos) : 0; }
+  int read() override {
+    uint8_t c;
+    return read(&c, 1) == 1 ? c : -1;
+  }
+  size_t read(uint8_t *buf, size_t len) {
+    if (!data || pos >= data->size())
+      return 0;
+    len = min(len, data->size() - pos);
+    memcpy(buf, data->data() + pos, len);
+    pos += len;
+    return len;
+  }
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t *buf, size_t len) override {
+    if (!data)
+      return 0;
+    if (append)
+      pos = data->size();
+    if (pos + len > data->size())
+      data->resize(pos + len);
+    memcpy(data->data() + pos, buf, len);
+    pos += len;
+    return len;
+  }
+  bool seek(uint32_t to) {
+    if (!data || to > data->size())
+      return false;
+    pos = to;
+    return true;
+  }
+  size_t position() const { return pos; }
+  size_t size() const { return data ? data->size() : 0; }
+  const char *name() const { return path.c_str(); }
+  File openNextFile() { return File(); }  // No directories
+  void close() { data.reset(); }
+  operator bool() const { return data != nullptr; }
+
+private:
+  shim_file_data_t data;
+  std::string path;
+  size_t pos = 0;
+  bool append = false;
+};
+
+class FS {
+public:
+  File open(const char *path, const char *mode = "r") {
+    auto it = files.find(path);
+    if (mode[0] == 'w' || (mode[0] == 'a' && it == files.end()))
+      it = files.insert_or_assign(path, std::make_shared<std::vector<uint8_t>>()).first;
+    if (it == files.end())
+      return File();
+    return File(it->second, path, mode[0] == 'a');
+  }
+  bool exists(const char *path) { return files.count(path) > 0; }
+  bool remove(const char *path) { return files.erase(path) > 0; }
+  bool rename(const char *from, const char *to) {
+    auto it = files.find(from);
+    if (it == files.end())
+      return false;
+    files[to] = it->second;
+    files.erase(from);
+    return true;
+  }
+  void format() { files.clear(); }  // Host only: drop every file
+
+private:
+  std::map<std::string, shim_file_data_t> files;
+};
+
+}  // namespace fs
+
+using fs::File;
+using fs::FS;
+
+#endif
@@ -0,0 +1,42 @@
+/*
+ * Host shim of ModbusMaster 2.0. Requests are real RTU frames on the Stream given to
+ * begin(), so they reach the simulated slaves the same way the raw frames of
+ * modbus_rtu.cpp do; only the API the bus task uses is provided.
+ */
+
+#ifndef SHIM_MODBUSMASTER_H
+#define SHIM_MODBUSMASTER_H
+
+#include "Arduino.h"
+
+class ModbusMaster {
+public:
+  static const uint8_t ku8MBSuccess = 0x00;
+  static const uint8_t ku8MBInvalidSlaveID = 0xE0;
+  static const uint8_t ku8MBInvalidFunction = 0xE1;
+  static const uint8_t ku8MBResponseTimedOut = 0xE2;
+  static const uint8_t ku8MBInvalidCRC = 0xE3;
+
+  void begin(uint8_t slave, Stream &serial) {
+    this->slave = slave;
+    this->serial = &serial;
+  }
+  uint8_t readHoldingRegisters(uint16_t address, uint16_t count) { return read(3, address, count); }
+  uint8_t readInputRegisters(uint16_t address, uint16_t count) { return read(4, address, count); }
+  uint8_t writeSingleRegister(uint16_t address, uint16_t value);
+  uint8_t writeMultipleRegisters(uint16_t address, uint16_t count);
+  uint8_t setTransmitBuffer(uint8_t index, uint16_t value);
+  void clearTransmitBuffer() { memset(transmit, 0, sizeof(transmit)); }
+  uint16_t getResponseBuffer(uint8_t index) { return index < 64 ? response[index] : 0xFFFF; }
+
+private:
+  uint8_t read(uint8_t function, uint16_t address, uint16_t count);
+  uint8_t transact(const uint8_t *payload, size_t len, uint8_t function, uint8_t *reply, size_t *reply_len);
+
+  uint8_t slave = 1;
+  Stream *serial = NULL;
+  uint16_t transmit[64];
+  uint16_t response[64];
+};
+
+#endif
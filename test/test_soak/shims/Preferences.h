@@ -0,0 +1,16 @@
+/* Host shim of the NVS Preferences API: one blob per key, kept in memory */
+
+#ifndef SHIM_PREFERENCES_H
+#define SHIM_PREFERENCES_H
+
+#include "Arduino.h"
+
+class Preferences {
+public:
+  bool begin(const char *name, bool read_only = false) { return true; }
+  void end() {}
+  size_t getBytes(const char *key, void *buf, size_t len);
+  size_t putBytes(const char *key, const void *value, size_t len);
+};
+
+#endif
@@ -0,0 +1,10 @@
+/* Host shim: esp_timer reads the simulation clock */
+
+#ifndef SHIM_ESP_TIMER_H
+#define SHIM_ESP_TIMER_H
+
+#include <stdint.h>
+
+int64_t esp_timer_get_time();
+
+#endif
@@ -0,0 +1,34 @@
+/*
+ * Host shim of the FreeRTOS API for the native soak test.
+ *
+ * The simulation runs on one host thread. Critical sections are no-ops and tasks are not
+ * threads: xTaskCreatePinnedToCore() records the bus task and the test runs it, and the
+ * task's blocking calls (ulTaskNotifyTake, vTaskDelay) advance the simulation clock and
+ * run the UI in the meantime, see sim.h.
+ */
+
+#ifndef SHIM_FREERTOS_H
+#define SHIM_FREERTOS_H
+
+#include <stdint.h>
+
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY 0xFFFFFFFFu
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define portTICK_PERIOD_MS 1
+
+typedef struct {
+  int unused;
+} portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+
+#endif
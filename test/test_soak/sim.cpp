@@ -0,0 +1,535 @@
+/*
+ * Description:
+ * Simulation and host shim implementations for the soak test. See sim.h.
+ */
+
+#include "sim.h"
+#include <ModbusMaster.h>
+#include <Preferences.h>
+#include <chrono>
+#include <map>
+#include <stdarg.h>
+#include <string>
+#include <vector>
+#include "crc16.h"
+#include "storage.h"
+
+#define LINE_BUFFER 512                // Bytes one frame may have on the simulated line
+#define MODBUS_TIMEOUT_MS 2000         // ModbusMaster's default response timeout
+#define MODBUS_WAIT_STEP_US 100        // Busy-wait step while ModbusMaster waits for a reply
+
+/* Thrown at a task sleep once done() holds, to leave the task's endless loop */
+struct sim_stop_t {};
+
+static uint64_t now_us = 0;
+static uint64_t ui_due_us = 0;
+static bool in_ui = false;             // The UI loop is running; time passes without nesting it
+static void (*ui_tick)() = NULL;
+static TaskFunction_t task_fn = NULL;
+static void *task_arg = NULL;
+static uint32_t notified = 0;          // Pending task notifications
+static bool verbose = false;
+static uint32_t random_state = 1;
+static sim_slave_t slaves[SIM_MAX_SLAVES];
+static sim_stats_t stats;
+
+static uint32_t baud = 9600;
+static uint8_t tx[LINE_BUFFER];        // Frame being written by the panel
+static size_t tx_len = 0;
+static uint8_t rx[LINE_BUFFER];        // Reply on its way to the panel
+static size_t rx_len = 0;
+static size_t rx_pos = 0;
+static uint64_t rx_ready_us = 0;       // When the last reply byte has arrived
+
+static std::map<std::string, std::vector<uint8_t>> nvs;
+
+HardwareSerial Serial(false);
+HardwareSerial Serial2(true);
+
+/* ---- Clock and UI loop ---- */
+
+/* Move the clock to t, running every UI loop iteration that falls due on the way */
+static void advance_to(uint64_t t) {
+  while (!in_ui && ui_tick != NULL && ui_due_us <= t) {
+    if (now_us < ui_due_us)
+      now_us = ui_due_us;
+    in_ui = true;
+    auto start = std::chrono::steady_clock::now();
+    ui_tick();
+    stats.ui_real_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    stats.ui_ticks++;
+    in_ui = false;
+    ui_due_us += SIM_UI_PERIOD_US;
+  }
+  if (now_us < t)
+    now_us = t;
+}
+
+uint64_t sim_now_us() {
+  return now_us;
+}
+
+uint32_t micros() {
+  return (uint32_t)(now_us++);  // Every clock read costs a microsecond of CPU time
+}
+
+uint32_t millis() {
+  return (uint32_t)(now_us++ / 1000);
+}
+
+int64_t esp_timer_get_time() {
+  return (int64_t)now_us++;
+}
+
+void delay(uint32_t ms) {
+  advance_to(now_us + ms * 1000ull);
+}
+
+void delayMicroseconds(uint32_t us) {
+  advance_to(now_us + us);
+}
+
+/* Deterministic, so a failing run can be repeated */
+uint32_t esp_random() {
+  random_state = random_state * 1664525u + 1013904223u;
+  return random_state;
+}
+
+size_t shim_strlcpy(char *dst, const char *src, size_t size) {
+  size_t len = strlen(src);
+  if (size > 0) {
+    size_t n = len < size - 1 ? len : size - 1;
+    memcpy(dst, src, n);
+    dst[n] = '\0';
+  }
+  return len;
+}
+
+/* ---- Tasks and queues ---- */
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name, uint32_t stack, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core) {
+  task_fn = task;
+  task_arg = arg;
+  if (handle != NULL)
+    *handle = (TaskHandle_t)&task_fn;
+  return pdPASS;
+}
+
+void vTaskDelay(TickType_t ticks) {
+  advance_to(now_us + ticks * 1000ull);
+}
+
+TickType_t xTaskGetTickCount() {
+  return (TickType_t)(now_us / 1000);
+}
+
+void xTaskNotifyGive(TaskHandle_t task) {
+  notified++;
+}
+
+/* The task sleeps here between cycles; this is also where the test stops it */
+static bool (*stop_when)() = NULL;
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks) {
+  if (stop_when != NULL && stop_when())
+    throw sim_stop_t();
+  uint64_t wake = now_us + ticks * 1000ull;
+  while (notified == 0 && now_us < wake)
+    advance_to(ui_tick != NULL ? min(wake, max(ui_due_us, now_us + 1)) : wake);
+  uint32_t n = notified;
+  notified = clear ? 0 : (n > 0 ? n - 1 : 0);
+  return n;
+}
+
+struct shim_queue {
+  std::vector<uint8_t> items;
+  UBaseType_t length;
+  UBaseType_t item_size;
+  UBaseType_t head;
+  UBaseType_t count;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+  shim_queue *q = new shim_queue;  // Once per queue at boot, like the firmware
+  q->items.resize(length * item_size);
+  q->length = length;
+  q->item_size = item_size;
+  q->head = 0;
+  q->count = 0;
+  return q;
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t ticks) {
+  if (q->count == q->length)
+    return pdFALSE;
+  memcpy(&q->items[((q->head + q->count) % q->length) * q->item_size], item, q->item_size);
+  q->count++;
+  return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t ticks) {
+  if (q->count == 0)
+    return pdFALSE;
+  memcpy(item, &q->items[q->head * q->item_size], q->item_size);
+  q->head = (q->head + 1) % q->length;
+  q->count--;
+  return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q) {
+  return q->count;
+}
+
+/* ---- Console output ---- */
+
+size_t Print::write(const uint8_t *buf, size_t len) {
+  for (size_t i = 0; i < len; i++)
+    write(buf[i]);
+  return len;
+}
+
+size_t Print::print(const char *s) {
+  return write((const uint8_t *)s, strlen(s));
+}
+
+size_t Print::println(const char *s) {
+  return print(s) + println();
+}
+
+size_t Print::println() {
+  return write('\n');
+}
+
+size_t Print::printf(const char *format, ...) {
+  char buf[256];
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(buf, sizeof(buf), format, args);
+  va_end(args);
+  return write((const uint8_t *)buf, min(len, (int)sizeof(buf) - 1));
+}
+
+size_t Stream::readBytesUntil(char terminator, char *buf, size_t len) {
+  size_t n = 0;
+  while (n < len) {
+    int c = read();
+    if (c < 0 || c == terminator)
+      break;
+    buf[n++] = c;
+  }
+  return n;
+}
+
+/* ---- RS485 line and slaves ---- */
+
+/* Time one character takes on the line */
+static uint32_t char_us() {
+  return 10000000u / baud;
+}
+
+void HardwareSerial::begin(unsigned long rate, uint32_t config, int8_t rx_pin, int8_t tx_pin) {
+  if (line)
+    baud = rate;
+}
+
+int HardwareSerial::available() {
+  if (!line || now_us < rx_ready_us)
+    return 0;
+  return rx_len - rx_pos;
+}
+
+int HardwareSerial::read() {
+  if (available() == 0)
+    return -1;
+  return rx[rx_pos++];
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+  if (!line) {
+    if (verbose)
+      putchar(c);
+    return 1;
+  }
+  if (tx_len < LINE_BUFFER)
+    tx[tx_len++] = c;
+  return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t *buf, size_t len) {
+  for (size_t i = 0; i < len; i++)
+    write(buf[i]);
+  return len;
+}
+
+static void line_frame(const uint8_t *frame, size_t len);
+
+/* The frame has left the UART: it takes its wire time, then the slaves see it */
+void HardwareSerial::flush() {
+  if (!line || tx_len == 0)
+    return;
+  advance_to(now_us + tx_len * char_us());
+  size_t len = tx_len;
+  tx_len = 0;
+  line_frame(tx, len);
+}
+
+/* Queue a reply with its CRC; it arrives after the turnaround and its own wire time */
+static void reply(const uint8_t *frame, size_t len, uint32_t turnaround_us) {
+  memcpy(rx, frame, len);
+  uint16_t crc = crc16(rx, len);
+  rx[len] = crc & 0xFF;
+  rx[len + 1] = crc >> 8;
+  rx_len = len + 2;
+  rx_pos = 0;
+  rx_ready_us = now_us + turnaround_us + rx_len * char_us();
+}
+
+/* Send an exception reply */
+static void exception(sim_slave_t &s, uint8_t function, uint8_t code, uint32_t turnaround_us) {
+  uint8_t frame[3] = {s.id, (uint8_t)(function | 0x80), code};
+  s.exceptions++;
+  reply(frame, sizeof(frame), turnaround_us);
+}
+
+/* Input registers change over time, each at its own rate, so polls keep finding news */
+static void update_inputs(sim_slave_t &s) {
+  uint32_t now_ms = now_us / 1000;
+  for (uint16_t i = 0; i < 64; i++)
+    s.input[i] = (now_ms / (250u * (i % 8 + 1))) + i;
+  if (s.plant_pv < SIM_REGISTERS && s.plant_out < SIM_REGISTERS) {
+    int32_t pv = s.input[s.plant_pv];
+    s.input[s.plant_pv] = pv + ((int32_t)s.holding[s.plant_out] - pv) / 16;  // First-order lag
+  }
+}
+
+/* Execute one request on one slave; replies unless it was a broadcast */
+static void execute(sim_slave_t &s, const uint8_t *frame, size_t len, bool broadcast) {
+  uint8_t function = frame[1];
+  uint16_t address = (frame[2] << 8) | frame[3];
+  uint16_t count = (frame[4] << 8) | frame[5];
+  uint32_t turnaround_us = s.latency_us + (s.jitter_us ? esp_random() % (s.jitter_us + 1) : 0);
+  uint8_t out[LINE_BUFFER];
+  s.requests++;
+
+  if ((function == 3 || function == 4) && !broadcast) {
+    if (count == 0 || count > 125 || address + count > SIM_REGISTERS) {
+      exception(s, function, 2, turnaround_us);
+      return;
+    }
+    update_inputs(s);
+    const uint16_t *regs = function == 3 ? s.holding : s.input;
+    out[0] = s.id;
+    out[1] = function;
+    out[2] = count * 2;
+    for (uint16_t i = 0; i < count; i++) {
+      out[3 + 2 * i] = regs[address + i] >> 8;
+      out[4 + 2 * i] = regs[address + i] & 0xFF;
+    }
+    s.reads++;
+    stats.reads++;
+    reply(out, 3 + 2 * count, turnaround_us + count * s.per_register_us);
+  } else if (function == 6 || function == 16) {
+    if (function == 6)
+      count = 1;
+    if (count == 0 || address + count > SIM_REGISTERS) {
+      if (!broadcast)
+        exception(s, function, 2, turnaround_us);
+      return;
+    }
+    if (function == 6)
+      s.holding[address] = (frame[4] << 8) | frame[5];
+    for (uint16_t i = 0; function == 16 && i < count; i++)
+      s.holding[address + i] = (frame[7 + 2 * i] << 8) | frame[8 + 2 * i];
+    s.writes++;
+    if (!broadcast)
+      reply(frame, 6, turnaround_us + count * s.per_register_us);  // Echo of address and count/value
+  } else if (function == 8 && !broadcast) {
+    uint16_t sub_function = address;
+    memcpy(out, frame, 6);
+    if (sub_function >= 11 && sub_function <= 13) {  // Bus message, CRC error, exception counters
+      uint32_t counter = sub_function == 11 ? s.requests : sub_function == 13 ? s.exceptions : 0;
+      out[4] = counter >> 8;
+      out[5] = counter & 0xFF;
+    } else if (sub_function != 0) {
+      exception(s, function, 1, turnaround_us);
+      return;
+    }
+    reply(out, 6, turnaround_us);
+  } else if (!broadcast) {
+    exception(s, function, 1, turnaround_us);
+  }
+}
+
+/* A complete frame from the panel: check it like a slave UART would, then execute it */
+static void line_frame(const uint8_t *frame, size_t len) {
+  rx_len = rx_pos = 0;
+  uint16_t crc = len >= 4 ? crc16(frame, len - 2) : 0;
+  if (len < 6 || frame[len - 2] != (crc & 0xFF) || frame[len - 1] != (crc >> 8))
+    return;  // Slaves ignore damaged frames
+
+  for (sim_slave_t &s : slaves) {
+    if (s.id == 0 || (frame[0] != s.id && frame[0] != 0))
+      continue;
+    if (s.loss_ppm != 0 && esp_random() % 1000000u < s.loss_ppm) {
+      s.lost++;
+      continue;
+    }
+    execute(s, frame, len, frame[0] == 0);
+  }
+}
+
+/* ---- ModbusMaster ---- */
+
+/* Send a request and wait for the reply, the way ModbusMaster does */
+uint8_t ModbusMaster::transact(const uint8_t *payload, size_t len, uint8_t function, uint8_t *reply_frame,
+                               size_t *reply_len) {
+  uint8_t frame[LINE_BUFFER];
+  frame[0] = slave;
+  frame[1] = function;
+  memcpy(frame + 2, payload, len);
+  uint16_t crc = crc16(frame, len + 2);
+  frame[len + 2] = crc & 0xFF;
+  frame[len + 3] = crc >> 8;
+  serial->write(frame, len + 4);
+  serial->flush();
+
+  uint32_t start_ms = millis();
+  while (serial->available() == 0) {
+    if (millis() - start_ms >= MODBUS_TIMEOUT_MS)
+      return ku8MBResponseTimedOut;
+    delayMicroseconds(MODBUS_WAIT_STEP_US);
+  }
+  size_t n = 0;
+  while (serial->available() > 0 && n < LINE_BUFFER)
+    reply_frame[n++] = serial->read();
+  *reply_len = n;
+
+  crc = crc16(reply_frame, n - 2);
+  if (n < 5 || reply_frame[n - 2] != (crc & 0xFF) || reply_frame[n - 1] != (crc >> 8))
+    return ku8MBInvalidCRC;
+  if (reply_frame[0] != slave)
+    return ku8MBInvalidSlaveID;
+  if (reply_frame[1] == (function | 0x80))
+    return reply_frame[2];  // Exception code
+  if (reply_frame[1] != function)
+    return ku8MBInvalidFunction;
+  return ku8MBSuccess;
+}
+
+uint8_t ModbusMaster::read(uint8_t function, uint16_t address, uint16_t count) {
+  uint8_t payload[4] = {(uint8_t)(address >> 8), (uint8_t)address, (uint8_t)(count >> 8), (uint8_t)count};
+  uint8_t frame[LINE_BUFFER];
+  size_t len;
+  uint8_t result = transact(payload, sizeof(payload), function, frame, &len);
+  if (result == ku8MBSuccess) {
+    for (uint16_t i = 0; i < count && i < 64; i++)
+      response[i] = (frame[3 + 2 * i] << 8) | frame[4 + 2 * i];
+  }
+  return result;
+}
+
+uint8_t ModbusMaster::writeSingleRegister(uint16_t address, uint16_t value) {
+  uint8_t payload[4] = {(uint8_t)(address >> 8), (uint8_t)address, (uint8_t)(value >> 8), (uint8_t)value};
+  uint8_t frame[LINE_BUFFER];
+  size_t len;
+  return transact(payload, sizeof(payload), 6, frame, &len);
+}
+
+uint8_t ModbusMaster::writeMultipleRegisters(uint16_t address, uint16_t count) {
+  uint8_t payload[5 + 2 * 64] = {(uint8_t)(address >> 8), (uint8_t)address, (uint8_t)(count >> 8), (uint8_t)count,
+                                 (uint8_t)(count * 2)};
+  for (uint16_t i = 0; i < count && i < 64; i++) {
+    payload[5 + 2 * i] = transmit[i] >> 8;
+    payload[6 + 2 * i] = transmit[i] & 0xFF;
+  }
+  uint8_t frame[LINE_BUFFER];
+  size_t len;
+  return transact(payload, 5 + 2 * count, 16, frame, &len);
+}
+
+uint8_t ModbusMaster::setTransmitBuffer(uint8_t index, uint16_t value) {
+  if (index >= 64)
+    return 0xE4;
+  transmit[index] = value;
+  return ku8MBSuccess;
+}
+
+/* ---- NVS and file system ---- */
+
+size_t Preferences::getBytes(const char *key, void *buf, size_t len) {
+  auto it = nvs.find(key);
+  if (it == nvs.end() || it->second.size() > len)
+    return 0;
+  memcpy(buf, it->second.data(), it->second.size());
+  return it->second.size();
+}
+
+size_t Preferences::putBytes(const char *key, const void *value, size_t len) {
+  nvs[key].assign((const uint8_t *)value, (const uint8_t *)value + len);
+  return len;
+}
+
+/* Empty RAM file system: every module runs on its built-in defaults */
+fs::FS &storage_fs() {
+  static fs::FS flash;
+  return flash;
+}
+
+/* ---- Simulation control ---- */
+
+void sim_reset() {
+  now_us = 0;
+  ui_due_us = 0;
+  ui_tick = NULL;
+  task_fn = NULL;
+  notified = 0;
+  random_state = 1;
+  memset(slaves, 0, sizeof(slaves));
+  memset(&stats, 0, sizeof(stats));
+  tx_len = rx_len = rx_pos = 0;
+  storage_fs().format();
+}
+
+sim_slave_t *sim_add_slave(uint8_t id) {
+  for (sim_slave_t &s : slaves) {
+    if (s.id != 0)
+      continue;
+    s.id = id;
+    s.latency_us = 3000;
+    s.per_register_us = 20;
+    s.plant_pv = s.plant_out = 0xFFFF;
+    return &s;
+  }
+  return NULL;
+}
+
+sim_slave_t *sim_find_slave(uint8_t id) {
+  for (sim_slave_t &s : slaves) {
+    if (s.id == id && id != 0)
+      return &s;
+  }
+  return NULL;
+}
+
+void sim_set_ui(void (*tick)()) {
+  ui_tick = tick;
+  ui_due_us = now_us;
+}
+
+void sim_run_task(bool (*done)()) {
+  stop_when = done;
+  try {
+    task_fn(task_arg);  // The firmware task never returns by itself
+  } catch (const sim_stop_t &) {
+  }
+  stop_when = NULL;
+}
+
+void sim_get_stats(sim_stats_t *out) {
+  *out = stats;
+}
+
+void sim_set_verbose(bool on) {
+  verbose = on;
+}
@@ -0,0 +1,57 @@
+/*
+ * Description:
+ * Simulation behind the host shims: virtual clock, RS485 line, simulated slaves and the
+ * UI loop.
+ *
+ * Everything runs on one host thread. The bus task is the firmware's own task function;
+ * when it blocks (ulTaskNotifyTake, vTaskDelay, the wait for a reply) the clock moves on
+ * and the UI loop runs every SIM_UI_PERIOD_US of virtual time, as loop() would on the
+ * other core. Frames on the line take their wire time at the configured baud rate, and
+ * each slave answers after a modelled latency, so the scheduler sees realistic timing
+ * while the run itself goes as fast as the host can compute it.
+ */
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <Arduino.h>
+
+#define SIM_MAX_SLAVES 4         // Slaves on the simulated line
+#define SIM_REGISTERS 1024       // Holding and input registers per slave
+#define SIM_UI_PERIOD_US 5000    // UI loop period, like the firmware's delay(5)
+
+/* One simulated slave */
+struct sim_slave_t {
+  uint8_t id;                    // Modbus slave ID, 0 = unused entry
+  uint32_t latency_us;           // Turnaround before the first reply byte
+  uint32_t per_register_us;      // Extra turnaround per register read or written
+  uint32_t jitter_us;            // Random extra turnaround, uniform 0..jitter_us
+  uint32_t loss_ppm;             // Requests silently dropped, per million
+  uint16_t plant_pv;             // Input register that follows plant_out, 0xFFFF = none
+  uint16_t plant_out;            // Holding register driving plant_pv
+  uint16_t holding[SIM_REGISTERS];
+  uint16_t input[SIM_REGISTERS];
+  uint32_t requests;             // Requests addressed to this slave, broadcasts included
+  uint32_t reads;                // FC03/FC04 requests answered
+  uint32_t writes;               // FC06/FC16 requests executed
+  uint32_t lost;                 // Requests dropped by loss_ppm
+  uint32_t exceptions;           // Exception replies sent
+};
+
+/* Counters of the whole simulation */
+struct sim_stats_t {
+  uint64_t reads;                // Read requests answered, all slaves
+  uint64_t ui_ticks;             // UI loop iterations run
+  uint64_t ui_real_ns;           // Host time spent in the UI loop
+};
+
+void sim_reset();                                  // Clock to zero, no slaves, no task
+sim_slave_t *sim_add_slave(uint8_t id);           // Add a slave with defaults and changing inputs
+sim_slave_t *sim_find_slave(uint8_t id);          // Slave by ID, or NULL
+uint64_t sim_now_us();                            // Virtual time
+void sim_set_ui(void (*tick)());                  // UI loop body, run every SIM_UI_PERIOD_US
+void sim_run_task(bool (*done)());                // Run the recorded firmware task until done() at a sleep
+void sim_get_stats(sim_stats_t *out);
+void sim_set_verbose(bool verbose);               // Echo firmware Serial output to stdout
+
+#endif
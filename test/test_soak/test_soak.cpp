@@ -0,0 +1,403 @@
+/*
+ * Description:
+ * Host soak test: the bus task, scheduler, tag cache, UI dispatch and register browser
+ * run against simulated slaves and a memory framebuffer for SOAK_POLLS poll cycles,
+ * with scripted taps, browser drags and register map reloads along the way.
+ *
+ * The run is cut into SOAK_WINDOWS windows of equal poll count. The first window is the
+ * warm-up and the second the baseline; the test fails if the last window drifts from
+ * the baseline beyond the SOAK_* limits below:
+ *   - LVGL heap in use and host heap in use, so slow leaks show up
+ *   - host time per rendered frame and per bus transaction, so gradual slowdowns do
+ *   - time per transaction on the simulated line and the oldest alarm value seen, so
+ *     scheduler drift does
+ *
+ *   pio test -e native -f test_soak
+ * Build with -DSOAK_POLLS=<n> for a longer or shorter run, -DSOAK_VERBOSE=1 to see the
+ * firmware's console output. -DSOAK_COMPILED_PLAN=1 (env:native-compiled) runs the same
+ * script on the poll plan generated from registers.csv: no tags are added and the map
+ * is never reloaded, so the bus polls what a stock panel polls.
+ */
+
+#include <Arduino.h>
+#include <lvgl.h>
+#include <malloc.h>
+#include <time.h>
+#include <unity.h>
+#include "browser.h"
+#include "bus.h"
+#include "config.h"
+#include "datalog.h"
+#include "sim.h"
+#include "storage.h"
+#include "tags.h"
+#include "ui_dispatch.h"
+
+#ifndef SOAK_POLLS
+#define SOAK_POLLS 2000000        // Reads answered by the simulated slaves over the whole run
+#endif
+#ifndef SOAK_VERBOSE
+#define SOAK_VERBOSE 0
+#endif
+#ifndef SOAK_COMPILED_PLAN
+#define SOAK_COMPILED_PLAN 0      // 1 = stay on the generated poll plan
+#endif
+#define SOAK_WINDOWS 10              // Measurement windows; 0 is warm-up, 1 the baseline
+#define SOAK_LV_GROWTH 512           // LVGL heap growth allowed, bytes
+#define SOAK_HOST_GROWTH 4096        // Host heap growth allowed, bytes
+#define SOAK_TIME_DRIFT_PCT 25       // Growth allowed in host time per frame and per transaction
+#define SOAK_TIME_SLACK_NS 2000      // Plus this much, so host noise on tiny costs does not fail the run
+#define SOAK_LINE_DRIFT_PCT 25       // Growth allowed in line time per transaction; lost replies make it vary
+#define SOAK_ALARM_AGE_MS (2000 + 4 * POLL_PERIOD_ALARM) // Oldest an alarm value may get; a lost reply
+                                                         // holds the bus for ModbusMaster's 2 s timeout
+#define SOAK_OPERATOR_AGE_MS (2000 + 4 * POLL_PERIOD_OPERATOR) // The same for the generated operator tag
+
+#define SCREEN_WIDTH 320
+#define SCREEN_HEIGHT 240
+#define BAUD 115200
+#define LABELS 8                     // Tags shown on the main screen
+#define TAP_PERIOD_MS 2000           // Setpoint button tapped this often
+#define BROWSE_PERIOD_MS 30000       // Browser opened this often
+#define BROWSE_OPEN_MS 6000          // and kept open for this long, dragged meanwhile
+#define RELOAD_PERIOD_MS 45000       // Register map reloaded this often
+#define PID_SLAVE 3
+#define PID_REGISTER 50              // Plant: input register follows the holding register
+
+/* What one window measured */
+struct window_t {
+  uint32_t lv_used;                  // LVGL heap in use at the end of the window
+  size_t host_used;                  // Host heap in use at the end of the window
+  uint64_t frame_ns;                 // Host time per rendered frame
+  uint64_t transaction_ns;           // Host time per bus transaction, UI excluded
+  uint32_t line_us;                  // Line time per transaction
+  uint32_t alarm_age_ms;             // Oldest watched value seen by the UI
+  uint32_t transactions;
+  uint32_t errors;
+  uint32_t frames;                   // Frames rendered
+};
+
+static window_t windows[SOAK_WINDOWS];
+static uint8_t window = 0;
+static uint64_t window_polls;        // Reads at the end of the current window
+static uint64_t window_start_ns;
+static sim_stats_t window_sim;
+static bus_stats_t window_bus;
+static uint32_t alarm_age_ms;
+static uint32_t flushes;             // Flushes to the framebuffer, several per frame
+static uint32_t frames;              // lv_timer_handler() calls that flushed
+static uint64_t frames_ns;           // Host time those calls took
+
+static lv_color_t framebuffer[SCREEN_WIDTH * SCREEN_HEIGHT];
+static lv_color_t draw_pixels[SCREEN_WIDTH * 10];
+static lv_disp_draw_buf_t draw_buf;
+static lv_point_t touch_point;
+static bool touch_pressed;
+
+static lv_obj_t *labels[TAG_MAX];
+static int watched_tags[4];          // Alarm tags, or the generated operator tag on the compiled plan
+static uint8_t watched_count;
+static int moving_tag;               // Tag a reload moves back and forth
+static uint16_t setpoint;
+static uint32_t samples;             // Samples handed to the data logger
+static uint32_t next_tap_ms = TAP_PERIOD_MS;
+static uint32_t next_browse_ms = BROWSE_PERIOD_MS;
+static uint32_t next_reload_ms = RELOAD_PERIOD_MS;
+static uint32_t browse_until_ms;     // Browser open until, 0 = closed
+static uint32_t reloads;
+
+/* The flash logger is not part of the run; count what it would have written */
+bool datalog_append(uint16_t tag, int32_t value) {
+  samples++;
+  return true;
+}
+
+static uint64_t host_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static size_t host_heap_used() {
+  return mallinfo2().uordblks;
+}
+
+static uint32_t lv_heap_used() {
+  lv_mem_monitor_t mon;
+  lv_mem_monitor(&mon);
+  return mon.total_size - mon.free_size;
+}
+
+/* Copy the rendered area into the framebuffer */
+static void flush_cb(lv_disp_drv_t *drv, const lv_area_t *area, lv_color_t *pixels) {
+  lv_coord_t width = area->x2 - area->x1 + 1;
+  for (lv_coord_t y = area->y1; y <= area->y2; y++) {
+    memcpy(&framebuffer[y * SCREEN_WIDTH + area->x1], pixels, width * sizeof(lv_color_t));
+    pixels += width;
+  }
+  flushes++;
+  lv_disp_flush_ready(drv);
+}
+
+/* Scripted touch input */
+static void touch_cb(lv_indev_drv_t *drv, lv_indev_data_t *data) {
+  data->point = touch_point;
+  data->state = touch_pressed ? LV_INDEV_STATE_PR : LV_INDEV_STATE_REL;
+}
+
+static void show_value(uint16_t id, const tag_value_t *value) {
+  tag_desc_t d;
+  if (labels[id] != NULL && tag_get_desc(id, &d))
+    lv_label_set_text_fmt(labels[id], "%s %d", d.name, (int)value->value);
+}
+
+/* Setpoint button: queue a write, as the keyboard does on the panel */
+static void setpoint_cb(lv_event_t *e) {
+  if (lv_event_get_code(e) == LV_EVENT_CLICKED)
+    bus_write(1, CONFIG_DEFAULT_SETPOINT_REG, ++setpoint);
+}
+
+/* Main screen: a label per shown tag and the setpoint button in the bottom-left corner */
+static void build_screen() {
+  lv_obj_t *scr = lv_scr_act();
+  uint8_t shown = 0;
+  for (uint16_t id = 0; id < tag_count() && shown < LABELS; id++) {
+    if (tag_desc(id)->function == TAG_FUNCTION_VIRTUAL)
+      continue;
+    labels[id] = lv_label_create(scr);
+    lv_obj_set_pos(labels[id], 10 + (shown % 2) * 150, 10 + (shown / 2) * 30);
+    lv_label_set_text(labels[id], "...");
+    ui_dispatch_bind(id, show_value);
+    shown++;
+  }
+  lv_obj_t *btn = lv_btn_create(scr);
+  lv_obj_set_pos(btn, 10, 180);
+  lv_obj_set_size(btn, 100, 40);
+  lv_obj_add_event_cb(btn, setpoint_cb, LV_EVENT_ALL, NULL);
+  lv_label_set_text(lv_label_create(btn), "Setpoint");
+}
+
+/* Add a polled tag with a generated name; names must outlive the table */
+static int add_tag(uint8_t slave, uint8_t function, uint16_t address, uint8_t poll_class) {
+  static char names[TAG_MAX][12];
+  uint16_t n = tag_count();
+  snprintf(names[n], sizeof(names[n]), "s%u_%c%u", slave, function == 4 ? 'i' : 'h', address);
+  tag_desc_t d = {names[n], slave, function, address, poll_class};
+  return tag_add(&d);
+}
+
+/* Tags on three slaves in every poll class, with gaps the planner coalesces across */
+static void add_tags() {
+  for (uint8_t i = 0; i < 4; i++)
+    watched_tags[watched_count++] = add_tag(1, 4, i, POLL_ALARM);
+  for (uint8_t i = 0; i < 10; i++)
+    add_tag(1, 4, 10 + i * 2, POLL_OPERATOR);
+  for (uint8_t i = 0; i < 12; i++)
+    add_tag(2, 3, 100 + i, POLL_TREND);
+  for (uint8_t i = 0; i < 8; i++)
+    add_tag(2, 4, i * 7, POLL_OPERATOR);
+  for (uint8_t i = 0; i < 6; i++)
+    add_tag(PID_SLAVE, 4, 20 + i, POLL_BACKGROUND);
+  moving_tag = add_tag(PID_SLAVE, 4, PID_REGISTER, POLL_TREND);
+}
+
+/* Swap a staged map that moves one tag, as a "tags reload" of an edited file does */
+static void reload_map() {
+  if (bus_reload_pending())
+    return;
+  uint16_t count;
+  tag_desc_t *table = tag_stage(&count);
+  table[moving_tag].address = table[moving_tag].address == PID_REGISTER ? PID_REGISTER + 1 : PID_REGISTER;
+  if (bus_reload(table, count))
+    reloads++;
+}
+
+/* The scripted operator: taps, browser sessions with drags, map reloads */
+static void script(uint32_t now_ms) {
+  static uint8_t tap_step = 0;
+  if (now_ms >= next_tap_ms && browse_until_ms == 0) {
+    touch_point = {60, 200};
+    touch_pressed = tap_step++ < 3;  // Held for three frames, then released
+    if (!touch_pressed) {
+      tap_step = 0;
+      next_tap_ms = now_ms + TAP_PERIOD_MS;
+    }
+  }
+
+  if (now_ms >= next_browse_ms && browse_until_ms == 0) {
+    browser_open(2, esp_random() % 2 ? 3 : 4, esp_random() % 900);
+    browse_until_ms = now_ms + BROWSE_OPEN_MS;
+    next_browse_ms += BROWSE_PERIOD_MS;
+  } else if (browse_until_ms != 0) {
+    uint32_t t = browse_until_ms - now_ms;  // Drag the table down, then back up
+    touch_pressed = t > 500;
+    touch_point = {150, (lv_coord_t)(t > BROWSE_OPEN_MS / 2 ? 60 + (BROWSE_OPEN_MS - t) / 20 : 60 + t / 20)};
+    if (now_ms >= browse_until_ms) {
+      browser_close();
+      browse_until_ms = 0;
+    }
+  }
+
+  if (!SOAK_COMPILED_PLAN && now_ms >= next_reload_ms) {
+    reload_map();
+    next_reload_ms += RELOAD_PERIOD_MS;
+  }
+}
+
+/* One iteration of the panel's loop() */
+static void ui_tick() {
+  uint32_t now_ms = millis();
+  script(now_ms);
+  ui_dispatch_drain();
+  lv_tick_inc(SIM_UI_PERIOD_US / 1000);
+  uint32_t before = flushes;
+  uint64_t start_ns = host_ns();
+  lv_timer_handler();
+  if (flushes != before) {
+    frames++;
+    frames_ns += host_ns() - start_ns;
+  }
+
+  for (uint8_t i = 0; i < watched_count; i++) {
+    tag_value_t v;
+    if (tag_read(watched_tags[i], &v) && v.quality != TAG_QUALITY_NONE)
+      alarm_age_ms = max(alarm_age_ms, now_ms - v.time_ms);
+  }
+}
+
+/* Close a window when its polls are done; the bus task stops after the last one */
+static bool window_done() {
+  sim_stats_t sim;
+  sim_get_stats(&sim);
+  if (sim.reads < window_polls)
+    return false;
+
+  bus_stats_t bus;
+  bus_get_stats(&bus);
+  uint64_t now_ns = host_ns();
+  window_t &w = windows[window];
+  w.lv_used = lv_heap_used();
+  w.host_used = host_heap_used();
+  w.transactions = bus.transactions - window_bus.transactions;
+  w.errors = bus.errors - window_bus.errors;
+  w.frames = frames;
+  w.frame_ns = frames ? frames_ns / frames : 0;
+  uint64_t ui_ns = sim.ui_real_ns - window_sim.ui_real_ns;
+  w.transaction_ns = w.transactions ? (now_ns - window_start_ns - ui_ns) / w.transactions : 0;
+  w.line_us = w.transactions ? (bus.busy_us - window_bus.busy_us) / w.transactions : 0;
+  w.alarm_age_ms = alarm_age_ms;
+  printf("window %u: lv %u B, host %zu B, frame %llu ns, transaction %llu ns / %u us on the line, "
+         "alarm age %u ms, %u transactions, %u errors, %u frames\n",
+         window, w.lv_used, w.host_used, (unsigned long long)w.frame_ns, (unsigned long long)w.transaction_ns,
+         w.line_us, w.alarm_age_ms, w.transactions, w.errors, w.frames);
+
+  window_bus = bus;
+  window_sim = sim;
+  window_start_ns = now_ns;
+  window_polls += SOAK_POLLS / SOAK_WINDOWS;
+  alarm_age_ms = 0;
+  frames = 0;
+  frames_ns = 0;
+  return ++window == SOAK_WINDOWS;
+}
+
+/* Boot the panel the way setup() does, minus flash and display hardware */
+static void boot() {
+  sim_reset();
+  sim_set_verbose(SOAK_VERBOSE);
+  for (uint8_t id = 1; id <= 3; id++) {
+    sim_slave_t *s = sim_add_slave(id);
+    s->latency_us = 2000 + id * 1000;
+    s->jitter_us = 1500;
+    s->loss_ppm = 200;  // The odd lost frame keeps the retry and error paths in the run
+  }
+  sim_slave_t *plant = sim_find_slave(PID_SLAVE);
+  plant->plant_pv = PID_REGISTER;
+  plant->plant_out = PID_REGISTER;
+
+  config_begin();
+  panel_config_t cfg = config_get();
+  cfg.baud = BAUD;
+  cfg.pid_period_ms = 200;
+  cfg.pid_slave = PID_SLAVE;
+  cfg.pid_pv_function = 4;
+  cfg.pid_pv_reg = PID_REGISTER;
+  cfg.pid_out_reg = PID_REGISTER;
+  cfg.pid_setpoint = 500;
+  cfg.pid_kp = 50;
+  cfg.pid_ki = 20;
+  TEST_ASSERT_TRUE(config_update(&cfg));
+
+  lv_init();
+  lv_disp_draw_buf_init(&draw_buf, draw_pixels, NULL, SCREEN_WIDTH * 10);
+  static lv_disp_drv_t disp_drv;
+  lv_disp_drv_init(&disp_drv);
+  disp_drv.hor_res = SCREEN_WIDTH;
+  disp_drv.ver_res = SCREEN_HEIGHT;
+  disp_drv.flush_cb = flush_cb;
+  disp_drv.draw_buf = &draw_buf;
+  lv_disp_drv_register(&disp_drv);
+  static lv_indev_drv_t indev_drv;
+  lv_indev_drv_init(&indev_drv);
+  indev_drv.type = LV_INDEV_TYPE_POINTER;
+  indev_drv.read_cb = touch_cb;
+  lv_indev_drv_register(&indev_drv);
+
+#if SOAK_COMPILED_PLAN
+  watched_tags[watched_count++] = TAG_PLC_DATA;
+#else
+  add_tags();
+#endif
+  build_screen();
+  TEST_ASSERT_TRUE(bus_begin());
+  browser_begin();
+  sim_set_ui(ui_tick);
+}
+
+/* Growth from the baseline to the last window within pct percent plus slack */
+static void assert_drift(const char *what, uint64_t baseline, uint64_t last, uint32_t pct, uint64_t slack) {
+  char msg[96];
+  snprintf(msg, sizeof(msg), "%s drifted from %llu to %llu", what, (unsigned long long)baseline,
+           (unsigned long long)last);
+  TEST_ASSERT_TRUE_MESSAGE(last <= baseline + baseline * pct / 100 + slack, msg);
+}
+
+static void test_soak() {
+  boot();
+  window_polls = SOAK_POLLS / SOAK_WINDOWS;
+  window_start_ns = host_ns();
+  sim_run_task(window_done);
+  TEST_ASSERT_EQUAL(SOAK_WINDOWS, window);
+
+  const window_t &base = windows[1];
+  const window_t &last = windows[SOAK_WINDOWS - 1];
+  printf("%u reloads, %u setpoint writes, %u samples logged, %.1f h simulated\n", reloads, setpoint, samples,
+         sim_now_us() / 3.6e9);
+  uint8_t blocks;
+  const uint16_t *plan_tags;
+  if (SOAK_COMPILED_PLAN)
+    TEST_ASSERT_NOT_NULL(tag_compiled_plan(&blocks, &plan_tags));  // Nothing replaced the generated plan
+  else
+    TEST_ASSERT_GREATER_THAN(0, reloads);
+  TEST_ASSERT_GREATER_THAN(0, setpoint);
+  TEST_ASSERT_LESS_THAN(last.transactions / 100 + 1, last.errors);  // Loss only, no timeouts piling up
+
+  assert_drift("LVGL heap", base.lv_used, last.lv_used, 0, SOAK_LV_GROWTH);
+  assert_drift("Host heap", base.host_used, last.host_used, 0, SOAK_HOST_GROWTH);
+  assert_drift("Frame time (ns)", base.frame_ns, last.frame_ns, SOAK_TIME_DRIFT_PCT, SOAK_TIME_SLACK_NS);
+  assert_drift("Transaction time (ns)", base.transaction_ns, last.transaction_ns, SOAK_TIME_DRIFT_PCT,
+               SOAK_TIME_SLACK_NS);
+  assert_drift("Line time per transaction (us)", base.line_us, last.line_us, SOAK_LINE_DRIFT_PCT, 0);
+  uint32_t age_limit_ms = SOAK_COMPILED_PLAN ? SOAK_OPERATOR_AGE_MS : SOAK_ALARM_AGE_MS;
+  for (uint8_t i = 1; i < SOAK_WINDOWS; i++)
+    TEST_ASSERT_LESS_OR_EQUAL(age_limit_ms, windows[i].alarm_age_ms);
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_soak);
+  return UNITY_END();
+}
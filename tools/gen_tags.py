@@ -0,0 +1,197 @@
+#!/usr/bin/env python3
+"""
+Generate the compiled-in tag table from the CSV register map.
+
+Usage: gen_tags.py [registers.csv]
+
+Runs before every PlatformIO build (extra_scripts = pre:tools/gen_tags.py) and can be
+run by hand. Each row of registers.csv describes one polled tag:
+
+  name,slave,function,address,class,description
+
+slave 0 stands for the configured slave ID, function is 3 or 4, the address may be
+written in hex and class is alarm, operator, trend or background. The script checks
+every row, coalesces the tags into the poll plan the bus task would build and writes
+
+  include/generated/tag_ids.h    tag ID enum, included by tags.h
+  include/generated/tag_table.h  constexpr descriptors and the plan, for tags.cpp
+
+Any error stops the build. Files are only rewritten when their content changes, so
+an unchanged map does not trigger a rebuild. TAG_MAX and the plan limits are read from
+the firmware headers.
+"""
+
+import csv
+import os
+import re
+import sys
+
+CLASSES = ["alarm", "operator", "trend", "background"]
+CLASS_ENUMS = ["POLL_ALARM", "POLL_OPERATOR", "POLL_TREND", "POLL_BACKGROUND"]
+NAME_LEN = 15   # TAGMAP_NAME_LEN without the terminator
+
+
+class MapError(Exception):
+    pass
+
+
+def header_define(path, name):
+    """Value of a numeric #define in a firmware header."""
+    with open(path) as f:
+        m = re.search(r"#define\s+%s\s+(\d+)" % name, f.read())
+    if m is None:
+        raise MapError("%s: no #define %s" % (path, name))
+    return int(m.group(1))
+
+
+def parse_int(text, what, lo, hi, where):
+    try:
+        value = int(text.strip(), 0)
+    except ValueError:
+        raise MapError("%s: %s %r is not a number" % (where, what, text))
+    if not lo <= value <= hi:
+        raise MapError("%s: %s %d outside %d-%d" % (where, what, value, lo, hi))
+    return value
+
+
+def read_map(path, tag_max):
+    """List of tag dicts in file order."""
+    tags = []
+    names = {}
+    registers = {}
+    with open(path, newline="") as f:
+        rows = csv.reader(f)
+        header = next(rows, None)
+        if header is None or [h.strip() for h in header[:5]] != ["name", "slave", "function", "address", "class"]:
+            raise MapError("%s:1: header must be name,slave,function,address,class[,description]" % path)
+        for row in rows:
+            where = "%s:%d" % (path, rows.line_num)
+            if not row or row[0].strip().startswith("#"):
+                continue
+            if len(row) < 5:
+                raise MapError("%s: expected at least 5 columns" % where)
+            name = row[0].strip()
+            if not re.fullmatch(r"[a-z][a-z0-9_]*", name) or len(name) > NAME_LEN:
+                raise MapError("%s: name %r must be a lower case identifier of up to %d characters"
+                               % (where, name, NAME_LEN))
+            if name in names:
+                raise MapError("%s: %s already defined on line %d" % (where, name, names[name]))
+            slave = parse_int(row[1], "slave", 0, 247, where)
+            function = parse_int(row[2], "function", 3, 4, where)
+            address = parse_int(row[3], "address", 0, 0xFFFF, where)
+            poll_class = row[4].strip()
+            if poll_class not in CLASSES:
+                raise MapError("%s: class %r is not one of %s" % (where, poll_class, ", ".join(CLASSES)))
+            register = (slave, function, address)
+            if register in registers:
+                raise MapError("%s: register %d:fc%d:0x%04X already used by %s"
+                               % (where, slave, function, address, registers[register]))
+            names[name] = rows.line_num
+            registers[register] = name
+            tags.append({"name": name, "slave": slave, "function": function, "address": address,
+                         "class": CLASSES.index(poll_class),
+                         "description": row[5].strip() if len(row) > 5 else ""})
+    if not tags:
+        raise MapError("%s: no tags" % path)
+    if len(tags) > tag_max:
+        raise MapError("%s: %d tags, the cache holds TAG_MAX = %d" % (path, len(tags), tag_max))
+    return tags
+
+
+def plan(tags, max_blocks, max_read, gap):
+    """Coalesce the tags into reads the way bus.cpp build_plan() does; returns
+    (blocks, ordered tag IDs)."""
+    order = sorted(range(len(tags)), key=lambda i: (tags[i]["slave"], tags[i]["function"],
+                                                    tags[i]["class"], tags[i]["address"]))
+    blocks = []
+    for pos, i in enumerate(order):
+        t = tags[i]
+        b = blocks[-1] if blocks else None
+        joins = (b is not None and b["slave"] == t["slave"] and b["function"] == t["function"] and
+                 b["class"] == t["class"] and t["address"] <= b["start"] + b["count"] + gap and
+                 t["address"] - b["start"] < max_read)
+        if not joins:
+            b = {"slave": t["slave"], "function": t["function"], "class": t["class"],
+                 "start": t["address"], "count": 0, "first": pos, "tags": 0}
+            blocks.append(b)
+        b["count"] = max(b["count"], t["address"] - b["start"] + 1)
+        b["tags"] += 1
+    if len(blocks) > max_blocks:
+        raise MapError("register map needs %d reads, the bus task plans BUS_MAX_BLOCKS = %d"
+                       % (len(blocks), max_blocks))
+    return blocks, order
+
+
+def render_ids(tags, source):
+    lines = ["/* Generated by tools/gen_tags.py from %s; do not edit */" % source, "",
+             "#ifndef TAG_IDS_H", "#define TAG_IDS_H", "",
+             "/* Compiled-in tags, in register map order */", "enum {"]
+    width = max(len(t["name"]) for t in tags) + 4 + len(" = 999,")
+    for i, t in enumerate(tags):
+        entry = "  TAG_%s = %d," % (t["name"].upper(), i)
+        lines.append(entry.ljust(width + 2) + ("// " + t["description"] if t["description"] else "").rstrip())
+    lines += ["  TAG_BUILTIN_COUNT", "};", "", "#endif", ""]
+    return "\n".join(line.rstrip() for line in lines)
+
+
+def render_table(tags, blocks, order, source):
+    lines = ["/* Generated by tools/gen_tags.py from %s; do not edit */" % source, "",
+             "#ifndef TAG_TABLE_H", "#define TAG_TABLE_H", "",
+             '#include "tags.h"', "",
+             "/* Descriptors of the compiled-in tags, by tag ID */",
+             "#define TAG_GENERATED_DESCRIPTORS \\"]
+    for t in tags:
+        lines.append('  {"%s", %d, %d, 0x%04X, %s}, \\' % (t["name"], t["slave"], t["function"],
+                                                         t["address"], CLASS_ENUMS[t["class"]]))
+    lines += ["", "static constexpr tag_desc_t tag_generated[] = {TAG_GENERATED_DESCRIPTORS};", "",
+              "/* Coalesced reads of the compiled-in tags */",
+              "static constexpr tag_block_t tag_generated_plan[] = {"]
+    for b in blocks:
+        lines.append("  {%d, %d, %s, 0x%04X, %d, %d, %d}," % (b["slave"], b["function"], CLASS_ENUMS[b["class"]],
+                                                              b["start"], b["count"], b["first"], b["tags"]))
+    lines += ["};", "",
+              "/* Tag IDs ordered by block */",
+              "static constexpr uint16_t tag_generated_plan_tags[] = {%s};" % ", ".join(str(i) for i in order),
+              "", "#endif", ""]
+    return "\n".join(lines)
+
+
+def write_if_changed(path, text):
+    old = None
+    if os.path.exists(path):
+        with open(path) as f:
+            old = f.read()
+    if old != text:
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        with open(path, "w") as f:
+            f.write(text)
+
+
+def generate(project_dir, csv_path):
+    include = os.path.join(project_dir, "include")
+    tag_max = header_define(os.path.join(include, "tags.h"), "TAG_MAX")
+    bus_h = os.path.join(include, "bus.h")
+    tags = read_map(csv_path, tag_max)
+    blocks, order = plan(tags, header_define(bus_h, "BUS_MAX_BLOCKS"), header_define(bus_h, "BUS_MAX_READ"),
+                         header_define(bus_h, "BUS_COALESCE_GAP"))
+    source = os.path.relpath(csv_path, project_dir)
+    write_if_changed(os.path.join(include, "generated", "tag_ids.h"), render_ids(tags, source))
+    write_if_changed(os.path.join(include, "generated", "tag_table.h"), render_table(tags, blocks, order, source))
+    print("%s: %d tags in %d reads" % (source, len(tags), len(blocks)))
+
+
+try:
+    Import("env")  # noqa: F821 - defined when PlatformIO runs this as an extra script
+    project = env.subst("$PROJECT_DIR")  # noqa: F821
+    try:
+        generate(project, os.path.join(project, "registers.csv"))
+    except (MapError, OSError) as e:
+        sys.stderr.write("error: %s\n" % e)
+        env.Exit(1)  # noqa: F821
+except NameError:
+    if __name__ == "__main__":
+        project = os.path.dirname(os.path.dirname(os.path.abspath(sys.argv[0])))
+        try:
+            generate(project, sys.argv[1] if len(sys.argv) > 1 else os.path.join(project, "registers.csv"))
+        except (MapError, OSError) as e:
+            sys.exit("error: %s" % e)
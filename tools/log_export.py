@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+"""
+Receive one log segment from the panel over USB Serial.
+
+Usage: log_export.py <port> <tier r|m|h> <seq> <output file>
+
+Sends "log export" to the panel console and appends the payload of every CRC-checked
+frame to the output file. Each ACK carries the low byte of the chunk it acknowledges,
+so the panel never moves past a chunk that is not on disk. If the transfer breaks off,
+run the script again with the same output file: it resumes at the first chunk that is
+not yet on disk.
+Requires pyserial.
+"""
+
+import os
+import struct
+import sys
+
+import serial
+
+CHUNK = 128          # LOG_EXPORT_CHUNK on the panel
+ACK, NAK = b"\x06", b"\x15"
+
+
+def crc16(data):
+    crc = 0xFFFF
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0xA001 if crc & 1 else crc >> 1
+    return crc
+
+
+def read_frame(port):
+    """Return (chunk, payload) of the next valid frame, or None on timeout."""
+    while True:
+        b = port.read(1)
+        if not b:
+            return None
+        if b != b"\xA5" or port.read(1) != b"\x5A":
+            continue  # Console text or noise between frames
+        header = port.read(8)
+        if len(header) < 8:
+            return None
+        tier, seq, chunk, length = struct.unpack("<BIHB", header)
+        rest = port.read(length + 2)
+        if len(rest) < length + 2:
+            return None
+        payload, crc = rest[:length], struct.unpack("<H", rest[length:])[0]
+        if crc16(header + payload) != crc:
+            port.write(NAK)
+            continue
+        return chunk, payload
+
+
+def main():
+    if len(sys.argv) != 5:
+        sys.exit(__doc__)
+    port_name, tier, seq, out_name = sys.argv[1:]
+
+    done = os.path.getsize(out_name) // CHUNK if os.path.exists(out_name) else 0
+    with open(out_name, "ab") as out, serial.Serial(port_name, 115200, timeout=2) as port:
+        out.truncate(done * CHUNK)  # Drop a partial trailing chunk
+        port.write(f"log export {tier} {seq} {done}\n".encode())
+        while True:
+            frame = read_frame(port)
+            if frame is None:
+                sys.exit(f"Transfer stalled after chunk {done}; run again to resume")
+            chunk, payload = frame
+            if chunk > done:
+                if not payload:
+                    sys.exit(f"End frame at chunk {chunk} but only {done} chunks received; run again to resume")
+                port.write(NAK)  # Ahead of the file: ask for the frame again
+                continue
+            if chunk == done and payload:
+                out.write(payload)
+                done += 1
+            # A duplicate of a stored chunk is acknowledged again, with its own number
+            port.write(ACK + bytes([chunk & 0xFF]))
+            if not payload:
+                break
+    print(f"Received {done} chunks into {out_name}")
+
+
+if __name__ == "__main__":
+    main()